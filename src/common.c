@@ -15,6 +15,7 @@
 /* You should have received a copy of the GNU General Public License     */
 /* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
 
+#include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <math.h>
@@ -109,3 +110,39 @@ double rc_window(double t, double left, double width, double rise)
 	return(r);
 }
 
+/* fputs() a string with JSON-style escape sequences */
+int fputs_json(const char *str, FILE *stream)
+{
+	int c;
+	
+	for(c = 0; *str; str++)
+	{
+		const char *s = NULL;
+		int r;
+		
+		switch(*str)
+		{
+		case '"': s = "\\\""; break;
+		case '\\': s = "\\\\"; break;
+		//case '/': s = "\\/"; break;
+		case '\b': s = "\\b"; break;
+		case '\f': s = "\\f"; break;
+		case '\n': s = "\\n"; break;
+		case '\r': s = "\\r"; break;
+		case '\t': s = "\\t"; break;
+		}
+		
+		if(s) r = fputs(s, stream);
+		else r = fputc(*str, stream) == EOF ? EOF : 1;
+		
+		if(r == EOF)
+		{
+			return(c > 0 ? c : EOF);
+		}
+		
+		c += r;
+	}
+	
+	return(c);
+}
+
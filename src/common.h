@@ -18,6 +18,7 @@
 #ifndef _COMMON_H
 #define _COMMON_H
 
+#include <stdio.h>
 #include <stdint.h>
 
 /* These factors where calculated with: f = M_PI / 2.0 / asin(0.9 - 0.1); */
@@ -46,6 +47,7 @@ extern int rational_cmp(rational_t a, rational_t b);
 extern rational_t rational_nearest(rational_t ref, rational_t a, rational_t b);
 extern cint16_t *sin_cint16(unsigned int length, unsigned int cycles, double level);
 extern double rc_window(double t, double left, double width, double rise);
+extern int fputs_json(const char *str, FILE *stream);
 
 static inline void cint16_mul(cint16_t *r, const cint16_t *a, const cint16_t *b)
 {
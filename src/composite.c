@@ -0,0 +1,428 @@
+/* hacktv - Analogue video transmitter for the HackRF                    */
+/*=======================================================================*/
+/* Copyright 2023 Philip Heron <phil@sanslogic.co.uk>                    */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* (at your option) any later version.                                   */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+/* Kernels for building the composite PAL/NTSC line: converting the
+ * RGB pixels to YIQ, copying the luminance and chrominance out of the
+ * converted YIQ samples, and mixing the chrominance with the colour
+ * subcarrier.
+ * 
+ * Each SIMD version gives exactly the same result as the scalar
+ * version. The sum in the mixer is done in 32 bits and the result
+ * truncated to 16 bits, as the C code does. The subcarrier lookup
+ * never holds INT16_MIN, so negating it for the PAL V-switch can't
+ * overflow.
+ * 
+ * The RGB to YIQ conversion is nine table loads per pixel. Only AVX2
+ * has gathers to do those several pixels at a time, the SSE2 and SSSE3
+ * versions would be scalar loads feeding a few vector adds, and use
+ * the C version. The full level lookup used without --compact-colour
+ * is a single load per pixel from a 96 MiB table, and stays scalar.
+*/
+
+#include <stdint.h>
+#include "common.h"
+#include "cpu.h"
+#include "composite.h"
+
+#ifdef CPU_X86
+#include <immintrin.h>
+#endif
+
+/* -=== Scalar reference ===- */
+
+static void _luma_c(int16_t *o, const int16_t *yiq, int n)
+{
+	int x;
+	
+	for(x = 0; x < n; x++)
+	{
+		o[x * 2] = yiq[x * 3];
+	}
+}
+
+static void _chroma_c(int16_t *oc, const int16_t *yiq, int n)
+{
+	int x;
+	
+	for(x = 0; x < n; x++)
+	{
+		oc[x * 2 + 0] = yiq[x * 3 + 1];
+		oc[x * 2 + 1] = yiq[x * 3 + 2];
+	}
+}
+
+static void _mix_c(int16_t *o, const int16_t *oc, const cint16_t *lut, int n, int pal)
+{
+	int x;
+	
+	for(x = 0; x < n; x++, o += 2, oc += 2)
+	{
+		*o += (oc[0] * lut[x].q +
+		       oc[1] * lut[x].i * pal) >> 15;
+	}
+}
+
+static void _yiq_c(int16_t *yiq, const uint32_t *rgb, int stride, const int32_t *lut, int n)
+{
+	const int32_t *r, *g, *b;
+	int32_t v;
+	int x, k;
+	
+	for(x = 0; x < n; x++, rgb += stride, yiq += 3)
+	{
+		r = &lut[(0x000 + ((*rgb >> 16) & 0xFF)) * 3];
+		g = &lut[(0x100 + ((*rgb >> 8) & 0xFF)) * 3];
+		b = &lut[(0x200 + ((*rgb >> 0) & 0xFF)) * 3];
+		
+		for(k = 0; k < 3; k++)
+		{
+			v = r[k] + g[k] + b[k];
+			v = (v + (1 << (COMPOSITE_YIQ_SHIFT - 1))) >> COMPOSITE_YIQ_SHIFT;
+			yiq[k] = v < -INT16_MAX ? -INT16_MAX : (v > INT16_MAX ? INT16_MAX : v);
+		}
+	}
+}
+
+const composite_kernels_t composite_scalar = {
+	"scalar", _luma_c, _chroma_c, _mix_c, _yiq_c
+};
+
+#ifdef CPU_X86
+
+/* -=== x86 ===- */
+
+/* pshufb masks to pick the Y, I and Q values of eight packed
+ * YIQ samples out of three registers (words 0-7, 8-15, 16-23) */
+static const int8_t _yiq_shuf[9][16] __attribute__((aligned(16))) = {
+	/* Y */
+	{  0, 1, 6, 7,12,13,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1 },
+	{ -1,-1,-1,-1,-1,-1, 2, 3, 8, 9,14,15,-1,-1,-1,-1 },
+	{ -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1, 4, 5,10,11 },
+	/* I */
+	{  2, 3, 8, 9,14,15,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1 },
+	{ -1,-1,-1,-1,-1,-1, 4, 5,10,11,-1,-1,-1,-1,-1,-1 },
+	{ -1,-1,-1,-1,-1,-1,-1,-1,-1,-1, 0, 1, 6, 7,12,13 },
+	/* Q */
+	{  4, 5,10,11,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1 },
+	{ -1,-1,-1,-1, 0, 1, 6, 7,12,13,-1,-1,-1,-1,-1,-1 },
+	{ -1,-1,-1,-1,-1,-1,-1,-1,-1,-1, 2, 3, 8, 9,14,15 },
+};
+
+__attribute__((target("ssse3")))
+static inline __m128i _pick_ssse3(__m128i a, __m128i b, __m128i c, int ch)
+{
+	const __m128i *m = (const __m128i *) _yiq_shuf[ch * 3];
+	
+	return(_mm_or_si128(
+		_mm_or_si128(
+			_mm_shuffle_epi8(a, _mm_load_si128(&m[0])),
+			_mm_shuffle_epi8(b, _mm_load_si128(&m[1]))
+		),
+		_mm_shuffle_epi8(c, _mm_load_si128(&m[2]))
+	));
+}
+
+__attribute__((target("ssse3")))
+static void _luma_ssse3(int16_t *o, const int16_t *yiq, int n)
+{
+	const __m128i keep = _mm_set1_epi32(0xFFFF0000);
+	const __m128i zero = _mm_setzero_si128();
+	__m128i a, b, c, y;
+	int x;
+	
+	for(x = 0; x + 8 <= n; x += 8, yiq += 24, o += 16)
+	{
+		a = _mm_loadu_si128((const __m128i *) &yiq[0]);
+		b = _mm_loadu_si128((const __m128i *) &yiq[8]);
+		c = _mm_loadu_si128((const __m128i *) &yiq[16]);
+		y = _pick_ssse3(a, b, c, 0);
+		
+		a = _mm_and_si128(_mm_loadu_si128((__m128i *) &o[0]), keep);
+		b = _mm_and_si128(_mm_loadu_si128((__m128i *) &o[8]), keep);
+		_mm_storeu_si128((__m128i *) &o[0], _mm_or_si128(a, _mm_unpacklo_epi16(y, zero)));
+		_mm_storeu_si128((__m128i *) &o[8], _mm_or_si128(b, _mm_unpackhi_epi16(y, zero)));
+	}
+	
+	_luma_c(o, yiq, n - x);
+}
+
+__attribute__((target("ssse3")))
+static void _chroma_ssse3(int16_t *oc, const int16_t *yiq, int n)
+{
+	__m128i a, b, c, i, q;
+	int x;
+	
+	for(x = 0; x + 8 <= n; x += 8, yiq += 24, oc += 16)
+	{
+		a = _mm_loadu_si128((const __m128i *) &yiq[0]);
+		b = _mm_loadu_si128((const __m128i *) &yiq[8]);
+		c = _mm_loadu_si128((const __m128i *) &yiq[16]);
+		i = _pick_ssse3(a, b, c, 1);
+		q = _pick_ssse3(a, b, c, 2);
+		
+		_mm_storeu_si128((__m128i *) &oc[0], _mm_unpacklo_epi16(i, q));
+		_mm_storeu_si128((__m128i *) &oc[8], _mm_unpackhi_epi16(i, q));
+	}
+	
+	_chroma_c(oc, yiq, n - x);
+}
+
+__attribute__((target("sse2")))
+static void _mix_sse2(int16_t *o, const int16_t *oc, const cint16_t *lut, int n, int pal)
+{
+	/* The lookup is swapped to (q, i) pairs so a single pmaddwd
+	 * gives oc[0] * q + oc[1] * i for each sample. For pal == -1
+	 * the i value is negated with (v ^ m) - m */
+	const __m128i neg = pal < 0 ? _mm_set1_epi32(0xFFFF0000) : _mm_setzero_si128();
+	const __m128i low = _mm_set1_epi32(0x0000FFFF);
+	__m128i l, r;
+	int x;
+	
+	for(x = 0; x + 4 <= n; x += 4, o += 8, oc += 8)
+	{
+		l = _mm_loadu_si128((const __m128i *) &lut[x]);
+		l = _mm_shufflehi_epi16(_mm_shufflelo_epi16(l, 0xB1), 0xB1);
+		l = _mm_sub_epi16(_mm_xor_si128(l, neg), neg);
+		
+		r = _mm_madd_epi16(_mm_loadu_si128((const __m128i *) oc), l);
+		r = _mm_and_si128(_mm_srai_epi32(r, 15), low);
+		
+		_mm_storeu_si128((__m128i *) o, _mm_add_epi16(_mm_loadu_si128((__m128i *) o), r));
+	}
+	
+	_mix_c(o, oc, &lut[x], n - x, pal);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i _load2_avx2(const int16_t *lo, const int16_t *hi)
+{
+	return(_mm256_inserti128_si256(
+		_mm256_castsi128_si256(_mm_loadu_si128((const __m128i *) lo)),
+		_mm_loadu_si128((const __m128i *) hi), 1
+	));
+}
+
+__attribute__((target("avx2")))
+static inline __m256i _pick_avx2(__m256i a, __m256i b, __m256i c, int ch)
+{
+	const __m128i *m = (const __m128i *) _yiq_shuf[ch * 3];
+	
+	return(_mm256_or_si256(
+		_mm256_or_si256(
+			_mm256_shuffle_epi8(a, _mm256_broadcastsi128_si256(_mm_load_si128(&m[0]))),
+			_mm256_shuffle_epi8(b, _mm256_broadcastsi128_si256(_mm_load_si128(&m[1])))
+		),
+		_mm256_shuffle_epi8(c, _mm256_broadcastsi128_si256(_mm_load_si128(&m[2])))
+	));
+}
+
+/* The AVX2 shuffles work within each 128-bit lane, so the low lane
+ * takes samples 0-7 and the high lane samples 8-15. The unpacked
+ * results are put back in order with vperm2i128 */
+
+__attribute__((target("avx2")))
+static void _luma_avx2(int16_t *o, const int16_t *yiq, int n)
+{
+	const __m256i keep = _mm256_set1_epi32(0xFFFF0000);
+	const __m256i zero = _mm256_setzero_si256();
+	__m256i a, b, c, y, lo, hi;
+	int x;
+	
+	for(x = 0; x + 16 <= n; x += 16, yiq += 48, o += 32)
+	{
+		a = _load2_avx2(&yiq[0], &yiq[24]);
+		b = _load2_avx2(&yiq[8], &yiq[32]);
+		c = _load2_avx2(&yiq[16], &yiq[40]);
+		y = _pick_avx2(a, b, c, 0);
+		
+		lo = _mm256_unpacklo_epi16(y, zero);
+		hi = _mm256_unpackhi_epi16(y, zero);
+		
+		a = _mm256_and_si256(_mm256_loadu_si256((__m256i *) &o[0]), keep);
+		b = _mm256_and_si256(_mm256_loadu_si256((__m256i *) &o[16]), keep);
+		_mm256_storeu_si256((__m256i *) &o[0], _mm256_or_si256(a, _mm256_permute2x128_si256(lo, hi, 0x20)));
+		_mm256_storeu_si256((__m256i *) &o[16], _mm256_or_si256(b, _mm256_permute2x128_si256(lo, hi, 0x31)));
+	}
+	
+	_luma_ssse3(o, yiq, n - x);
+}
+
+__attribute__((target("avx2")))
+static void _chroma_avx2(int16_t *oc, const int16_t *yiq, int n)
+{
+	__m256i a, b, c, i, q, lo, hi;
+	int x;
+	
+	for(x = 0; x + 16 <= n; x += 16, yiq += 48, oc += 32)
+	{
+		a = _load2_avx2(&yiq[0], &yiq[24]);
+		b = _load2_avx2(&yiq[8], &yiq[32]);
+		c = _load2_avx2(&yiq[16], &yiq[40]);
+		i = _pick_avx2(a, b, c, 1);
+		q = _pick_avx2(a, b, c, 2);
+		
+		lo = _mm256_unpacklo_epi16(i, q);
+		hi = _mm256_unpackhi_epi16(i, q);
+		
+		_mm256_storeu_si256((__m256i *) &oc[0], _mm256_permute2x128_si256(lo, hi, 0x20));
+		_mm256_storeu_si256((__m256i *) &oc[16], _mm256_permute2x128_si256(lo, hi, 0x31));
+	}
+	
+	_chroma_ssse3(oc, yiq, n - x);
+}
+
+__attribute__((target("avx2")))
+static void _mix_avx2(int16_t *o, const int16_t *oc, const cint16_t *lut, int n, int pal)
+{
+	const __m256i neg = pal < 0 ? _mm256_set1_epi32(0xFFFF0000) : _mm256_setzero_si256();
+	const __m256i low = _mm256_set1_epi32(0x0000FFFF);
+	__m256i l, r;
+	int x;
+	
+	for(x = 0; x + 8 <= n; x += 8, o += 16, oc += 16)
+	{
+		l = _mm256_loadu_si256((const __m256i *) &lut[x]);
+		l = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(l, 0xB1), 0xB1);
+		l = _mm256_sub_epi16(_mm256_xor_si256(l, neg), neg);
+		
+		r = _mm256_madd_epi16(_mm256_loadu_si256((const __m256i *) oc), l);
+		r = _mm256_and_si256(_mm256_srai_epi32(r, 15), low);
+		
+		_mm256_storeu_si256((__m256i *) o, _mm256_add_epi16(_mm256_loadu_si256((__m256i *) o), r));
+	}
+	
+	_mix_sse2(o, oc, &lut[x], n - x, pal);
+}
+
+/* pshufb masks to put the Y, I and Q values of eight pixels, one
+ * register each, into three registers of packed YIQ samples */
+static const int8_t _yiq_pack[9][16] __attribute__((aligned(16))) = {
+	/* Y */
+	{  0, 1,-1,-1,-1,-1, 2, 3,-1,-1,-1,-1, 4, 5,-1,-1 },
+	{ -1,-1, 6, 7,-1,-1,-1,-1, 8, 9,-1,-1,-1,-1,10,11 },
+	{ -1,-1,-1,-1,12,13,-1,-1,-1,-1,14,15,-1,-1,-1,-1 },
+	/* I */
+	{ -1,-1, 0, 1,-1,-1,-1,-1, 2, 3,-1,-1,-1,-1, 4, 5 },
+	{ -1,-1,-1,-1, 6, 7,-1,-1,-1,-1, 8, 9,-1,-1,-1,-1 },
+	{ 10,11,-1,-1,-1,-1,12,13,-1,-1,-1,-1,14,15,-1,-1 },
+	/* Q */
+	{ -1,-1,-1,-1, 0, 1,-1,-1,-1,-1, 2, 3,-1,-1,-1,-1 },
+	{  4, 5,-1,-1,-1,-1, 6, 7,-1,-1,-1,-1, 8, 9,-1,-1 },
+	{ -1,-1,10,11,-1,-1,-1,-1,12,13,-1,-1,-1,-1,14,15 },
+};
+
+__attribute__((target("avx2")))
+static inline __m128i _pack_avx2(__m128i y, __m128i i, __m128i q, int r)
+{
+	const __m128i *m = (const __m128i *) _yiq_pack;
+	
+	return(_mm_or_si128(
+		_mm_or_si128(
+			_mm_shuffle_epi8(y, _mm_load_si128(&m[0 + r])),
+			_mm_shuffle_epi8(i, _mm_load_si128(&m[3 + r]))
+		),
+		_mm_shuffle_epi8(q, _mm_load_si128(&m[6 + r]))
+	));
+}
+
+/* The sum of one of the Y, I or Q parts for eight pixels, rounded */
+__attribute__((target("avx2")))
+static inline __m256i _yiq_sum_avx2(const int32_t *lut, __m256i r, __m256i g, __m256i b)
+{
+	__m256i v;
+	
+	v = _mm256_i32gather_epi32(lut, r, 4);
+	v = _mm256_add_epi32(v, _mm256_i32gather_epi32(lut, g, 4));
+	v = _mm256_add_epi32(v, _mm256_i32gather_epi32(lut, b, 4));
+	v = _mm256_add_epi32(v, _mm256_set1_epi32(1 << (COMPOSITE_YIQ_SHIFT - 1)));
+	
+	return(_mm256_srai_epi32(v, COMPOSITE_YIQ_SHIFT));
+}
+
+__attribute__((target("avx2")))
+static void _yiq_avx2(int16_t *yiq, const uint32_t *rgb, int stride, const int32_t *lut, int n)
+{
+	const __m256i mask = _mm256_set1_epi32(0xFF);
+	const __m256i min = _mm256_set1_epi16(-INT16_MAX);
+	const __m256i offsets = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+	const __m256i index = _mm256_mullo_epi32(offsets, _mm256_set1_epi32(stride));
+	__m256i c, r, g, b, yi, qq;
+	__m128i y, i, q;
+	int x;
+	
+	for(x = 0; x + 8 <= n; x += 8, rgb += stride * 8, yiq += 24)
+	{
+		if(stride == 1)
+		{
+			c = _mm256_loadu_si256((const __m256i *) rgb);
+		}
+		else
+		{
+			c = _mm256_i32gather_epi32((const int *) rgb, index, 4);
+		}
+		
+		/* Table offsets of the R, G and B levels, times three */
+		r = _mm256_and_si256(_mm256_srli_epi32(c, 16), mask);
+		g = _mm256_add_epi32(_mm256_and_si256(_mm256_srli_epi32(c, 8), mask), _mm256_set1_epi32(0x100));
+		b = _mm256_add_epi32(_mm256_and_si256(c, mask), _mm256_set1_epi32(0x200));
+		r = _mm256_add_epi32(r, _mm256_slli_epi32(r, 1));
+		g = _mm256_add_epi32(g, _mm256_slli_epi32(g, 1));
+		b = _mm256_add_epi32(b, _mm256_slli_epi32(b, 1));
+		
+		/* Saturate to 16 bits, then limit to -INT16_MAX */
+		yi = _mm256_packs_epi32(_yiq_sum_avx2(&lut[0], r, g, b), _yiq_sum_avx2(&lut[1], r, g, b));
+		qq = _mm256_packs_epi32(_yiq_sum_avx2(&lut[2], r, g, b), _mm256_setzero_si256());
+		yi = _mm256_permute4x64_epi64(_mm256_max_epi16(yi, min), 0xD8);
+		qq = _mm256_permute4x64_epi64(_mm256_max_epi16(qq, min), 0xD8);
+		
+		y = _mm256_castsi256_si128(yi);
+		i = _mm256_extracti128_si256(yi, 1);
+		q = _mm256_castsi256_si128(qq);
+		
+		_mm_storeu_si128((__m128i *) &yiq[0], _pack_avx2(y, i, q, 0));
+		_mm_storeu_si128((__m128i *) &yiq[8], _pack_avx2(y, i, q, 1));
+		_mm_storeu_si128((__m128i *) &yiq[16], _pack_avx2(y, i, q, 2));
+	}
+	
+	_yiq_c(yiq, rgb, stride, lut, n - x);
+}
+
+static const composite_kernels_t _composite_sse2 = {
+	"sse2", _luma_c, _chroma_c, _mix_sse2, _yiq_c
+};
+
+static const composite_kernels_t _composite_ssse3 = {
+	"ssse3", _luma_ssse3, _chroma_ssse3, _mix_sse2, _yiq_c
+};
+
+static const composite_kernels_t _composite_avx2 = {
+	"avx2", _luma_avx2, _chroma_avx2, _mix_avx2, _yiq_avx2
+};
+
+#endif
+
+const composite_kernels_t *composite_kernels(int features)
+{
+#ifdef CPU_X86
+	if(features & CPU_AVX2)  return(&_composite_avx2);
+	if(features & CPU_SSSE3) return(&_composite_ssse3);
+	if(features & CPU_SSE2)  return(&_composite_sse2);
+#endif
+	
+	return(&composite_scalar);
+}
+
@@ -0,0 +1,61 @@
+/* hacktv - Analogue video transmitter for the HackRF                    */
+/*=======================================================================*/
+/* Copyright 2023 Philip Heron <phil@sanslogic.co.uk>                    */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* (at your option) any later version.                                   */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+#ifndef _COMPOSITE_H
+#define _COMPOSITE_H
+
+#include <stdint.h>
+#include "common.h"
+
+/* Luma fill: o[x * 2] = yiq[x * 3] for n samples. The odd (Q)
+ * samples of o are left untouched */
+typedef void (*composite_luma_t)(int16_t *o, const int16_t *yiq, int n);
+
+/* Chroma fill: copy the I and Q values of n packed YIQ
+ * samples into the interleaved chrominance buffer oc */
+typedef void (*composite_chroma_t)(int16_t *oc, const int16_t *yiq, int n);
+
+/* Subcarrier modulation:
+ * o[x * 2] += (oc[x * 2] * lut[x].q + oc[x * 2 + 1] * lut[x].i * pal) >> 15
+ * pal is 1 or -1 */
+typedef void (*composite_mix_t)(int16_t *o, const int16_t *oc, const cint16_t *lut, int n, int pal);
+
+/* Fractional bits of the RGB to YIQ channel lookup */
+#define COMPOSITE_YIQ_SHIFT 12
+
+/* RGB to YIQ through the channel lookup, which holds the Y, I and Q
+ * parts of each of the 0x100 R, G and B levels in that order:
+ * yiq[x * 3 + k] = (r[k] + g[k] + b[k]) >> COMPOSITE_YIQ_SHIFT, rounded
+ * and limited to +/-INT16_MAX, for n pixels stride apart in rgb */
+typedef void (*composite_yiq_t)(int16_t *yiq, const uint32_t *rgb, int stride, const int32_t *lut, int n);
+
+typedef struct {
+	const char *name;
+	composite_luma_t luma;
+	composite_chroma_t chroma;
+	composite_mix_t mix;
+	composite_yiq_t yiq;
+} composite_kernels_t;
+
+/* The plain C versions, used as the reference */
+extern const composite_kernels_t composite_scalar;
+
+/* Returns the fastest kernels for the CPU features given */
+extern const composite_kernels_t *composite_kernels(int features);
+
+#endif
+
@@ -0,0 +1,223 @@
+/* hacktv - Analogue video transmitter for the HackRF                    */
+/*=======================================================================*/
+/* Copyright 2023 Philip Heron <phil@sanslogic.co.uk>                    */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* (at your option) any later version.                                   */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+/* Checks that every composite line kernel this CPU can run gives
+ * exactly the same results as the scalar reference. Run with
+ * "make check".
+ * 
+ * The inputs are random, with a share of INT16_MIN and INT16_MAX
+ * values. Every length from 0 to _MAX_SAMPLES is tried at different
+ * offsets from the vector alignment, so the vector loops and their
+ * scalar tails are both covered. The whole output buffer is compared,
+ * which also catches writes to the samples a kernel must leave alone.
+ * 
+ * The RGB to YIQ conversion is also tried with the pixels one, two
+ * and three apart. Its channel lookup is scaled so that some sums
+ * saturate and others don't.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "common.h"
+#include "cpu.h"
+#include "composite.h"
+
+#define _MAX_SAMPLES 100
+#define _OFFSETS 16
+#define _ROUNDS 4
+#define _STRIDES 3
+
+/* Room for the longest run at the largest offset */
+#define _LEN (_MAX_SAMPLES + _OFFSETS)
+
+/* Features that can select a different backend */
+static const int _features[] = {
+	CPU_SSE2, CPU_SSSE3, CPU_AVX2, CPU_AVX512BW, 0
+};
+
+static uint32_t _seed = 1;
+
+static int16_t _random(int round)
+{
+	uint32_t r;
+	
+	/* A simple LCG, the same sequence on every platform */
+	_seed = _seed * 1103515245 + 12345;
+	r = _seed >> 8;
+	
+	/* The first round uses only the extremes,
+	 * the others one in eight of them */
+	switch(r & (round == 0 ? 1 : 15))
+	{
+	case 0: return(INT16_MIN);
+	case 1: return(INT16_MAX);
+	}
+	
+	return(r >> 8);
+}
+
+static void _fill(int16_t *d, int n, int round)
+{
+	int x;
+	
+	for(x = 0; x < n; x++)
+	{
+		d[x] = _random(round);
+	}
+}
+
+static int _check(const composite_kernels_t *k, int round)
+{
+	static int16_t yiq[_LEN * 3];
+	static int16_t oc[_LEN * 2];
+	static cint16_t lut[_LEN];
+	static int16_t init[_LEN * 2];
+	static int16_t ref[_LEN * 2];
+	static int16_t out[_LEN * 2];
+	static uint32_t rgb[_LEN * _STRIDES];
+	static int32_t ylut[0x300 * 3];
+	static int16_t yref[_LEN * 3];
+	static int16_t yout[_LEN * 3];
+	int n, o, x, pal, stride;
+	int errors = 0;
+	
+	_fill(yiq, _LEN * 3, round);
+	_fill(oc, _LEN * 2, round);
+	_fill(init, _LEN * 2, round);
+	
+	/* The subcarrier lookup never holds INT16_MIN */
+	for(x = 0; x < _LEN; x++)
+	{
+		lut[x].i = _random(round);
+		lut[x].q = _random(round);
+		if(lut[x].i == INT16_MIN) lut[x].i = -INT16_MAX;
+		if(lut[x].q == INT16_MIN) lut[x].q = -INT16_MAX;
+	}
+	
+	for(x = 0; x < _LEN * _STRIDES; x++)
+	{
+		rgb[x] = (uint16_t) _random(round) << 16 | (uint16_t) _random(round);
+	}
+	
+	/* From within 16 bits after the shift to well past them */
+	for(x = 0; x < 0x300 * 3; x++)
+	{
+		ylut[x] = _random(round) * (1 << (x % 4 + 10));
+	}
+	
+	for(n = 0; n <= _MAX_SAMPLES; n++)
+	{
+		for(o = 0; o < _OFFSETS; o++)
+		{
+			memcpy(ref, init, sizeof(ref));
+			memcpy(out, init, sizeof(out));
+			composite_scalar.luma(&ref[o * 2], &yiq[o * 3], n);
+			k->luma(&out[o * 2], &yiq[o * 3], n);
+			
+			if(memcmp(ref, out, sizeof(ref)) != 0)
+			{
+				fprintf(stderr, "%s luma: n = %d, offset %d\n", k->name, n, o);
+				errors++;
+			}
+			
+			memcpy(ref, init, sizeof(ref));
+			memcpy(out, init, sizeof(out));
+			composite_scalar.chroma(&ref[o * 2], &yiq[o * 3], n);
+			k->chroma(&out[o * 2], &yiq[o * 3], n);
+			
+			if(memcmp(ref, out, sizeof(ref)) != 0)
+			{
+				fprintf(stderr, "%s chroma: n = %d, offset %d\n", k->name, n, o);
+				errors++;
+			}
+			
+			for(pal = -1; pal <= 1; pal += 2)
+			{
+				/* The lookup starts at its own offset */
+				x = (o * 7 + n) % _OFFSETS;
+				
+				memcpy(ref, init, sizeof(ref));
+				memcpy(out, init, sizeof(out));
+				composite_scalar.mix(&ref[o * 2], &oc[o * 2], &lut[x], n, pal);
+				k->mix(&out[o * 2], &oc[o * 2], &lut[x], n, pal);
+				
+				if(memcmp(ref, out, sizeof(ref)) != 0)
+				{
+					fprintf(stderr, "%s mix: n = %d, offsets %d/%d, pal %d\n", k->name, n, o, x, pal);
+					errors++;
+				}
+			}
+			
+			for(stride = 1; stride <= _STRIDES; stride++)
+			{
+				memset(yref, 0xA5, sizeof(yref));
+				memset(yout, 0xA5, sizeof(yout));
+				composite_scalar.yiq(&yref[o * 3], &rgb[o], stride, ylut, n);
+				k->yiq(&yout[o * 3], &rgb[o], stride, ylut, n);
+				
+				if(memcmp(yref, yout, sizeof(yref)) != 0)
+				{
+					fprintf(stderr, "%s yiq: n = %d, offset %d, stride %d\n", k->name, n, o, stride);
+					errors++;
+				}
+			}
+		}
+	}
+	
+	return(errors);
+}
+
+int main(int argc, char *argv[])
+{
+	const composite_kernels_t *tested[sizeof(_features) / sizeof(int)];
+	const composite_kernels_t *k;
+	int i, j, r, ntested = 0;
+	int errors, failed = 0;
+	
+	for(i = 0; _features[i]; i++)
+	{
+		if((cpu_features() & _features[i]) == 0) continue;
+		
+		k = composite_kernels(_features[i]);
+		if(k == &composite_scalar) continue;
+		
+		/* Some features share a backend */
+		for(j = 0; j < ntested && tested[j] != k; j++);
+		if(j < ntested) continue;
+		
+		tested[ntested++] = k;
+		
+		for(errors = r = 0; r < _ROUNDS; r++)
+		{
+			errors += _check(k, r);
+		}
+		
+		printf("composite %s: %s\n", k->name, errors ? "FAILED" : "OK");
+		
+		if(errors) failed = 1;
+	}
+	
+	if(ntested == 0)
+	{
+		printf("No SIMD composite kernels for this CPU\n");
+	}
+	
+	return(failed);
+}
+
@@ -0,0 +1,56 @@
+/* hacktv - Analogue video transmitter for the HackRF                    */
+/*=======================================================================*/
+/* Copyright 2023 Philip Heron <phil@sanslogic.co.uk>                    */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* (at your option) any later version.                                   */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+#include "cpu.h"
+
+/* Features masked off by cpu_disable() */
+static int _disabled = 0;
+
+static int _detect(void)
+{
+	int f = 0;
+	
+#if defined(CPU_X86) && defined(__GNUC__)
+	__builtin_cpu_init();
+	
+	if(__builtin_cpu_supports("sse2"))     f |= CPU_SSE2;
+	if(__builtin_cpu_supports("ssse3"))    f |= CPU_SSSE3;
+	if(__builtin_cpu_supports("avx2"))     f |= CPU_AVX2;
+	if(__builtin_cpu_supports("avx512bw")) f |= CPU_AVX512BW;
+#endif
+	
+	return(f);
+}
+
+int cpu_features(void)
+{
+	static int f = -1;
+	
+	if(f < 0)
+	{
+		f = _detect();
+	}
+	
+	return(f & ~_disabled);
+}
+
+void cpu_disable(int features)
+{
+	/* Only takes effect for kernels selected after the call */
+	_disabled |= features;
+}
+
@@ -0,0 +1,35 @@
+/* hacktv - Analogue video transmitter for the HackRF                    */
+/*=======================================================================*/
+/* Copyright 2023 Philip Heron <phil@sanslogic.co.uk>                    */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* (at your option) any later version.                                   */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+#ifndef _CPU_H
+#define _CPU_H
+
+/* SIMD instruction sets usable at runtime */
+#define CPU_SSE2     (1 << 0)
+#define CPU_SSSE3    (1 << 1)
+#define CPU_AVX2     (1 << 2)
+#define CPU_AVX512BW (1 << 3)
+
+#if defined(__x86_64__) || defined(__i386__)
+#define CPU_X86
+#endif
+
+extern int cpu_features(void);
+extern void cpu_disable(int features);
+
+#endif
+
@@ -55,6 +55,9 @@ static const int16_t _50_10_us_b_taps[DANCE_B_50_10_US_NTAPS] = {
 static const int _step[4] = { 0, 3, 1, 2 };
 static const int _syms[4] = { 0, 1, 3, 2 };
 
+/* Samples rendered and mixed per pass */
+#define _MOD_BLOCK 2048
+
 /* Ranges */
 typedef struct {
 	uint16_t mask;
@@ -387,7 +390,8 @@ int dance_mod_init(dance_mod_t *s, uint8_t mode, unsigned int sample_rate, unsig
 	double sps;
 	double t;
 	double r;
-	int x, n;
+	cint16_t *p;
+	int x, n, i;
 	
 	memset(s, 0, sizeof(dance_mod_t));
 	
@@ -397,13 +401,13 @@ int dance_mod_init(dance_mod_t *s, uint8_t mode, unsigned int sample_rate, unsig
 	/* Calculate the number of taps needed to cover 5 symbols, rounded up to odd number */
 	s->ntaps = ((unsigned int) (sps * 5) + 1) | 1;
 	
-	s->taps = malloc(sizeof(int16_t) * s->ntaps);
-	if(!s->taps)
+	s->pulses = malloc(sizeof(cint16_t) * s->ntaps * 4);
+	if(!s->pulses)
 	{
 		return(-1);
 	}
 	
-	/* Generate the filter taps */
+	/* Generate the filter taps, and the pulse for each symbol */
 	n = s->ntaps / 2;
 	for(x = -n; x <= n; x++)
 	{
@@ -412,16 +416,21 @@ int dance_mod_init(dance_mod_t *s, uint8_t mode, unsigned int sample_rate, unsig
 		r  = _rrc(t, beta, 1.0) * _hamming((double) x / n);
 		r *= M_SQRT1_2 * INT16_MAX * level;
 		
-		s->taps[x + n] = lround(r);
+		for(i = 0; i < 4; i++)
+		{
+			p = &s->pulses[i * s->ntaps + x + n];
+			p->i = (_syms[i] & 1 ? 1 : -1) * lround(r);
+			p->q = (_syms[i] & 2 ? 1 : -1) * lround(r);
+		}
 	}
 	
-	/* Allocate memory for the baseband buffer */
-	s->bb_start = calloc(s->ntaps, sizeof(cint16_t));
-	s->bb_end   = s->bb_start + s->ntaps;
-	s->bb       = s->bb_start;
-	s->bb_len   = 0;
+	/* Allocate memory for the baseband buffer. Pulses can
+	 * start on the last sample of a block, so it must hold
+	 * one block plus the pulse length */
+	s->bb = calloc(_MOD_BLOCK + s->ntaps, sizeof(cint16_t));
+	s->bb_len = 0;
 	
-	if(!s->bb_start)
+	if(!s->bb)
 	{
 		return(-1);
 	}
@@ -456,8 +465,8 @@ int dance_mod_init(dance_mod_t *s, uint8_t mode, unsigned int sample_rate, unsig
 int dance_mod_free(dance_mod_t *s)
 {
 	free(s->cc_start);
-	free(s->bb_start);
-	free(s->taps);
+	free(s->bb);
+	free(s->pulses);
 	
 	return(0);
 }
@@ -470,74 +479,79 @@ void dance_mod_input(dance_mod_t *s, const int16_t *audio)
 int dance_mod_output(dance_mod_t *s, int16_t *iq, size_t samples)
 {
 	cint16_t *ciq = (cint16_t *) iq;
-	int x, i;
-	int16_t r;
+	const int16_t *p;
+	int16_t *b;
+	int x, i, l, n;
 	
-	for(x = 0; x < samples;)
+	for(; samples > 0; samples -= l, ciq += l)
 	{
-		/* Output and clear the buffer */
-		for(; x < samples && s->bb_len; x++, s->bb_len--)
+		l = samples < _MOD_BLOCK ? samples : _MOD_BLOCK;
+		
+		/* Add the pulse of each symbol starting in this block. One
+		 * on the boundary is also rendered here, so frames are
+		 * encoded at the same point as the per-sample version */
+		for(x = s->bb_len; x <= l; x += s->bb_len)
 		{
-			cint16_mula(ciq++, s->bb, s->cc);
+			if(s->frame_bit == DANCE_FRAME_BITS)
+			{
+				/* Encode the next frame */
+				dance_encode_frame_a(
+					&s->enc, s->frame,
+					s->audio + 0, 2,
+					s->audio + 1, 2,
+					NULL, 0, NULL, 0
+				);
+				s->frame_bit = 0;
+			}
+			
+			/* Read out the next 2-bit symbol, MSB first */
+			s->dsym += _step[(s->frame[s->frame_bit >> 3] >> (6 - (s->frame_bit & 0x07))) & 0x03];
+			s->dsym &= 0x03;
+			s->frame_bit += 2;
 			
-			s->bb->i = 0;
-			s->bb->q = 0;
+			/* Encode the symbol */
+			p = (const int16_t *) &s->pulses[s->dsym * s->ntaps];
+			b = (int16_t *) &s->bb[x];
 			
-			if(++s->bb == s->bb_end)
+			for(i = 0; i < s->ntaps * 2; i++)
 			{
-				s->bb = s->bb_start;
+				b[i] += p[i];
 			}
 			
-			if(++s->cc == s->cc_end)
+			/* Calculate length of the next block */
+			s->bb_len = s->sps;
+			
+			s->ds += s->dsl;
+			if(s->ds >= s->decimation)
 			{
-				s->cc = s->cc_start;
+				s->bb_len--;
+				s->ds -= s->decimation;
 			}
 		}
 		
-		if(s->bb_len > 0)
-		{
-			break;
-		}
+		s->bb_len = x - l;
 		
-		if(s->frame_bit == DANCE_FRAME_BITS)
+		/* Mix with the carrier, in runs up to the end of its table */
+		for(x = 0; x < l; x += n)
 		{
-			/* Encode the next frame */
-			dance_encode_frame_a(
-				&s->enc, s->frame,
-				s->audio + 0, 2,
-				s->audio + 1, 2,
-				NULL, 0, NULL, 0
-			);
-			s->frame_bit = 0;
-		}
-		
-		/* Read out the next 2-bit symbol, MSB first */
-		s->dsym += _step[(s->frame[s->frame_bit >> 3] >> (6 - (s->frame_bit & 0x07))) & 0x03];
-		s->dsym &= 0x03;
-		s->frame_bit += 2;
-		
-		/* Encode the symbol */
-		for(i = 0; i < s->ntaps; i++)
-		{
-			r = s->taps[i];
-			s->bb->i += (_syms[s->dsym] & 1 ? r : -r);
-			s->bb->q += (_syms[s->dsym] & 2 ? r : -r);
+			n = s->cc_end - s->cc;
+			if(n > l - x) n = l - x;
 			
-			if(++s->bb == s->bb_end)
+			for(i = 0; i < n; i++)
 			{
-				s->bb = s->bb_start;
+				cint16_mula(&ciq[x + i], &s->bb[x + i], &s->cc[i]);
+			}
+			
+			s->cc += n;
+			if(s->cc == s->cc_end)
+			{
+				s->cc = s->cc_start;
 			}
 		}
 		
-		/* Calculate length of the next block */
-		s->bb_len = s->sps;
-		
-		s->ds += s->dsl;
-		if(s->ds >= s->decimation)
-		{
-			s->bb_len--;
-			s->ds -= s->decimation;
-		}
+		/* Move the tail of the pulses to the start of the buffer */
+		memmove(s->bb, s->bb + l, sizeof(cint16_t) * s->ntaps);
+		memset(s->bb + s->ntaps, 0, sizeof(cint16_t) * l);
 	}
 	
 	return(0);
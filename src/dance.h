@@ -82,15 +82,13 @@ typedef struct {
 	int16_t audio[DANCE_AUDIO_LEN * 2];
 	
 	int ntaps;
-	int16_t *taps;
+	cint16_t *pulses; /* Shaped pulse for each symbol, ntaps * 4 */
 	int16_t *hist;
 	
 	int dsym; /* Differential symbol */
 	
-	cint16_t *bb;
-	cint16_t *bb_start;
-	cint16_t *bb_end;
-	int bb_len;
+	cint16_t *bb; /* Baseband accumulator */
+	int bb_len; /* Samples until the next symbol */
 	
 	int sps;
 	int ds;
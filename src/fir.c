@@ -21,6 +21,7 @@
 #include <math.h>
 #include "fir.h"
 #include "common.h"
+#include "cpu.h"
 
 
 
@@ -216,6 +217,410 @@ void fir_complex_band_pass(double *taps, size_t ntaps, double sample_rate, doubl
 
 
 
+/* int16_t FFT overlap-save */
+
+
+
+/* Long real filters can be run as an overlap-save convolution. The
+ * input is copied after the last ntaps + delay - 1 samples of history,
+ * and pairs of blocks are packed into the real and imaginary parts of
+ * one complex FFT. The taps and samples are both integers, so the
+ * double precision result rounded to the nearest integer is exactly
+ * the sum the direct form would calculate, the output is identical.
+ * 
+ * Whether this is faster than the direct form depends on the number of
+ * taps and on the kernels the direct form uses. Each set of kernels
+ * gives the tap count where the FFT was measured to win. */
+
+/* Calls with fewer samples than this use the direct form */
+#define _FFT_MIN_SAMPLES 64
+
+struct _fir_fft_t {
+	
+	int n;          /* FFT size */
+	int l;          /* Output samples per FFT block */
+	int h;          /* History length */
+	
+	double *tw;     /* Twiddle factors, n - 1 complex */
+	double *taps;   /* FFT of the taps, n complex, scaled by 1 / n */
+	double *buf;    /* Work buffer, n complex */
+	
+	int16_t *z;     /* History followed by the new input */
+	size_t zlen;
+};
+
+static void _fft_free(fir_int16_t *s)
+{
+	if(s->fft == NULL) return;
+	
+	free(s->fft->tw);
+	free(s->fft->taps);
+	free(s->fft->buf);
+	free(s->fft->z);
+	free(s->fft);
+	s->fft = NULL;
+}
+
+static void _fft(const struct _fir_fft_t *f, double *x)
+{
+	double tr, ti;
+	double *a, *b;
+	int i, j, k, m, n;
+	
+	n = f->n;
+	
+	/* Bit reverse the input order */
+	for(i = 1, j = 0; i < n; i++)
+	{
+		for(k = n >> 1; j & k; k >>= 1) j ^= k;
+		j ^= k;
+		
+		if(i < j)
+		{
+			tr = x[i * 2 + 0]; x[i * 2 + 0] = x[j * 2 + 0]; x[j * 2 + 0] = tr;
+			ti = x[i * 2 + 1]; x[i * 2 + 1] = x[j * 2 + 1]; x[j * 2 + 1] = ti;
+		}
+	}
+	
+	/* Radix-2 butterflies. The twiddle factors for each
+	 * stage are stored together, starting at m - 1 */
+	for(m = 1; m < n; m <<= 1)
+	{
+		const double *w = &f->tw[(m - 1) * 2];
+		
+		for(i = 0; i < n; i += m * 2)
+		{
+			a = &x[i * 2];
+			b = &x[(i + m) * 2];
+			
+			for(j = 0; j < m; j++)
+			{
+				tr = b[j * 2 + 0] * w[j * 2 + 0] - b[j * 2 + 1] * w[j * 2 + 1];
+				ti = b[j * 2 + 0] * w[j * 2 + 1] + b[j * 2 + 1] * w[j * 2 + 0];
+				
+				b[j * 2 + 0] = a[j * 2 + 0] - tr;
+				b[j * 2 + 1] = a[j * 2 + 1] - ti;
+				a[j * 2 + 0] += tr;
+				a[j * 2 + 1] += ti;
+			}
+		}
+	}
+}
+
+static int _fft_init(fir_int16_t *s)
+{
+	struct _fir_fft_t *f;
+	int i, m;
+	
+	f = calloc(1, sizeof(struct _fir_fft_t));
+	if(!f)
+	{
+		return(-1);
+	}
+	
+	s->fft = f;
+	
+	/* Use an FFT of at least four times the filter length */
+	for(f->n = 64; f->n < s->ntaps * 4; f->n <<= 1);
+	f->l = f->n - s->ntaps + 1;
+	f->h = s->lwin - 1;
+	
+	f->tw = malloc(sizeof(double) * f->n * 2);
+	f->taps = calloc(f->n * 2, sizeof(double));
+	f->buf = malloc(sizeof(double) * f->n * 2);
+	f->zlen = f->h + 1;
+	f->z = calloc(f->zlen, sizeof(int16_t));
+	
+	if(!f->tw || !f->taps || !f->buf || !f->z)
+	{
+		_fft_free(s);
+		return(-1);
+	}
+	
+	for(m = 1; m < f->n; m <<= 1)
+	{
+		for(i = 0; i < m; i++)
+		{
+			f->tw[(m - 1 + i) * 2 + 0] = cos(-M_PI * i / m);
+			f->tw[(m - 1 + i) * 2 + 1] = sin(-M_PI * i / m);
+		}
+	}
+	
+	/* The direct form taps are stored in the order they are
+	 * applied, reverse them back into the filter response */
+	for(i = 0; i < s->ntaps; i++)
+	{
+		f->taps[i * 2] = (double) s->itaps[s->ntaps - 1 - i] / f->n;
+	}
+	
+	_fft(f, f->taps);
+	
+	return(0);
+}
+
+static void _fft_reset(fir_int16_t *s)
+{
+	memset(s->fft->z, 0, sizeof(int16_t) * s->fft->h);
+}
+
+static size_t _fft_process(fir_int16_t *s, int16_t *out, const int16_t *in, size_t samples, int step)
+{
+	struct _fir_fft_t *f = s->fft;
+	double *b = f->buf;
+	int16_t *z;
+	int64_t a;
+	size_t i, j, k, n;
+	
+	/* Grow the input buffer if needed */
+	if(f->h + samples > f->zlen)
+	{
+		z = realloc(f->z, sizeof(int16_t) * (f->h + samples));
+		if(!z) return(0);
+		
+		f->z = z;
+		f->zlen = f->h + samples;
+	}
+	
+	z = f->z;
+	
+	/* Copy the input in after the history. This is done
+	 * first as the output may overwrite the input */
+	for(i = 0; i < samples; i++)
+	{
+		z[f->h + i] = in[i * step];
+	}
+	
+	if(samples < _FFT_MIN_SAMPLES)
+	{
+		/* Not worth an FFT, run the direct form over the buffer */
+		for(i = 0; i < samples; i++)
+		{
+			a = (int32_t) s->kernels->dot(&z[i], s->itaps, s->ntaps);
+			a >>= 15;
+			out[i * step] = a < INT16_MIN ? INT16_MIN : (a > INT16_MAX ? INT16_MAX : a);
+		}
+	}
+	
+	for(i = 0; i < samples && samples >= _FFT_MIN_SAMPLES; i += f->l * 2)
+	{
+		/* Pack two blocks into the real and imaginary parts */
+		for(j = 0; j < f->n; j++)
+		{
+			k = i + j;
+			b[j * 2 + 0] = k < f->h + samples ? z[k] : 0;
+			k += f->l;
+			b[j * 2 + 1] = k < f->h + samples ? z[k] : 0;
+		}
+		
+		_fft(f, b);
+		
+		/* Multiply by the filter response. The inverse FFT is done
+		 * as a forward FFT of the conjugate, conjugating the result */
+		for(j = 0; j < f->n; j++)
+		{
+			double re = b[j * 2 + 0] * f->taps[j * 2 + 0] - b[j * 2 + 1] * f->taps[j * 2 + 1];
+			double im = b[j * 2 + 0] * f->taps[j * 2 + 1] + b[j * 2 + 1] * f->taps[j * 2 + 0];
+			b[j * 2 + 0] = re;
+			b[j * 2 + 1] = -im;
+		}
+		
+		_fft(f, b);
+		
+		/* The valid outputs start after ntaps - 1 samples. Wrap the
+		 * sum to 32 bits, as the direct form does */
+		for(k = 0; k < 2; k++)
+		{
+			n = i + f->l * k;
+			
+			for(j = 0; j < f->l && n + j < samples; j++)
+			{
+				double v = b[(j + s->ntaps - 1) * 2 + k];
+				
+				if(k == 1) v = -v;
+				
+				a = (int32_t) (uint32_t) (int64_t) (v < 0 ? v - 0.5 : v + 0.5);
+				a >>= 15;
+				out[(n + j) * step] = a < INT16_MIN ? INT16_MIN : (a > INT16_MAX ? INT16_MAX : a);
+			}
+		}
+	}
+	
+	/* Keep the newest samples as history for the next call */
+	memmove(z, &z[samples], sizeof(int16_t) * f->h);
+	
+	return(samples);
+}
+
+static void _fft_select(fir_int16_t *s)
+{
+	if(s->interpolation != 1 || s->decimation != 1 || s->ntaps < s->kernels->fft_taps)
+	{
+		return;
+	}
+	
+	if(_fft_init(s) == 0)
+	{
+		s->type = 4;
+	}
+}
+
+
+
+/* int16_t interpolated polyphase resampler */
+
+
+
+/* A rational resampler needs one filter phase for every step of the
+ * interpolation factor. Sample rates that don't share a large common
+ * factor, such as 20 MHz and 13.5 MHz or most SDR rates, can need
+ * thousands of phases and tap tables far larger than the cache.
+ * 
+ * Above _RESAMPLER_MAX_PHASES the filter is built with a fixed number of
+ * phases instead. The exact output position is still tracked in units of
+ * the full interpolation factor, so the output rate doesn't drift, and
+ * each output is linearly interpolated between the results of the two
+ * nearest phases. This is a first-order Farrow structure with the
+ * polynomial evaluated across the tap table. */
+
+/* Taps per phase */
+#define _RESAMPLER_TAPS 21
+
+/* Largest exact polyphase filter */
+#define _RESAMPLER_MAX_PHASES 1024
+
+/* Phases used when the exact filter would be too large */
+#define _RESAMPLER_PHASES 256
+
+static int _ipoly_init(fir_int16_t *s, int interpolation, int decimation)
+{
+	double *taps;
+	double cutoff, width;
+	double e, err, peak;
+	int ntaps;
+	int i, k, p;
+	
+	s->type = 5;
+	
+	s->kernels = fir_kernels(cpu_features());
+	
+	s->interpolation = interpolation;
+	s->decimation = decimation;
+	s->phases = _RESAMPLER_PHASES;
+	
+	/* One extra phase for the interpolation
+	 * past the last one, which is the first
+	 * phase one input sample later */
+	s->ataps = _RESAMPLER_TAPS;
+	s->ntaps = (s->phases + 1) * s->ataps;
+	
+	s->itaps = calloc(s->ntaps, sizeof(int16_t));
+	s->qtaps = NULL;
+	s->fft = NULL;
+	
+	s->lwin = s->ataps;
+	s->win = calloc(s->ataps * 2, sizeof(int16_t));
+	s->owin = 0;
+	s->d = 0;
+	
+	/* The prototype is designed at twice the phase rate,
+	 * the odd taps fall half way between the phases and
+	 * are used to measure the interpolation error */
+	ntaps = s->ataps * s->phases * 2 + 1;
+	taps = calloc(ntaps, sizeof(double));
+	
+	if(!s->itaps || !s->win || !taps)
+	{
+		free(taps);
+		fir_int16_free(s);
+		return(-1);
+	}
+	
+	cutoff = 0.45;
+	width = 0.1;
+	
+	if(interpolation < decimation)
+	{
+		cutoff *= (double) interpolation / decimation;
+		width *= (double) interpolation / decimation;
+	}
+	
+	fir_low_pass(taps, ntaps, s->phases * 2, cutoff, width, s->phases * 2);
+	
+	/* Copy taps into the order they will be applied,
+	 * the same order the exact polyphase filter uses */
+	for(p = 0; p <= s->phases; p++)
+	{
+		for(k = 0; k < s->ataps; k++)
+		{
+			s->itaps[p * s->ataps + k] = lround(taps[((s->ataps - 1 - k) * s->phases + p) * 2] * 32767.0);
+		}
+	}
+	
+	/* Worst case output error of the interpolation in dB
+	 * relative to full scale, found at the half-way points */
+	peak = 0;
+	
+	for(p = 0; p < s->phases; p++)
+	{
+		err = 0;
+		
+		for(k = 0; k < s->ataps; k++)
+		{
+			i = ((s->ataps - 1 - k) * s->phases + p) * 2;
+			e = taps[i + 1] - (taps[i] + taps[i + 2]) / 2;
+			err += fabs(e);
+		}
+		
+		if(err > peak) peak = err;
+	}
+	
+	free(taps);
+	
+	s->error = peak > 0 ? 20.0 * log10(peak) : -INFINITY;
+	
+	return(0);
+}
+
+static size_t _ipoly_process(fir_int16_t *s, int16_t *out, const int16_t *in, size_t samples, int step)
+{
+	const int16_t *taps;
+	int64_t ph;
+	int a, b;
+	int x;
+	
+	for(x = 0; samples; samples--)
+	{
+		/* Append the next input sample to the round buffer */
+		s->win[s->owin] = *in;
+		if(s->owin < s->ataps) s->win[s->owin + s->lwin] = *in;
+		if(++s->owin == s->lwin) s->owin = 0;
+		
+		for(; s->d < s->interpolation; s->d += s->decimation)
+		{
+			/* Position between the phases, 16-bit fraction */
+			ph = ((int64_t) s->d * s->phases << 16) / s->interpolation;
+			taps = &s->itaps[(ph >> 16) * s->ataps];
+			
+			a = s->kernels->dot(&s->win[s->owin], taps, s->ataps);
+			b = s->kernels->dot(&s->win[s->owin], taps + s->ataps, s->ataps);
+			
+			a += (((int64_t) b - a) * (ph & 0xFFFF)) >> 16;
+			
+			a >>= 15;
+			*out = a < INT16_MIN ? INT16_MIN : (a > INT16_MAX ? INT16_MAX : a);
+			out += step;
+			x++;
+		}
+		s->d -= s->interpolation;
+		
+		in += step;
+	}
+	
+	return(x);
+}
+
+
+
 /* int16_t */
 
 
@@ -226,6 +631,8 @@ int fir_int16_init(fir_int16_t *s, const double *taps, unsigned int ntaps, int i
 	
 	s->type = 1;
 	
+	s->kernels = fir_kernels(cpu_features());
+	
 	s->interpolation = interpolation;
 	s->decimation = decimation;
 	
@@ -235,6 +642,7 @@ int fir_int16_init(fir_int16_t *s, const double *taps, unsigned int ntaps, int i
 	
 	s->itaps = calloc(s->ntaps, sizeof(int16_t));
 	s->qtaps = NULL;
+	s->fft = NULL;
 	
 	/* Copy taps into the order they will be applied */
 	j = s->ntaps - s->ataps;
@@ -250,18 +658,22 @@ int fir_int16_init(fir_int16_t *s, const double *taps, unsigned int ntaps, int i
 	s->owin = 0;
 	s->d = 0;
 	
+	/* Switch to FFT convolution for long filters */
+	_fft_select(s);
+	
 	return(0);
 }
 
 size_t fir_int16_process(fir_int16_t *s, int16_t *out, const int16_t *in, size_t samples, int step)
 {
 	int a;
-	int x, y;
-	const int16_t *win, *taps;
+	int x;
 	
 	if(s->type == 0) return(0);
 	else if(s->type == 2) return(fir_int16_complex_process(s, out, in, samples));
 	else if(s->type == 3) return(fir_int16_scomplex_process(s, out, in, samples));
+	else if(s->type == 4) return(_fft_process(s, out, in, samples, step));
+	else if(s->type == 5) return(_ipoly_process(s, out, in, samples, step));
 	
 	for(x = 0; samples; samples--)
 	{
@@ -272,14 +684,8 @@ size_t fir_int16_process(fir_int16_t *s, int16_t *out, const int16_t *in, size_t
 		
 		for(; s->d < s->interpolation; s->d += s->decimation)
 		{
-			win = &s->win[s->owin];
-			taps = &s->itaps[s->d * s->ataps];
-			
 			/* Calculate the next output sample */
-			for(a = y = 0; y < s->ataps; y++)
-			{
-				a += *(win++) * *(taps++);
-			}
+			a = s->kernels->dot(&s->win[s->owin], &s->itaps[s->d * s->ataps], s->ataps);
 			
 			a >>= 15;
 			*out = a < INT16_MIN ? INT16_MIN : (a > INT16_MAX ? INT16_MAX : a);
@@ -298,6 +704,19 @@ size_t fir_int16_process_block(fir_int16_t *s, int16_t *out, const int16_t *in,
 {
 	int x;
 	
+	if(s->type == 4)
+	{
+		/* Pre-fill the history */
+		_fft_reset(s);
+		
+		for(x = 0; x < s->ataps / 2; x++, in += step)
+		{
+			s->fft->z[s->fft->h - s->ataps / 2 + x] = *in;
+		}
+		
+		return(_fft_process(s, out, in, samples, step));
+	}
+	
 	/* Pre-fill buffer */
 	memset(s->win, 0, (s->lwin + s->ataps) * sizeof(int16_t));
 	s->owin = 0;
@@ -315,6 +734,7 @@ size_t fir_int16_process_block(fir_int16_t *s, int16_t *out, const int16_t *in,
 
 void fir_int16_free(fir_int16_t *s)
 {
+	_fft_free(s);
 	free(s->win);
 	free(s->itaps);
 	free(s->qtaps);
@@ -333,8 +753,13 @@ int fir_int16_resampler_init(fir_int16_t *s, int interpolation, int decimation)
 	interpolation /= d;
 	decimation /= d;
 	
+	if(interpolation > _RESAMPLER_MAX_PHASES)
+	{
+		return(_ipoly_init(s, interpolation, decimation));
+	}
+	
 	/* Generate the filter taps */
-	ntaps = 21 * interpolation;
+	ntaps = _RESAMPLER_TAPS * interpolation;
 	if((ntaps & 1) == 0) ntaps--;
 	
 	taps = calloc(ntaps, sizeof(double));
@@ -371,6 +796,8 @@ int fir_int16_complex_init(fir_int16_t *s, const double *taps, unsigned int ntap
 	
 	s->type = 2;
 	
+	s->kernels = fir_kernels(cpu_features());
+	
 	s->interpolation = interpolation;
 	s->decimation = decimation;
 	
@@ -380,6 +807,7 @@ int fir_int16_complex_init(fir_int16_t *s, const double *taps, unsigned int ntap
 	
 	s->itaps = calloc(s->ntaps, sizeof(int16_t));
 	s->qtaps = calloc(s->ntaps, sizeof(int16_t));
+	s->fft = NULL;
 	
 	/* Copy the taps in the order and format they are to be used */
 	j = s->ntaps - s->ataps;
@@ -402,8 +830,7 @@ int fir_int16_complex_init(fir_int16_t *s, const double *taps, unsigned int ntap
 size_t fir_int16_complex_process(fir_int16_t *s, int16_t *out, const int16_t *in, size_t samples)
 {
 	int32_t ai, aq;
-	int x, y;
-	const int16_t *win, *itaps, *qtaps;
+	int x;
 	
 	for(x = 0; samples; samples--)
 	{
@@ -419,16 +846,8 @@ size_t fir_int16_complex_process(fir_int16_t *s, int16_t *out, const int16_t *in
 		
 		for(; s->d < s->interpolation; s->d += s->decimation)
 		{
-			win = &s->win[s->owin * 2];
-			itaps = &s->itaps[s->d * s->ataps];
-			qtaps = &s->qtaps[s->d * s->ataps];
-			
 			/* Calculate the next output sample */
-			for(ai = aq = y = 0; y < s->ataps; y++, win += 2, itaps++, qtaps++)
-			{
-				ai += win[0] * *itaps - win[1] * *qtaps;
-				aq += win[0] * *qtaps + win[1] * *itaps;
-			}
+			s->kernels->cdot(&ai, &aq, &s->win[s->owin * 2], &s->itaps[s->d * s->ataps], &s->qtaps[s->d * s->ataps], s->ataps);
 			
 			ai >>= 15;
 			aq >>= 15;
@@ -451,6 +870,8 @@ int fir_int16_scomplex_init(fir_int16_t *s, const double *taps, unsigned int nta
 	
 	s->type = 3;
 	
+	s->kernels = fir_kernels(cpu_features());
+	
 	s->interpolation = interpolation;
 	s->decimation = decimation;
 	
@@ -460,6 +881,7 @@ int fir_int16_scomplex_init(fir_int16_t *s, const double *taps, unsigned int nta
 	
 	s->itaps = calloc(s->ntaps, sizeof(int16_t));
 	s->qtaps = calloc(s->ntaps, sizeof(int16_t));
+	s->fft = NULL;
 	
 	/* Copy the taps in the order and format they are to be used */
 	j = s->ntaps - s->ataps;
@@ -482,8 +904,7 @@ int fir_int16_scomplex_init(fir_int16_t *s, const double *taps, unsigned int nta
 size_t fir_int16_scomplex_process(fir_int16_t *s, int16_t *out, const int16_t *in, size_t samples)
 {
 	int32_t ai, aq;
-	int x, y;
-	const int16_t *win, *itaps, *qtaps;
+	int x;
 	
 	for(x = 0; samples; samples--)
 	{
@@ -494,16 +915,8 @@ size_t fir_int16_scomplex_process(fir_int16_t *s, int16_t *out, const int16_t *i
 		
 		for(; s->d < s->interpolation; s->d += s->decimation)
 		{
-			win = &s->win[s->owin];
-			itaps = &s->itaps[s->d * s->ataps];
-			qtaps = &s->qtaps[s->d * s->ataps];
-			
 			/* Calculate the next output sample */
-			for(ai = aq = y = 0; y < s->ataps; y++)
-			{
-				ai += *win     * *(itaps++);
-				aq += *(win++) * *(qtaps++);
-			}
+			s->kernels->sdot(&ai, &aq, &s->win[s->owin], &s->itaps[s->d * s->ataps], &s->qtaps[s->d * s->ataps], s->ataps);
 			
 			ai >>= 15;
 			aq >>= 15;
@@ -588,12 +1001,12 @@ size_t fir_int32_process(fir_int32_t *s, int32_t *out, const int32_t *in, size_t
 			
 			a >>= 15;
 			*out = a < INT32_MIN ? INT32_MIN : (a > INT32_MAX ? INT32_MAX : a);
-			out += 2;
+			out++;
 			x++;
 		}
 		s->d -= s->interpolation;
 		
-		in += 2;
+		in++;
 	}
 	
 	return(x);
@@ -611,30 +1024,156 @@ void fir_int32_free(fir_int32_t *s)
 
 /* IIR filter */
 
+/* Coefficients are held in Q30 and the output history in Q12, which
+ * keeps the feedback products within 64 bits for outputs up to 2^19.
+ * Each block is filtered in two passes: the feed-forward sums have no
+ * dependency between samples and are computed first in a loop the
+ * compiler can vectorise, then the short recursive part is run
+ * sample by sample.
+*/
+#define _IIR_Q 30
+#define _IIR_YQ 12
+#define _IIR_BLOCK 256
 
+static int64_t _iir_coeff(double v)
+{
+	return((int64_t) llround(v * (1 << _IIR_Q)));
+}
+
+static int _iir_alloc(iir_int16_t *s, int nsections)
+{
+	memset(s, 0, sizeof(iir_int16_t));
+	
+	s->nsections = nsections;
+	s->sections = calloc(nsections, sizeof(iir_int16_section_t));
+	s->buf = malloc(sizeof(int32_t) * (_IIR_BLOCK + 2));
+	
+	if(!s->sections || !s->buf)
+	{
+		iir_int16_free(s);
+		return(-1);
+	}
+	
+	return(0);
+}
+
+static void _iir_section_init(iir_int16_section_t *c, const double *a, const double *b, int order)
+{
+	int i;
+	
+	/* Normalise to a0 = 1 */
+	for(i = 0; i <= order; i++)
+	{
+		c->b[i] = _iir_coeff(b[i] / a[0]);
+	}
+	
+	for(i = 1; i <= order; i++)
+	{
+		c->a[i - 1] = _iir_coeff(a[i] / a[0]);
+	}
+}
+
+static void _iir_section_process(iir_int16_section_t *c, int32_t *x, int samples)
+{
+	int64_t ff[_IIR_BLOCK];
+	int64_t y1, y2, acc;
+	int i;
+	
+	/* x points two samples into the buffer, leaving room for the history */
+	x[-2] = c->x[1];
+	x[-1] = c->x[0];
+	c->x[1] = x[samples - 2];
+	c->x[0] = x[samples - 1];
+	
+	for(i = 0; i < samples; i++)
+	{
+		ff[i] = c->b[0] * x[i] + c->b[1] * x[i - 1] + c->b[2] * x[i - 2];
+	}
+	
+	y1 = c->y[0];
+	y2 = c->y[1];
+	
+	for(i = 0; i < samples; i++)
+	{
+		acc = ff[i] - ((c->a[0] * y1 + c->a[1] * y2) >> _IIR_YQ);
+		y2 = y1;
+		y1 = (acc + (1 << (_IIR_Q - _IIR_YQ - 1))) >> (_IIR_Q - _IIR_YQ);
+		x[i] = (acc + (1 << (_IIR_Q - 1))) >> _IIR_Q;
+	}
+	
+	c->y[0] = y1;
+	c->y[1] = y2;
+}
 
 int iir_int16_init(iir_int16_t *s, const double *a, const double *b)
 {
-	s->a[0] = a[0];
-	s->a[1] = a[1];
-	s->b[0] = b[0];
-	s->b[1] = b[1];
-	s->ix = 0;
-	s->iy = 0;
+	if(_iir_alloc(s, 1) != 0)
+	{
+		return(-1);
+	}
+	
+	_iir_section_init(&s->sections[0], a, b, 1);
+	
+	return(0);
+}
+
+int iir_int16_biquad_init(iir_int16_t *s, const double *a, const double *b)
+{
+	if(_iir_alloc(s, 1) != 0)
+	{
+		return(-1);
+	}
+	
+	_iir_section_init(&s->sections[0], a, b, 2);
+	
+	return(0);
+}
+
+int iir_int16_cascade_init(iir_int16_t *s, const double *sos, int nsections)
+{
+	int i;
+	
+	/* Each section is a row of six coefficients,
+	 * b0 b1 b2 a0 a1 a2, the same layout as scipy's sos */
+	if(nsections < 1 || _iir_alloc(s, nsections) != 0)
+	{
+		return(-1);
+	}
+	
+	for(i = 0; i < nsections; i++)
+	{
+		_iir_section_init(&s->sections[i], &sos[i * 6 + 3], &sos[i * 6], 2);
+	}
+	
 	return(0);
 }
 
 size_t iir_int16_process(iir_int16_t *s, int16_t *out, const int16_t *in, size_t samples, size_t step)
 {
-	size_t i;
+	int32_t *x = s->buf + 2;
+	size_t i, j, n;
+	int k;
 	
-	for(i = 0; i < samples; i++)
+	for(i = 0; i < samples; i += n)
 	{
-		s->iy = (double) *in * s->b[0] + s->ix * s->b[1] - s->iy * s->a[1];
-		s->ix = (double) *in;
-		*out = lround(s->iy < INT16_MIN ? INT16_MIN : (s->iy > INT16_MAX ? INT16_MAX : s->iy));
-		in += step;
-		out += step;
+		n = samples - i;
+		if(n > _IIR_BLOCK) n = _IIR_BLOCK;
+		
+		for(j = 0; j < n; j++, in += step)
+		{
+			x[j] = *in;
+		}
+		
+		/* Intermediate results are not clipped between sections */
+		for(k = 0; k < s->nsections; k++)
+		{
+			_iir_section_process(&s->sections[k], x, n);
+		}
+		
+		for(j = 0; j < n; j++, out += step)
+		{
+			*out = x[j] < INT16_MIN ? INT16_MIN : (x[j] > INT16_MAX ? INT16_MAX : x[j]);
+		}
 	}
 	
 	return(samples);
@@ -642,6 +1181,8 @@ size_t iir_int16_process(iir_int16_t *s, int16_t *out, const int16_t *in, size_t
 
 void iir_int16_free(iir_int16_t *s)
 {
+	free(s->sections);
+	free(s->buf);
 	memset(s, 0, sizeof(iir_int16_t));
 }
 
@@ -651,14 +1192,31 @@ void iir_int16_free(iir_int16_t *s)
 
 
 
+/* The attenuation applied to each sample is the largest of the
+ * shaped attenuation peaks within the window around it:
+ * 
+ * att(t) = max(peak_a[e] * shape[t - e]) >> 15, for t - width < e <= t
+ * 
+ * The shape is log-concave, so once a newer peak overtakes an older one
+ * it stays ahead until the older one leaves the window. This lets the
+ * peaks be held in a deque like a sliding window maximum, with the
+ * current largest at the front. Each peak is added and removed once,
+ * the cost per sample no longer depends on the window width. */
+
+/* Number of samples run through the input filters at a time */
+#define _LIMITER_BLOCK 256
+
 void limiter_free(limiter_t *s)
 {
 	fir_int32_free(&s->vfir);
 	fir_int32_free(&s->ffir);
 	free(s->shape);
-	free(s->att);
 	free(s->fix);
 	free(s->var);
+	free(s->peak_t);
+	free(s->peak_a);
+	free(s->vbuf);
+	free(s->fbuf);
 }
 
 int limiter_init(limiter_t *s, int16_t level, int width, const double *vtaps, const double *ftaps, int ntaps)
@@ -706,10 +1264,13 @@ int limiter_init(limiter_t *s, int16_t level, int width, const double *vtaps, co
 	
 	/* Initial state */
 	s->level = level;
-	s->att = calloc(sizeof(int16_t), s->width);
 	s->fix = calloc(sizeof(int32_t), s->width);
 	s->var = calloc(sizeof(int32_t), s->width);
-	if(!s->att || !s->fix || !s->var)
+	s->peak_t = calloc(sizeof(unsigned int), s->width);
+	s->peak_a = calloc(sizeof(int32_t), s->width);
+	s->vbuf = calloc(sizeof(int32_t), _LIMITER_BLOCK);
+	s->fbuf = calloc(sizeof(int32_t), _LIMITER_BLOCK);
+	if(!s->fix || !s->var || !s->peak_t || !s->peak_a || !s->vbuf || !s->fbuf)
 	{
 		limiter_free(s);
 		return(-1);
@@ -721,57 +1282,154 @@ int limiter_init(limiter_t *s, int16_t level, int width, const double *vtaps, co
 	return(0);
 }
 
-void limiter_process(limiter_t *s, int16_t *out, const int16_t *vin, const int16_t *fin, int samples, int step)
+/* The shaped attenuation of peak i at time t, or -1 once it has left the window */
+static inline int64_t _limiter_peak(const limiter_t *s, int i, unsigned int t)
 {
-	int i, j;
-	int32_t a, b;
+	unsigned int k;
 	
-	for(i = 0; i < samples; i++)
+	i = (s->peak_first + i) % s->width;
+	k = t - s->peak_t[i];
+	
+	return(k < s->width ? (int64_t) s->peak_a[i] * s->shape[k] : -1);
+}
+
+/* The time at which peak y overtakes the older peak x */
+static unsigned int _limiter_cross(const limiter_t *s, int x, int y)
+{
+	unsigned int lo, hi, m;
+	
+	lo = s->peak_t[(s->peak_first + y) % s->width];
+	hi = s->peak_t[(s->peak_first + x) % s->width] + s->width;
+	
+	while(lo != hi)
+	{
+		m = lo + (hi - lo) / 2;
+		
+		if(_limiter_peak(s, y, m) >= _limiter_peak(s, x, m))
+		{
+			hi = m;
+		}
+		else
+		{
+			lo = m + 1;
+		}
+	}
+	
+	return(lo);
+}
+
+static void _limiter_add_peak(limiter_t *s, int32_t a)
+{
+	unsigned int start;
+	int b;
+	
+	/* Drop expired peaks from the front */
+	while(s->peaks > 0 && _limiter_peak(s, 0, s->t) < 0)
 	{
-		s->var[s->p] = *vin;
-		s->fix[s->p] = (fin ? *fin : 0);
-		s->att[s->p] = 0;
+		if(++s->peak_first == s->width) s->peak_first = 0;
+		s->peaks--;
+	}
+	
+	/* Add the new peak to the back */
+	b = (s->peak_first + s->peaks) % s->width;
+	s->peak_t[b] = s->t;
+	s->peak_a[b] = a;
+	s->peaks++;
+	
+	/* Drop any peaks the new one overtakes before they would be the largest */
+	while(s->peaks > 1)
+	{
+		b = s->peaks - 2;
+		start = b > 0 ? _limiter_cross(s, b - 1, b) : s->t;
 		
-		/* Apply input filters */
-		if(s->vfir.type) fir_int32_process(&s->vfir, &s->var[s->p], &s->var[s->p], 1);
-		if(s->ffir.type) fir_int32_process(&s->ffir, &s->fix[s->p], &s->fix[s->p], 1);
+		if((int) (_limiter_cross(s, b, b + 1) - start) > 0)
+		{
+			break;
+		}
 		
-		/* Hard limit the fixed input */
-		if(s->fix[s->p] < -s->level) s->fix[s->p] = -s->level;
-		else if(s->fix[s->p] > s->level) s->fix[s->p] = s->level;
+		/* Remove peak b, moving the new peak down */
+		s->peak_t[(s->peak_first + b) % s->width] = s->peak_t[(s->peak_first + b + 1) % s->width];
+		s->peak_a[(s->peak_first + b) % s->width] = s->peak_a[(s->peak_first + b + 1) % s->width];
+		s->peaks--;
+	}
+}
+
+static int32_t _limiter_att(limiter_t *s)
+{
+	/* Drop peaks that have expired or been overtaken */
+	while(s->peaks > 0)
+	{
+		if(_limiter_peak(s, 0, s->t) >= 0 &&
+		   (s->peaks == 1 || _limiter_peak(s, 1, s->t) < _limiter_peak(s, 0, s->t)))
+		{
+			break;
+		}
 		
-		/* The variable signal is the difference between vin and fin */
-		s->var[s->p] -= s->fix[s->p];
+		if(++s->peak_first == s->width) s->peak_first = 0;
+		s->peaks--;
+	}
+	
+	return(s->peaks > 0 ? _limiter_peak(s, 0, s->t) >> 15 : 0);
+}
+
+void limiter_process(limiter_t *s, int16_t *out, const int16_t *vin, const int16_t *fin, int samples, int step)
+{
+	int i, n;
+	int32_t a, att;
+	
+	for(; samples > 0; samples -= n)
+	{
+		n = samples < _LIMITER_BLOCK ? samples : _LIMITER_BLOCK;
+		
+		/* Apply the input filters a block at a time. This is done
+		 * before any output is written, the input may be overwritten */
+		for(i = 0; i < n; i++)
+		{
+			s->vbuf[i] = vin[i * step];
+			s->fbuf[i] = fin ? fin[i * step] : 0;
+		}
 		
-		if(++s->p == s->width) s->p = 0;
-		if(++s->h == s->width) s->h = 0;
+		if(s->vfir.type) fir_int32_process(&s->vfir, s->vbuf, s->vbuf, n);
+		if(s->ffir.type) fir_int32_process(&s->ffir, s->fbuf, s->fbuf, n);
 		
-		/* Soft limit the variable input */
-		a = abs(s->var[s->h] + s->fix[s->h]);
-		if(a > s->level)
+		for(i = 0; i < n; i++)
 		{
-			a = INT16_MAX - (s->level + abs(s->var[s->h]) - a) * INT16_MAX / abs(s->var[s->h]);
+			s->var[s->p] = s->vbuf[i];
+			s->fix[s->p] = s->fbuf[i];
 			
-			for(j = 0; j < s->width; j++)
+			/* Hard limit the fixed input */
+			if(s->fix[s->p] < -s->level) s->fix[s->p] = -s->level;
+			else if(s->fix[s->p] > s->level) s->fix[s->p] = s->level;
+			
+			/* The variable signal is the difference between vin and fin */
+			s->var[s->p] -= s->fix[s->p];
+			
+			if(++s->p == s->width) s->p = 0;
+			if(++s->h == s->width) s->h = 0;
+			
+			/* Soft limit the variable input */
+			a = abs(s->var[s->h] + s->fix[s->h]);
+			if(a > s->level)
 			{
-				b = (a * s->shape[j]) >> 15;
-				if(b > s->att[s->p]) s->att[s->p] = b;
-				if(++s->p == s->width) s->p = 0;
+				a = INT16_MAX - (s->level + abs(s->var[s->h]) - a) * INT16_MAX / abs(s->var[s->h]);
+				_limiter_add_peak(s, a);
 			}
+			
+			att = _limiter_att(s);
+			s->t++;
+			
+			a  = s->fix[s->p];
+			a += ((int64_t) s->var[s->p] * (INT16_MAX - att)) >> 15;
+			
+			/* Hard limit to catch rounding errors */
+			if(a < -s->level) a = -s->level;
+			else if(a > s->level) a = s->level;
+			
+			out[i * step] = a;
 		}
 		
-		a  = s->fix[s->p];
-		a += ((int64_t) s->var[s->p] * (INT16_MAX - s->att[s->p])) >> 15;
-		
-		/* Hard limit to catch rounding errors */
-		if(a < -s->level) a = -s->level;
-		else if(a > s->level) a = s->level;
-		
-		*out = a;
-		
-		vin += step;
-		out += step;
-		if(fin) fin += step;
+		vin += n * step;
+		out += n * step;
+		if(fin) fin += n * step;
 	}
 }
-
@@ -18,12 +18,17 @@
 #ifndef _FIR_H
 #define _FIR_H
 
+#include "fir_simd.h"
+
 typedef struct {
 	
 	int type;
+	const fir_kernels_t *kernels;
 	
 	int interpolation;
 	int decimation;
+	int phases;
+	double error;
 	
 	unsigned int ntaps;
 	unsigned int ataps;
@@ -35,6 +40,9 @@ typedef struct {
 	int16_t *win;
 	int d;
 	
+	/* FFT convolution state */
+	struct _fir_fft_t *fft;
+	
 } fir_int16_t;
 
 typedef struct {
@@ -80,13 +88,21 @@ extern size_t fir_int32_process(fir_int32_t *s, int32_t *out, const int32_t *in,
 extern void fir_int32_free(fir_int32_t *s);
 
 typedef struct {
-	double a[2];
-	double b[2];
-	double ix;
-	double iy;
+	int64_t b[3];	/* Feed-forward taps, Q30 */
+	int64_t a[2];	/* Feedback taps a1 and a2, Q30 */
+	int32_t x[2];	/* Previous inputs */
+	int64_t y[2];	/* Previous outputs, Q12 */
+} iir_int16_section_t;
+
+typedef struct {
+	int nsections;
+	iir_int16_section_t *sections;
+	int32_t *buf;
 } iir_int16_t;
 
 extern int iir_int16_init(iir_int16_t *s, const double *a, const double *b);
+extern int iir_int16_biquad_init(iir_int16_t *s, const double *a, const double *b);
+extern int iir_int16_cascade_init(iir_int16_t *s, const double *sos, int nsections);
 extern size_t iir_int16_process(iir_int16_t *s, int16_t *out, const int16_t *in, size_t samples, size_t step);
 extern void iir_int16_free(iir_int16_t *s);
 
@@ -104,10 +120,20 @@ typedef struct {
 	int16_t level;
 	int32_t *fix;
 	int32_t *var;
-	int16_t *att;
 	int p;
 	int h;
 	
+	/* Attenuation peaks still in the window, oldest first */
+	unsigned int t;
+	unsigned int *peak_t;
+	int32_t *peak_a;
+	int peak_first;
+	int peaks;
+	
+	/* Filtered input blocks */
+	int32_t *vbuf;
+	int32_t *fbuf;
+	
 } limiter_t;
 
 extern void limiter_free(limiter_t *s);
@@ -0,0 +1,446 @@
+/* hacktv - Analogue video transmitter for the HackRF                    */
+/*=======================================================================*/
+/* Copyright 2023 Philip Heron <phil@sanslogic.co.uk>                    */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* (at your option) any later version.                                   */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+/* Multiply-accumulate kernels for the int16 FIR filters.
+ * 
+ * The C filters accumulate in 32 bits, letting the sum wrap. Integer
+ * addition is the same modulo 2^32 in any order, so the SIMD versions
+ * give exactly the same result as the scalar ones however the lanes
+ * are summed. The taps are never negated, a window sample of
+ * INT16_MIN would not survive it.
+*/
+
+#include <stdint.h>
+#include "cpu.h"
+#include "fir_simd.h"
+
+#ifdef CPU_X86
+#include <immintrin.h>
+#endif
+
+/* -=== Scalar reference ===- */
+
+static inline int32_t _dot_c(const int16_t *win, const int16_t *taps, int n)
+{
+	uint32_t a = 0;
+	int x;
+	
+	for(x = 0; x < n; x++)
+	{
+		a += (uint32_t) (win[x] * taps[x]);
+	}
+	
+	return((int32_t) a);
+}
+
+static inline void _cdot_c(int32_t *ai, int32_t *aq, const int16_t *win, const int16_t *itaps, const int16_t *qtaps, int n)
+{
+	uint32_t i = 0, q = 0;
+	int x;
+	
+	for(x = 0; x < n; x++, win += 2)
+	{
+		i += (uint32_t) (win[0] * itaps[x]) - (uint32_t) (win[1] * qtaps[x]);
+		q += (uint32_t) (win[0] * qtaps[x]) + (uint32_t) (win[1] * itaps[x]);
+	}
+	
+	*ai = (int32_t) i;
+	*aq = (int32_t) q;
+}
+
+static inline void _sdot_c(int32_t *ai, int32_t *aq, const int16_t *win, const int16_t *itaps, const int16_t *qtaps, int n)
+{
+	uint32_t i = 0, q = 0;
+	int x;
+	
+	for(x = 0; x < n; x++)
+	{
+		i += (uint32_t) (win[x] * itaps[x]);
+		q += (uint32_t) (win[x] * qtaps[x]);
+	}
+	
+	*ai = (int32_t) i;
+	*aq = (int32_t) q;
+}
+
+const fir_kernels_t fir_scalar = {
+	"scalar", _dot_c, _cdot_c, _sdot_c, 32
+};
+
+#ifdef CPU_X86
+
+/* -=== x86 SSE2 / AVX2 / AVX-512 ===- */
+
+/* The last few taps are handled by stepping back to load a full
+ * vector ending on the last tap, with the taps already summed masked
+ * to zero. _tail_mask[r] gives the mask for r remaining taps */
+static const int16_t _tail_mask[16] __attribute__((aligned(16))) = {
+	0, 0, 0, 0, 0, 0, 0, 0, -1, -1, -1, -1, -1, -1, -1, -1
+};
+
+__attribute__((target("sse2")))
+static inline int32_t _hsum_sse2(__m128i a)
+{
+	a = _mm_add_epi32(a, _mm_shuffle_epi32(a, _MM_SHUFFLE(1, 0, 3, 2)));
+	a = _mm_add_epi32(a, _mm_shuffle_epi32(a, _MM_SHUFFLE(2, 3, 0, 1)));
+	return(_mm_cvtsi128_si32(a));
+}
+
+__attribute__((target("sse2")))
+static inline __m128i _dot8_sse2(__m128i a, const int16_t *win, const int16_t *taps, __m128i mask)
+{
+	__m128i t = _mm_and_si128(_mm_loadu_si128((const __m128i *) taps), mask);
+	return(_mm_add_epi32(a, _mm_madd_epi16(_mm_loadu_si128((const __m128i *) win), t)));
+}
+
+__attribute__((target("sse2")))
+static inline void _cdot8_sse2(__m128i *i, __m128i *q, const int16_t *win, const int16_t *itaps, const int16_t *qtaps, __m128i mask)
+{
+	const __m128i z = _mm_setzero_si128();
+	__m128i w0 = _mm_loadu_si128((const __m128i *) &win[0]);
+	__m128i w1 = _mm_loadu_si128((const __m128i *) &win[8]);
+	__m128i ti = _mm_and_si128(_mm_loadu_si128((const __m128i *) itaps), mask);
+	__m128i tq = _mm_and_si128(_mm_loadu_si128((const __m128i *) qtaps), mask);
+	
+	/* I: wi * ti - wq * tq */
+	*i = _mm_add_epi32(*i, _mm_madd_epi16(w0, _mm_unpacklo_epi16(ti, z)));
+	*i = _mm_add_epi32(*i, _mm_madd_epi16(w1, _mm_unpackhi_epi16(ti, z)));
+	*i = _mm_sub_epi32(*i, _mm_madd_epi16(w0, _mm_unpacklo_epi16(z, tq)));
+	*i = _mm_sub_epi32(*i, _mm_madd_epi16(w1, _mm_unpackhi_epi16(z, tq)));
+	
+	/* Q: wi * tq + wq * ti */
+	*q = _mm_add_epi32(*q, _mm_madd_epi16(w0, _mm_unpacklo_epi16(tq, ti)));
+	*q = _mm_add_epi32(*q, _mm_madd_epi16(w1, _mm_unpackhi_epi16(tq, ti)));
+}
+
+__attribute__((target("sse2")))
+static inline void _sdot8_sse2(__m128i *i, __m128i *q, const int16_t *win, const int16_t *itaps, const int16_t *qtaps, __m128i mask)
+{
+	__m128i w = _mm_loadu_si128((const __m128i *) win);
+	*i = _mm_add_epi32(*i, _mm_madd_epi16(w, _mm_and_si128(_mm_loadu_si128((const __m128i *) itaps), mask)));
+	*q = _mm_add_epi32(*q, _mm_madd_epi16(w, _mm_and_si128(_mm_loadu_si128((const __m128i *) qtaps), mask)));
+}
+
+__attribute__((target("sse2")))
+static inline __m128i _tail_sse2(int r)
+{
+	return(_mm_loadu_si128((const __m128i *) &_tail_mask[r]));
+}
+
+__attribute__((target("sse2")))
+static int32_t _dot_sse2(const int16_t *win, const int16_t *taps, int n)
+{
+	const __m128i all = _mm_set1_epi16(-1);
+	__m128i a = _mm_setzero_si128();
+	int x;
+	
+	if(n < 8) return(_dot_c(win, taps, n));
+	
+	for(x = 0; x + 8 <= n; x += 8)
+	{
+		a = _dot8_sse2(a, &win[x], &taps[x], all);
+	}
+	
+	if(x < n)
+	{
+		a = _dot8_sse2(a, &win[n - 8], &taps[n - 8], _tail_sse2(n - x));
+	}
+	
+	return(_hsum_sse2(a));
+}
+
+__attribute__((target("sse2")))
+static void _cdot_sse2(int32_t *ai, int32_t *aq, const int16_t *win, const int16_t *itaps, const int16_t *qtaps, int n)
+{
+	const __m128i all = _mm_set1_epi16(-1);
+	__m128i i = _mm_setzero_si128();
+	__m128i q = _mm_setzero_si128();
+	int x;
+	
+	if(n < 8)
+	{
+		_cdot_c(ai, aq, win, itaps, qtaps, n);
+		return;
+	}
+	
+	for(x = 0; x + 8 <= n; x += 8)
+	{
+		_cdot8_sse2(&i, &q, &win[x * 2], &itaps[x], &qtaps[x], all);
+	}
+	
+	if(x < n)
+	{
+		_cdot8_sse2(&i, &q, &win[(n - 8) * 2], &itaps[n - 8], &qtaps[n - 8], _tail_sse2(n - x));
+	}
+	
+	*ai = _hsum_sse2(i);
+	*aq = _hsum_sse2(q);
+}
+
+__attribute__((target("sse2")))
+static void _sdot_sse2(int32_t *ai, int32_t *aq, const int16_t *win, const int16_t *itaps, const int16_t *qtaps, int n)
+{
+	const __m128i all = _mm_set1_epi16(-1);
+	__m128i i = _mm_setzero_si128();
+	__m128i q = _mm_setzero_si128();
+	int x;
+	
+	if(n < 8)
+	{
+		_sdot_c(ai, aq, win, itaps, qtaps, n);
+		return;
+	}
+	
+	for(x = 0; x + 8 <= n; x += 8)
+	{
+		_sdot8_sse2(&i, &q, &win[x], &itaps[x], &qtaps[x], all);
+	}
+	
+	if(x < n)
+	{
+		_sdot8_sse2(&i, &q, &win[n - 8], &itaps[n - 8], &qtaps[n - 8], _tail_sse2(n - x));
+	}
+	
+	*ai = _hsum_sse2(i);
+	*aq = _hsum_sse2(q);
+}
+
+/* The AVX2 versions work 16 taps at a time, finishing
+ * the last 8 or fewer with the 128-bit steps above */
+
+__attribute__((target("avx2")))
+static inline __m128i _fold_avx2(__m256i a)
+{
+	return(_mm_add_epi32(_mm256_castsi256_si128(a), _mm256_extracti128_si256(a, 1)));
+}
+
+__attribute__((target("avx2")))
+static int32_t _dot_avx2(const int16_t *win, const int16_t *taps, int n)
+{
+	const __m128i all = _mm_set1_epi16(-1);
+	__m256i a = _mm256_setzero_si256();
+	__m128i b;
+	int x;
+	
+	if(n < 8) return(_dot_c(win, taps, n));
+	
+	for(x = 0; x + 16 <= n; x += 16)
+	{
+		a = _mm256_add_epi32(a, _mm256_madd_epi16(
+			_mm256_loadu_si256((const __m256i *) &win[x]),
+			_mm256_loadu_si256((const __m256i *) &taps[x])
+		));
+	}
+	
+	b = _fold_avx2(a);
+	
+	if(x + 8 <= n)
+	{
+		b = _dot8_sse2(b, &win[x], &taps[x], all);
+		x += 8;
+	}
+	
+	if(x < n)
+	{
+		b = _dot8_sse2(b, &win[n - 8], &taps[n - 8], _tail_sse2(n - x));
+	}
+	
+	return(_hsum_sse2(b));
+}
+
+__attribute__((target("avx2")))
+static void _cdot_avx2(int32_t *ai, int32_t *aq, const int16_t *win, const int16_t *itaps, const int16_t *qtaps, int n)
+{
+	const __m128i all = _mm_set1_epi16(-1);
+	const __m256i z = _mm256_setzero_si256();
+	__m256i i = z, q = z;
+	__m256i w0, w1, t0, t1, ti, tq;
+	__m128i bi, bq;
+	int x;
+	
+	if(n < 8)
+	{
+		_cdot_c(ai, aq, win, itaps, qtaps, n);
+		return;
+	}
+	
+	for(x = 0; x + 16 <= n; x += 16)
+	{
+		/* The unpacks work within each 128-bit lane, so the window is
+		 * loaded to match: w0 = complex taps 0-3 and 8-11, w1 = 4-7 and 12-15 */
+		t0 = _mm256_loadu_si256((const __m256i *) &win[x * 2]);
+		t1 = _mm256_loadu_si256((const __m256i *) &win[x * 2 + 16]);
+		w0 = _mm256_permute2x128_si256(t0, t1, 0x20);
+		w1 = _mm256_permute2x128_si256(t0, t1, 0x31);
+		ti = _mm256_loadu_si256((const __m256i *) &itaps[x]);
+		tq = _mm256_loadu_si256((const __m256i *) &qtaps[x]);
+		
+		/* I: wi * ti - wq * tq */
+		i = _mm256_add_epi32(i, _mm256_madd_epi16(w0, _mm256_unpacklo_epi16(ti, z)));
+		i = _mm256_add_epi32(i, _mm256_madd_epi16(w1, _mm256_unpackhi_epi16(ti, z)));
+		i = _mm256_sub_epi32(i, _mm256_madd_epi16(w0, _mm256_unpacklo_epi16(z, tq)));
+		i = _mm256_sub_epi32(i, _mm256_madd_epi16(w1, _mm256_unpackhi_epi16(z, tq)));
+		
+		/* Q: wi * tq + wq * ti */
+		q = _mm256_add_epi32(q, _mm256_madd_epi16(w0, _mm256_unpacklo_epi16(tq, ti)));
+		q = _mm256_add_epi32(q, _mm256_madd_epi16(w1, _mm256_unpackhi_epi16(tq, ti)));
+	}
+	
+	bi = _fold_avx2(i);
+	bq = _fold_avx2(q);
+	
+	if(x + 8 <= n)
+	{
+		_cdot8_sse2(&bi, &bq, &win[x * 2], &itaps[x], &qtaps[x], all);
+		x += 8;
+	}
+	
+	if(x < n)
+	{
+		_cdot8_sse2(&bi, &bq, &win[(n - 8) * 2], &itaps[n - 8], &qtaps[n - 8], _tail_sse2(n - x));
+	}
+	
+	*ai = _hsum_sse2(bi);
+	*aq = _hsum_sse2(bq);
+}
+
+__attribute__((target("avx2")))
+static void _sdot_avx2(int32_t *ai, int32_t *aq, const int16_t *win, const int16_t *itaps, const int16_t *qtaps, int n)
+{
+	const __m128i all = _mm_set1_epi16(-1);
+	__m256i i = _mm256_setzero_si256();
+	__m256i q = _mm256_setzero_si256();
+	__m256i w;
+	__m128i bi, bq;
+	int x;
+	
+	if(n < 8)
+	{
+		_sdot_c(ai, aq, win, itaps, qtaps, n);
+		return;
+	}
+	
+	for(x = 0; x + 16 <= n; x += 16)
+	{
+		w = _mm256_loadu_si256((const __m256i *) &win[x]);
+		i = _mm256_add_epi32(i, _mm256_madd_epi16(w, _mm256_loadu_si256((const __m256i *) &itaps[x])));
+		q = _mm256_add_epi32(q, _mm256_madd_epi16(w, _mm256_loadu_si256((const __m256i *) &qtaps[x])));
+	}
+	
+	bi = _fold_avx2(i);
+	bq = _fold_avx2(q);
+	
+	if(x + 8 <= n)
+	{
+		_sdot8_sse2(&bi, &bq, &win[x], &itaps[x], &qtaps[x], all);
+		x += 8;
+	}
+	
+	if(x < n)
+	{
+		_sdot8_sse2(&bi, &bq, &win[n - 8], &itaps[n - 8], &qtaps[n - 8], _tail_sse2(n - x));
+	}
+	
+	*ai = _hsum_sse2(bi);
+	*aq = _hsum_sse2(bq);
+}
+
+/* AVX-512 uses masked loads for the last taps, the masked
+ * lanes are never read so can run off the end of the arrays */
+
+__attribute__((target("avx512bw")))
+static int32_t _dot_avx512(const int16_t *win, const int16_t *taps, int n)
+{
+	__m512i a = _mm512_setzero_si512();
+	__mmask32 m;
+	int x;
+	
+	for(x = 0; x + 32 <= n; x += 32)
+	{
+		a = _mm512_add_epi32(a, _mm512_madd_epi16(
+			_mm512_loadu_si512((const void *) &win[x]),
+			_mm512_loadu_si512((const void *) &taps[x])
+		));
+	}
+	
+	if(x < n)
+	{
+		m = (__mmask32) ((1ULL << (n - x)) - 1);
+		a = _mm512_add_epi32(a, _mm512_madd_epi16(
+			_mm512_maskz_loadu_epi16(m, &win[x]),
+			_mm512_maskz_loadu_epi16(m, &taps[x])
+		));
+	}
+	
+	return(_mm512_reduce_add_epi32(a));
+}
+
+__attribute__((target("avx512bw")))
+static void _sdot_avx512(int32_t *ai, int32_t *aq, const int16_t *win, const int16_t *itaps, const int16_t *qtaps, int n)
+{
+	__m512i i = _mm512_setzero_si512();
+	__m512i q = _mm512_setzero_si512();
+	__m512i w;
+	__mmask32 m;
+	int x;
+	
+	for(x = 0; x + 32 <= n; x += 32)
+	{
+		w = _mm512_loadu_si512((const void *) &win[x]);
+		i = _mm512_add_epi32(i, _mm512_madd_epi16(w, _mm512_loadu_si512((const void *) &itaps[x])));
+		q = _mm512_add_epi32(q, _mm512_madd_epi16(w, _mm512_loadu_si512((const void *) &qtaps[x])));
+	}
+	
+	if(x < n)
+	{
+		m = (__mmask32) ((1ULL << (n - x)) - 1);
+		w = _mm512_maskz_loadu_epi16(m, &win[x]);
+		i = _mm512_add_epi32(i, _mm512_madd_epi16(w, _mm512_maskz_loadu_epi16(m, &itaps[x])));
+		q = _mm512_add_epi32(q, _mm512_madd_epi16(w, _mm512_maskz_loadu_epi16(m, &qtaps[x])));
+	}
+	
+	*ai = _mm512_reduce_add_epi32(i);
+	*aq = _mm512_reduce_add_epi32(q);
+}
+
+static const fir_kernels_t _fir_sse2 = {
+	"sse2", _dot_sse2, _cdot_sse2, _sdot_sse2, 320
+};
+
+static const fir_kernels_t _fir_avx2 = {
+	"avx2", _dot_avx2, _cdot_avx2, _sdot_avx2, 512
+};
+
+/* The complex window gains little from the wider
+ * registers, the AVX2 version is used for it */
+static const fir_kernels_t _fir_avx512 = {
+	"avx512", _dot_avx512, _cdot_avx2, _sdot_avx512, 1280
+};
+
+#endif
+
+const fir_kernels_t *fir_kernels(int features)
+{
+#ifdef CPU_X86
+	if(features & CPU_AVX512BW) return(&_fir_avx512);
+	if(features & CPU_AVX2)     return(&_fir_avx2);
+	if(features & CPU_SSE2)     return(&_fir_sse2);
+#endif
+	
+	return(&fir_scalar);
+}
+
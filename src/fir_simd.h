@@ -0,0 +1,55 @@
+/* hacktv - Analogue video transmitter for the HackRF                    */
+/*=======================================================================*/
+/* Copyright 2023 Philip Heron <phil@sanslogic.co.uk>                    */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* (at your option) any later version.                                   */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+#ifndef _FIR_SIMD_H
+#define _FIR_SIMD_H
+
+#include <stdint.h>
+
+/* Real dot product: sum of win[x] * taps[x] for n taps */
+typedef int32_t (*fir_dot_t)(const int16_t *win, const int16_t *taps, int n);
+
+/* Complex dot product of the interleaved I/Q window with the
+ * complex taps itaps + j * qtaps, for n taps:
+ * ai = sum of win[x * 2] * itaps[x] - win[x * 2 + 1] * qtaps[x]
+ * aq = sum of win[x * 2] * qtaps[x] + win[x * 2 + 1] * itaps[x] */
+typedef void (*fir_cdot_t)(int32_t *ai, int32_t *aq, const int16_t *win, const int16_t *itaps, const int16_t *qtaps, int n);
+
+/* Real window, complex taps:
+ * ai = sum of win[x] * itaps[x]
+ * aq = sum of win[x] * qtaps[x] */
+typedef void (*fir_sdot_t)(int32_t *ai, int32_t *aq, const int16_t *win, const int16_t *itaps, const int16_t *qtaps, int n);
+
+typedef struct {
+	const char *name;
+	fir_dot_t dot;
+	fir_cdot_t cdot;
+	fir_sdot_t sdot;
+	
+	/* Shortest real filter that runs faster as an FFT convolution
+	 * than with these kernels, measured on x86 */
+	int fft_taps;
+} fir_kernels_t;
+
+/* The plain C versions, used as the reference */
+extern const fir_kernels_t fir_scalar;
+
+/* Returns the fastest kernels for the CPU features given */
+extern const fir_kernels_t *fir_kernels(int features);
+
+#endif
+
@@ -0,0 +1,159 @@
+/* hacktv - Analogue video transmitter for the HackRF                    */
+/*=======================================================================*/
+/* Copyright 2023 Philip Heron <phil@sanslogic.co.uk>                    */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* (at your option) any later version.                                   */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+/* Checks that every FIR kernel backend this CPU can run gives exactly
+ * the same results as the scalar reference. Run with "make check".
+ * 
+ * The window and taps are random, with a share of INT16_MIN and
+ * INT16_MAX values to exercise the wrapping sums. Every tap count from
+ * 0 to _MAX_TAPS is tried, with the window and taps starting at
+ * different offsets from the vector alignment.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include "cpu.h"
+#include "fir_simd.h"
+
+#define _MAX_TAPS 260
+#define _OFFSETS 16
+#define _ROUNDS 4
+
+/* Features that can select a different backend */
+static const int _features[] = {
+	CPU_SSE2, CPU_SSSE3, CPU_AVX2, CPU_AVX512BW, 0
+};
+
+static uint32_t _seed = 1;
+
+static int16_t _random(int round)
+{
+	uint32_t r;
+	
+	/* A simple LCG, the same sequence on every platform */
+	_seed = _seed * 1103515245 + 12345;
+	r = _seed >> 8;
+	
+	/* The first round uses only the extremes,
+	 * the others one in eight of them */
+	switch(r & (round == 0 ? 1 : 15))
+	{
+	case 0: return(INT16_MIN);
+	case 1: return(INT16_MAX);
+	}
+	
+	return(r >> 8);
+}
+
+static int _check(const fir_kernels_t *k, int round)
+{
+	static int16_t win[(_MAX_TAPS + _OFFSETS) * 2];
+	static int16_t itaps[_MAX_TAPS + _OFFSETS];
+	static int16_t qtaps[_MAX_TAPS + _OFFSETS];
+	int32_t ri, rq, ai, aq;
+	int n, o, ot, x;
+	int errors = 0;
+	
+	for(x = 0; x < (_MAX_TAPS + _OFFSETS) * 2; x++)
+	{
+		win[x] = _random(round);
+	}
+	
+	for(x = 0; x < _MAX_TAPS + _OFFSETS; x++)
+	{
+		itaps[x] = _random(round);
+		qtaps[x] = _random(round);
+	}
+	
+	for(n = 0; n <= _MAX_TAPS; n++)
+	{
+		for(o = 0; o < _OFFSETS; o++)
+		{
+			/* Move the taps independently of the window */
+			ot = (o * 7 + n) % _OFFSETS;
+			
+			ri = fir_scalar.dot(&win[o], &itaps[ot], n);
+			ai = k->dot(&win[o], &itaps[ot], n);
+			
+			if(ai != ri)
+			{
+				fprintf(stderr, "%s dot: n = %d, offsets %d/%d: %d != %d\n", k->name, n, o, ot, ai, ri);
+				errors++;
+			}
+			
+			fir_scalar.cdot(&ri, &rq, &win[o], &itaps[ot], &qtaps[o], n);
+			k->cdot(&ai, &aq, &win[o], &itaps[ot], &qtaps[o], n);
+			
+			if(ai != ri || aq != rq)
+			{
+				fprintf(stderr, "%s cdot: n = %d, offsets %d/%d: %d,%d != %d,%d\n", k->name, n, o, ot, ai, aq, ri, rq);
+				errors++;
+			}
+			
+			fir_scalar.sdot(&ri, &rq, &win[o], &itaps[ot], &qtaps[o], n);
+			k->sdot(&ai, &aq, &win[o], &itaps[ot], &qtaps[o], n);
+			
+			if(ai != ri || aq != rq)
+			{
+				fprintf(stderr, "%s sdot: n = %d, offsets %d/%d: %d,%d != %d,%d\n", k->name, n, o, ot, ai, aq, ri, rq);
+				errors++;
+			}
+		}
+	}
+	
+	return(errors);
+}
+
+int main(int argc, char *argv[])
+{
+	const fir_kernels_t *tested[sizeof(_features) / sizeof(int)];
+	const fir_kernels_t *k;
+	int i, j, r, ntested = 0;
+	int errors, failed = 0;
+	
+	for(i = 0; _features[i]; i++)
+	{
+		if((cpu_features() & _features[i]) == 0) continue;
+		
+		k = fir_kernels(_features[i]);
+		if(k == &fir_scalar) continue;
+		
+		/* Some features share a backend */
+		for(j = 0; j < ntested && tested[j] != k; j++);
+		if(j < ntested) continue;
+		
+		tested[ntested++] = k;
+		
+		for(errors = r = 0; r < _ROUNDS; r++)
+		{
+			errors += _check(k, r);
+		}
+		
+		printf("%s: %s\n", k->name, errors ? "FAILED" : "OK");
+		
+		if(errors) failed = 1;
+	}
+	
+	if(ntested == 0)
+	{
+		printf("No SIMD FIR kernels for this CPU\n");
+	}
+	
+	return(failed);
+}
+
@@ -21,9 +21,11 @@
 #include <string.h>
 #include <getopt.h>
 #include <signal.h>
+#include <time.h>
 #include "hacktv.h"
 #include "av.h"
 #include "rf.h"
+#include "cpu.h"
 
 #ifdef WIN32
 #define OS_SEP '\\'
@@ -152,6 +154,16 @@ static void print_usage(void)
 		"                                 white levels.\n"
 		"      --secam-field-id           Enable SECAM field identification.\n"
 		"      --json                     Output a JSON array when used with --list-modes.\n"
+		"      --threaded                 Run the video and audio line processes on\n"
+		"                                 multiple threads.\n"
+		"      --block-lines <value>      Set the number of lines rendered and written\n"
+		"                                 at once, or 'field'. Default: field\n"
+		"      --compact-colour           Use small colour conversion tables instead of\n"
+		"                                 the 96 MiB lookup. Levels may differ by +/-1.\n"
+		"      --nosimd                   Use the plain C versions of the SIMD kernels.\n"
+		"      --replay-cache <mode>      Cache one colour cycle of the output and\n"
+		"                                 replay it for static sources. Modes: auto\n"
+		"                                 (once the output repeats exactly) or on.\n"
 		"      --version                  Print the version number and exit.\n"
 		"\n"
 		"Input options\n"
@@ -200,6 +212,28 @@ static void print_usage(void)
 		"\n"
 		"  -o, --output file:<filename>   Open a file for output. Use - for stdout.\n"
 		"  -t, --type <type>              Set the file data type.\n"
+		"      --file-buffers <value>     Number of buffers for the file writer thread.\n"
+		"                                 0 writes from the render thread. Default: 4\n"
+		"                                 for regular files, 0 for pipes and stdout.\n"
+		"      --file-buffer-size <MiB>   Size of each file writer buffer. Default: 4\n"
+		"      --direct-io                Write the file with O_DIRECT, bypassing the\n"
+		"                                 page cache. On Linux, falls back to\n"
+		"                                 sync_file_range() and posix_fadvise()\n"
+		"                                 where O_DIRECT isn't supported.\n"
+		"      --mmap                     Write the file through a memory map.\n"
+		"      --segment-size <MiB>       Start a new file after this many MiB.\n"
+		"      --segment-time <seconds>   Start a new file after this many seconds.\n"
+		"                                 Segments imply --mmap. The filename needs\n"
+		"                                 a %%d for the segment number, eg.\n"
+		"                                 out-%%05d.iq. Each segment is written as\n"
+		"                                 <filename>.part until it's complete.\n"
+		"      --sigmf                    Write SigMF metadata next to the file,\n"
+		"                                 with an annotation for each frame.\n"
+		"      --compress <level>         Compress the file with zlib, level 1 to 9.\n"
+		"                                 Each file writer buffer becomes one chunk.\n"
+		"                                 --passthru reads these files directly.\n"
+		"      --compress-threads <value> Number of compression threads.\n"
+		"                                 Default: one per CPU, up to 4\n"
 		"\n"
 		"Supported file types:\n"
 		"\n"
@@ -367,42 +401,6 @@ static void print_usage(void)
 	);
 }
 
-/* fputs() a string with JSON-style escape sequences */
-static int _fputs_json(const char *str, FILE *stream)
-{
-	int c;
-	
-	for(c = 0; *str; str++)
-	{
-		const char *s = NULL;
-		int r;
-		
-		switch(*str)
-		{
-		case '"': s = "\\\""; break;
-		case '\\': s = "\\\\"; break;
-		//case '/': s = "\\/"; break;
-		case '\b': s = "\\b"; break;
-		case '\f': s = "\\f"; break;
-		case '\n': s = "\\n"; break;
-		case '\r': s = "\\r"; break;
-		case '\t': s = "\\t"; break;
-		}
-		
-		if(s) r = fputs(s, stream);
-		else r = fputc(*str, stream) == EOF ? EOF : 1;
-		
-		if(r == EOF)
-		{
-			return(c > 0 ? c : EOF);
-		}
-		
-		c += r;
-	}
-	
-	return(c);
-}
-
 /* List all avaliable modes, optionally formatted as a JSON array */
 static void _list_modes(int json)
 {
@@ -416,9 +414,9 @@ static void _list_modes(int json)
 		if(json)
 		{
 			printf("  {\n    \"id\": \"");
-			_fputs_json(vc->id, stdout);
+			fputs_json(vc->id, stdout);
 			printf("\",\n    \"description\": \"");
-			_fputs_json(vc->desc ? vc->desc : "", stdout);
+			fputs_json(vc->desc ? vc->desc : "", stdout);
 			printf("\"\n  }%s\n", vc[1].id != NULL ? "," : "");
 		}
 		else
@@ -498,6 +496,20 @@ enum {
 	_OPT_MAX_ASPECT,
 	_OPT_LETTERBOX,
 	_OPT_PILLARBOX,
+	_OPT_THREADED,
+	_OPT_BLOCK_LINES,
+	_OPT_COMPACT_COLOUR,
+	_OPT_NOSIMD,
+	_OPT_REPLAY_CACHE,
+	_OPT_FILE_BUFFERS,
+	_OPT_FILE_BUFFER_SIZE,
+	_OPT_DIRECT_IO,
+	_OPT_MMAP,
+	_OPT_SEGMENT_SIZE,
+	_OPT_SEGMENT_TIME,
+	_OPT_SIGMF,
+	_OPT_COMPRESS,
+	_OPT_COMPRESS_THREADS,
 	_OPT_VERSION,
 };
 
@@ -592,6 +604,21 @@ int main(int argc, char *argv[])
 		{ "showecm",        no_argument,       0, _OPT_SHOW_ECM },
 		{ "downmix",        no_argument,       0, _OPT_DOWNMIX },
 		{ "volume",         required_argument, 0, _OPT_VOLUME },
+		{ "threaded",       no_argument,       0, _OPT_THREADED },
+		{ "block-lines",    required_argument, 0, _OPT_BLOCK_LINES },
+		{ "compact-colour", no_argument,       0, _OPT_COMPACT_COLOUR },
+		{ "compact-color",  no_argument,       0, _OPT_COMPACT_COLOUR },
+		{ "nosimd",         no_argument,       0, _OPT_NOSIMD },
+		{ "replay-cache",   required_argument, 0, _OPT_REPLAY_CACHE },
+		{ "file-buffers",   required_argument, 0, _OPT_FILE_BUFFERS },
+		{ "file-buffer-size", required_argument, 0, _OPT_FILE_BUFFER_SIZE },
+		{ "direct-io",      no_argument,       0, _OPT_DIRECT_IO },
+		{ "mmap",           no_argument,       0, _OPT_MMAP },
+		{ "segment-size",   required_argument, 0, _OPT_SEGMENT_SIZE },
+		{ "segment-time",   required_argument, 0, _OPT_SEGMENT_TIME },
+		{ "sigmf",          no_argument,       0, _OPT_SIGMF },
+		{ "compress",       required_argument, 0, _OPT_COMPRESS },
+		{ "compress-threads", required_argument, 0, _OPT_COMPRESS_THREADS },
 		{ "version",        no_argument,       0, _OPT_VERSION },
 		{ 0,                0,                 0,  0  }
 	};
@@ -601,6 +628,7 @@ int main(int argc, char *argv[])
 	char *pre, *sub;
 	int l;
 	int r;
+	struct timespec ts[2];
 	
 	/* Disable console output buffer in Windows */
 	#ifdef WIN32
@@ -673,6 +701,20 @@ int main(int argc, char *argv[])
 	s.file_type = RF_INT16;
 	s.raw_bb_blanking_level = 0;
 	s.raw_bb_white_level = INT16_MAX;
+	s.threaded = 0;
+	s.block_lines = 0;
+	s.compact_colour = 0;
+	s.nosimd = 0;
+	s.replay = VID_REPLAY_OFF;
+	s.file_buffers = -1;
+	s.file_buffer_size = 4;
+	s.direct_io = 0;
+	s.mmap = 0;
+	s.segment_size = 0;
+	s.segment_time = 0;
+	s.sigmf = 0;
+	s.compress = 0;
+	s.compress_threads = 0;
 	
 	opterr = 0;
 	while((c = getopt_long(argc, argv, "o:m:s:D:G:irvf:al:g:A:t:p:", long_options, &option_index)) != -1)
@@ -1126,6 +1168,122 @@ int main(int argc, char *argv[])
 			
 			break;
 		
+		case _OPT_THREADED: /* --threaded */
+			s.threaded = 1;
+			break;
+		
+		case _OPT_BLOCK_LINES: /* --block-lines <value|field> */
+			if(strcmp(optarg, "field") == 0)
+			{
+				s.block_lines = 0;
+			}
+			else
+			{
+				s.block_lines = atoi(optarg);
+				
+				if(s.block_lines < 1)
+				{
+					fprintf(stderr, "Invalid block size '%s'.\n", optarg);
+					return(-1);
+				}
+			}
+			break;
+		
+		case _OPT_COMPACT_COLOUR: /* --compact-colour */
+			s.compact_colour = 1;
+			break;
+		
+		case _OPT_NOSIMD: /* --nosimd */
+			s.nosimd = 1;
+			break;
+		
+		case _OPT_FILE_BUFFERS: /* --file-buffers <value> */
+			s.file_buffers = atoi(optarg);
+			
+			if(s.file_buffers < 0)
+			{
+				fprintf(stderr, "Invalid number of file buffers '%s'.\n", optarg);
+				return(-1);
+			}
+			break;
+		
+		case _OPT_FILE_BUFFER_SIZE: /* --file-buffer-size <MiB> */
+			s.file_buffer_size = atoi(optarg);
+			
+			if(s.file_buffer_size < 1)
+			{
+				fprintf(stderr, "Invalid file buffer size '%s'.\n", optarg);
+				return(-1);
+			}
+			break;
+		
+		case _OPT_DIRECT_IO: /* --direct-io */
+			s.direct_io = 1;
+			break;
+		
+		case _OPT_MMAP: /* --mmap */
+			s.mmap = 1;
+			break;
+		
+		case _OPT_SEGMENT_SIZE: /* --segment-size <MiB> */
+			s.segment_size = atoi(optarg);
+			s.mmap = 1;
+			
+			if(s.segment_size < 1)
+			{
+				fprintf(stderr, "Invalid segment size '%s'.\n", optarg);
+				return(-1);
+			}
+			break;
+		
+		case _OPT_SEGMENT_TIME: /* --segment-time <seconds> */
+			s.segment_time = atof(optarg);
+			s.mmap = 1;
+			
+			if(s.segment_time <= 0)
+			{
+				fprintf(stderr, "Invalid segment time '%s'.\n", optarg);
+				return(-1);
+			}
+			break;
+		
+		case _OPT_SIGMF: /* --sigmf */
+			s.sigmf = 1;
+			break;
+		
+		case _OPT_COMPRESS: /* --compress <level> */
+			s.compress = atoi(optarg);
+			
+			if(s.compress < 1 || s.compress > 9)
+			{
+				fprintf(stderr, "Invalid compression level '%s'.\n", optarg);
+				return(-1);
+			}
+			
+			break;
+		
+		case _OPT_COMPRESS_THREADS: /* --compress-threads <value> */
+			s.compress_threads = atoi(optarg);
+			
+			if(s.compress_threads < 1)
+			{
+				fprintf(stderr, "Invalid number of compression threads '%s'.\n", optarg);
+				return(-1);
+			}
+			
+			break;
+		
+		case _OPT_REPLAY_CACHE: /* --replay-cache <auto|on> */
+			if(strcmp(optarg, "auto") == 0) s.replay = VID_REPLAY_AUTO;
+			else if(strcmp(optarg, "on") == 0) s.replay = VID_REPLAY_ON;
+			else if(strcmp(optarg, "off") == 0) s.replay = VID_REPLAY_OFF;
+			else
+			{
+				fprintf(stderr, "Unrecognised replay cache mode '%s'.\n", optarg);
+				return(-1);
+			}
+			break;
+		
 		case _OPT_VERSION: /* --version */
 			print_version();
 			return(0);
@@ -1540,6 +1698,17 @@ int main(int argc, char *argv[])
 		vid_conf.vfilter = 1;
 	}
 	
+	vid_conf.threaded = s.threaded;
+	vid_conf.block_lines = s.block_lines;
+	vid_conf.compact_colour = s.compact_colour;
+	vid_conf.replay = s.replay;
+	vid_conf.verbose = s.verbose;
+	
+	if(s.nosimd)
+	{
+		cpu_disable(~0);
+	}
+	
 	if(s.sis)
 	{
 		if(vid_conf.lines != 625)
@@ -1561,7 +1730,31 @@ int main(int argc, char *argv[])
 	vid_conf.raw_bb_white_level = s.raw_bb_white_level;
 	vid_conf.secam_field_id = s.secam_field_id;
 	
+	/* Check the output options before anything is opened */
+	if(s.compress > 0 && s.mmap)
+	{
+		fprintf(stderr, "Compressed output can't be memory mapped or segmented.\n");
+		return(-1);
+	}
+	
+	if(s.sigmf)
+	{
+		if(strcmp(s.output_type, "file") != 0 || s.segment_size > 0 || s.segment_time > 0)
+		{
+			fprintf(stderr, "SigMF metadata is only supported for a single output file.\n");
+			return(-1);
+		}
+		
+		if(s.compress > 0)
+		{
+			fprintf(stderr, "SigMF metadata can't describe a compressed file.\n");
+			return(-1);
+		}
+	}
+	
 	/* Setup video encoder */
+	clock_gettime(CLOCK_MONOTONIC, &ts[0]);
+	
 	r = vid_init(&s.vid, s.samplerate, s.pixelrate, &vid_conf);
 	if(r != VID_OK)
 	{
@@ -1569,6 +1762,14 @@ int main(int argc, char *argv[])
 		return(-1);
 	}
 	
+	if(s.verbose)
+	{
+		clock_gettime(CLOCK_MONOTONIC, &ts[1]);
+		fprintf(stderr, "Video encoder initialised in %.3f seconds.\n",
+			(ts[1].tv_sec - ts[0].tv_sec) + (ts[1].tv_nsec - ts[0].tv_nsec) / 1e9
+		);
+	}
+	
 	vid_info(&s.vid);
 	
 	if(strcmp(s.output_type, "hackrf") == 0)
@@ -1613,10 +1814,28 @@ int main(int argc, char *argv[])
 		return(-1);
 #endif
 	}
+	else if(strcmp(s.output_type, "file") == 0 && s.mmap)
+	{
+		if(rf_mmap_open(&s.rf, s.output, s.file_type, s.vid.conf.output_type == RF_INT16_COMPLEX, (size_t) s.segment_size << 20, (size_t) (s.segment_time * s.vid.sample_rate + 0.5)) != RF_OK)
+		{
+			vid_free(&s.vid);
+			return(-1);
+		}
+	}
 	else if(strcmp(s.output_type, "file") == 0)
 	{
-		if(rf_file_open(&s.rf, s.output, s.file_type, s.vid.conf.output_type == RF_INT16_COMPLEX) != RF_OK)
+		if(rf_file_open(&s.rf, s.output, s.file_type, s.vid.conf.output_type == RF_INT16_COMPLEX, s.file_buffers, (size_t) s.file_buffer_size << 20, s.direct_io, s.compress, s.compress_threads) != RF_OK)
+		{
+			vid_free(&s.vid);
+			return(-1);
+		}
+	}
+	
+	if(s.sigmf)
+	{
+		if(sigmf_open(&s.sigmf_meta, s.output, s.mode, s.file_type, s.vid.conf.output_type == RF_INT16_COMPLEX, &s.vid, s.frequency) != 0)
 		{
+			rf_close(&s.rf);
 			vid_free(&s.vid);
 			return(-1);
 		}
@@ -1707,11 +1926,13 @@ int main(int argc, char *argv[])
 			while(!_abort)
 			{
 				size_t samples;
-				int16_t *data = vid_next_line(&s.vid, &samples);
+				int16_t *data = vid_next_block(&s.vid, &samples);
 				
 				if(data == NULL) break;
 				
 				if(rf_write(&s.rf, data, samples) != RF_OK) break;
+				
+				sigmf_block(&s.sigmf_meta, &s.vid, samples);
 			}
 			
 			if(_signal)
@@ -1720,12 +1941,13 @@ int main(int argc, char *argv[])
 				_signal = 0;
 			}
 			
-			av_close(&s.vid.av);
+			vid_av_close(&s.vid);
 		}
 	}
 	while(s.repeat && !_abort);
 	
 	rf_close(&s.rf);
+	sigmf_close(&s.sigmf_meta);
 	vid_free(&s.vid);
 	
 	av_ffmpeg_deinit();
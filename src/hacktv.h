@@ -20,6 +20,7 @@
 #include <stdint.h>
 #include "video.h"
 #include "rf.h"
+#include "sigmf.h"
 
 /* Return codes */
 #define HACKTV_OK             0
@@ -109,10 +110,27 @@ typedef struct {
 	int json;
 	char *ffmt;
 	char *fopts;
+	int threaded;
+	int block_lines;
+	int compact_colour;
+	int nosimd;
+	int replay;
+	int file_buffers;
+	int file_buffer_size;
+	int direct_io;
+	int mmap;
+	int segment_size;
+	double segment_time;
+	int sigmf;
+	int compress;
+	int compress_threads;
 	
 	/* Video encoder state */
 	vid_t vid;
 	
+	/* SigMF metadata for file output */
+	sigmf_t sigmf_meta;
+	
 	/* RF sink interface */
 	rf_t rf;
 	
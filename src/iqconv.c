@@ -0,0 +1,591 @@
+/* hacktv - Analogue video transmitter for the HackRF                    */
+/*=======================================================================*/
+/* Copyright 2023 Philip Heron <phil@sanslogic.co.uk>                    */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* (at your option) any later version.                                   */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+/* Sample format conversion for the RF outputs
+ * 
+ * Each SIMD version gives exactly the same result as the scalar
+ * version. For float, dividing by 32767 in single precision rounds
+ * the same as the double precision multiply it replaces, for every
+ * int16 input. The division in the scaler is done as a multiply:
+ * 
+ * y / 32767 == (y + 1 + ((y + 1) >> 15)) >> 15
+ * 
+ * which is exact for 0 <= y <= 32768 * 32767.
+*/
+
+#include <stdint.h>
+#include <string.h>
+#include "cpu.h"
+#include "rf.h"
+#include "iqconv.h"
+
+#ifdef CPU_X86
+#include <immintrin.h>
+#endif
+
+/* -=== Scalar reference ===- */
+
+static void _uint8_real_c(void *dst, const int16_t *iq_data, size_t samples)
+{
+	uint8_t *u8 = dst;
+	size_t i;
+	
+	for(i = 0; i < samples; i++, iq_data += 2)
+	{
+		u8[i] = (iq_data[0] - INT16_MIN) >> 8;
+	}
+}
+
+static void _int8_real_c(void *dst, const int16_t *iq_data, size_t samples)
+{
+	int8_t *i8 = dst;
+	size_t i;
+	
+	for(i = 0; i < samples; i++, iq_data += 2)
+	{
+		i8[i] = iq_data[0] >> 8;
+	}
+}
+
+static void _uint16_real_c(void *dst, const int16_t *iq_data, size_t samples)
+{
+	uint16_t *u16 = dst;
+	size_t i;
+	
+	for(i = 0; i < samples; i++, iq_data += 2)
+	{
+		u16[i] = (iq_data[0] - INT16_MIN);
+	}
+}
+
+static void _int16_real_c(void *dst, const int16_t *iq_data, size_t samples)
+{
+	int16_t *i16 = dst;
+	size_t i;
+	
+	for(i = 0; i < samples; i++, iq_data += 2)
+	{
+		i16[i] = iq_data[0];
+	}
+}
+
+static void _int32_real_c(void *dst, const int16_t *iq_data, size_t samples)
+{
+	int32_t *i32 = dst;
+	size_t i;
+	
+	for(i = 0; i < samples; i++, iq_data += 2)
+	{
+		i32[i] = (iq_data[0] << 16) + iq_data[0];
+	}
+}
+
+static void _float_real_c(void *dst, const int16_t *iq_data, size_t samples)
+{
+	float *f32 = dst;
+	size_t i;
+	
+	for(i = 0; i < samples; i++, iq_data += 2)
+	{
+		f32[i] = (float) iq_data[0] * (1.0 / 32767.0);
+	}
+}
+
+static void _uint8_complex_c(void *dst, const int16_t *iq_data, size_t samples)
+{
+	uint8_t *u8 = dst;
+	size_t i;
+	
+	for(i = 0; i < samples; i++, iq_data += 2)
+	{
+		u8[i * 2 + 0] = (iq_data[0] - INT16_MIN) >> 8;
+		u8[i * 2 + 1] = (iq_data[1] - INT16_MIN) >> 8;
+	}
+}
+
+static void _int8_complex_c(void *dst, const int16_t *iq_data, size_t samples)
+{
+	int8_t *i8 = dst;
+	size_t i;
+	
+	for(i = 0; i < samples; i++, iq_data += 2)
+	{
+		i8[i * 2 + 0] = iq_data[0] >> 8;
+		i8[i * 2 + 1] = iq_data[1] >> 8;
+	}
+}
+
+static void _uint16_complex_c(void *dst, const int16_t *iq_data, size_t samples)
+{
+	uint16_t *u16 = dst;
+	size_t i;
+	
+	for(i = 0; i < samples; i++, iq_data += 2)
+	{
+		u16[i * 2 + 0] = (iq_data[0] - INT16_MIN);
+		u16[i * 2 + 1] = (iq_data[1] - INT16_MIN);
+	}
+}
+
+static void _int16_complex_c(void *dst, const int16_t *iq_data, size_t samples)
+{
+	memcpy(dst, iq_data, sizeof(int16_t) * 2 * samples);
+}
+
+static void _int32_complex_c(void *dst, const int16_t *iq_data, size_t samples)
+{
+	int32_t *i32 = dst;
+	size_t i;
+	
+	for(i = 0; i < samples; i++, iq_data += 2)
+	{
+		i32[i * 2 + 0] = (iq_data[0] << 16) + iq_data[0];
+		i32[i * 2 + 1] = (iq_data[1] << 16) + iq_data[1];
+	}
+}
+
+static void _float_complex_c(void *dst, const int16_t *iq_data, size_t samples)
+{
+	float *f32 = dst;
+	size_t i;
+	
+	for(i = 0; i < samples; i++, iq_data += 2)
+	{
+		f32[i * 2 + 0] = (float) iq_data[0] * (1.0 / 32767.0);
+		f32[i * 2 + 1] = (float) iq_data[1] * (1.0 / 32767.0);
+	}
+}
+
+static void _planar_c(uint8_t *i, uint8_t *q, const int16_t *iq_data, size_t samples)
+{
+	size_t x;
+	
+	for(x = 0; x < samples; x++, iq_data += 2)
+	{
+		i[x] = 128 + (iq_data[0] / 256);
+		q[x] = 128 + (iq_data[1] / 256);
+	}
+}
+
+static void _scale_c(int16_t *dst, const int16_t *iq_data, int scale, size_t samples)
+{
+	size_t x;
+	
+	for(x = 0; x < samples * 2; x++)
+	{
+		dst[x] = iq_data[x] * scale / INT16_MAX;
+	}
+}
+
+const iqconv_kernels_t iqconv_scalar = {
+	"scalar",
+	{
+		[RF_UINT8]  = { _uint8_real_c,  _uint8_complex_c },
+		[RF_INT8]   = { _int8_real_c,   _int8_complex_c },
+		[RF_UINT16] = { _uint16_real_c, _uint16_complex_c },
+		[RF_INT16]  = { _int16_real_c,  _int16_complex_c },
+		[RF_INT32]  = { _int32_real_c,  _int32_complex_c },
+		[RF_FLOAT]  = { _float_real_c,  _float_complex_c },
+	},
+	_planar_c,
+	_scale_c,
+};
+
+#ifdef CPU_X86
+
+/* -=== x86 SSE2 ===- */
+
+/* The I part of four samples, sign extended to 32 bits */
+__attribute__((target("sse2")))
+static inline __m128i _real_epi32(__m128i v)
+{
+	return(_mm_srai_epi32(_mm_slli_epi32(v, 16), 16));
+}
+
+/* (v << 16) + v, for 32-bit v */
+__attribute__((target("sse2")))
+static inline __m128i _dup_epi32(__m128i v)
+{
+	return(_mm_add_epi32(_mm_slli_epi32(v, 16), v));
+}
+
+__attribute__((target("sse2")))
+static void _8_real_sse2(uint8_t *dst, const int16_t *iq_data, size_t samples, int flip)
+{
+	const __m128i f = _mm_set1_epi8(flip);
+	const __m128i *s = (const __m128i *) iq_data;
+	__m128i a, b;
+	size_t x;
+	
+	for(x = 0; x + 16 <= samples; x += 16, s += 4)
+	{
+		/* The top 8 bits of I, from 16 samples */
+		a = _mm_packs_epi32(
+			_mm_srai_epi32(_mm_slli_epi32(_mm_loadu_si128(&s[0]), 16), 24),
+			_mm_srai_epi32(_mm_slli_epi32(_mm_loadu_si128(&s[1]), 16), 24)
+		);
+		b = _mm_packs_epi32(
+			_mm_srai_epi32(_mm_slli_epi32(_mm_loadu_si128(&s[2]), 16), 24),
+			_mm_srai_epi32(_mm_slli_epi32(_mm_loadu_si128(&s[3]), 16), 24)
+		);
+		
+		_mm_storeu_si128((__m128i *) &dst[x], _mm_xor_si128(_mm_packs_epi16(a, b), f));
+	}
+	
+	if(flip) _uint8_real_c(&dst[x], &iq_data[x * 2], samples - x);
+	else _int8_real_c(&dst[x], &iq_data[x * 2], samples - x);
+}
+
+__attribute__((target("sse2")))
+static void _uint8_real_sse2(void *dst, const int16_t *iq_data, size_t samples)
+{
+	_8_real_sse2(dst, iq_data, samples, 0x80);
+}
+
+__attribute__((target("sse2")))
+static void _int8_real_sse2(void *dst, const int16_t *iq_data, size_t samples)
+{
+	_8_real_sse2(dst, iq_data, samples, 0x00);
+}
+
+__attribute__((target("sse2")))
+static void _8_complex_sse2(uint8_t *dst, const int16_t *iq_data, size_t samples, int flip)
+{
+	const __m128i f = _mm_set1_epi8(flip);
+	const __m128i *s = (const __m128i *) iq_data;
+	__m128i a, b;
+	size_t x;
+	
+	for(x = 0; x + 8 <= samples; x += 8, s += 2)
+	{
+		a = _mm_srai_epi16(_mm_loadu_si128(&s[0]), 8);
+		b = _mm_srai_epi16(_mm_loadu_si128(&s[1]), 8);
+		_mm_storeu_si128((__m128i *) &dst[x * 2], _mm_xor_si128(_mm_packs_epi16(a, b), f));
+	}
+	
+	if(flip) _uint8_complex_c(&dst[x * 2], &iq_data[x * 2], samples - x);
+	else _int8_complex_c(&dst[x * 2], &iq_data[x * 2], samples - x);
+}
+
+__attribute__((target("sse2")))
+static void _uint8_complex_sse2(void *dst, const int16_t *iq_data, size_t samples)
+{
+	_8_complex_sse2(dst, iq_data, samples, 0x80);
+}
+
+__attribute__((target("sse2")))
+static void _int8_complex_sse2(void *dst, const int16_t *iq_data, size_t samples)
+{
+	_8_complex_sse2(dst, iq_data, samples, 0x00);
+}
+
+__attribute__((target("sse2")))
+static void _16_real_sse2(int16_t *dst, const int16_t *iq_data, size_t samples, int flip)
+{
+	const __m128i f = _mm_set1_epi16(flip);
+	const __m128i *s = (const __m128i *) iq_data;
+	__m128i a, b;
+	size_t x;
+	
+	for(x = 0; x + 8 <= samples; x += 8, s += 2)
+	{
+		a = _real_epi32(_mm_loadu_si128(&s[0]));
+		b = _real_epi32(_mm_loadu_si128(&s[1]));
+		_mm_storeu_si128((__m128i *) &dst[x], _mm_xor_si128(_mm_packs_epi32(a, b), f));
+	}
+	
+	if(flip) _uint16_real_c(&dst[x], &iq_data[x * 2], samples - x);
+	else _int16_real_c(&dst[x], &iq_data[x * 2], samples - x);
+}
+
+__attribute__((target("sse2")))
+static void _uint16_real_sse2(void *dst, const int16_t *iq_data, size_t samples)
+{
+	_16_real_sse2(dst, iq_data, samples, INT16_MIN);
+}
+
+__attribute__((target("sse2")))
+static void _int16_real_sse2(void *dst, const int16_t *iq_data, size_t samples)
+{
+	_16_real_sse2(dst, iq_data, samples, 0);
+}
+
+__attribute__((target("sse2")))
+static void _uint16_complex_sse2(void *dst, const int16_t *iq_data, size_t samples)
+{
+	const __m128i f = _mm_set1_epi16(INT16_MIN);
+	const __m128i *s = (const __m128i *) iq_data;
+	__m128i *d = dst;
+	size_t x;
+	
+	for(x = 0; x + 4 <= samples; x += 4, s++, d++)
+	{
+		_mm_storeu_si128(d, _mm_xor_si128(_mm_loadu_si128(s), f));
+	}
+	
+	_uint16_complex_c(d, &iq_data[x * 2], samples - x);
+}
+
+__attribute__((target("sse2")))
+static void _int32_real_sse2(void *dst, const int16_t *iq_data, size_t samples)
+{
+	const __m128i *s = (const __m128i *) iq_data;
+	__m128i *d = dst;
+	size_t x;
+	
+	for(x = 0; x + 4 <= samples; x += 4, s++, d++)
+	{
+		_mm_storeu_si128(d, _dup_epi32(_real_epi32(_mm_loadu_si128(s))));
+	}
+	
+	_int32_real_c(d, &iq_data[x * 2], samples - x);
+}
+
+__attribute__((target("sse2")))
+static void _int32_complex_sse2(void *dst, const int16_t *iq_data, size_t samples)
+{
+	const __m128i *s = (const __m128i *) iq_data;
+	__m128i *d = dst;
+	__m128i v;
+	size_t x;
+	
+	for(x = 0; x + 4 <= samples; x += 4, s++, d += 2)
+	{
+		v = _mm_loadu_si128(s);
+		_mm_storeu_si128(&d[0], _dup_epi32(_mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16)));
+		_mm_storeu_si128(&d[1], _dup_epi32(_mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16)));
+	}
+	
+	_int32_complex_c(d, &iq_data[x * 2], samples - x);
+}
+
+__attribute__((target("sse2")))
+static void _float_real_sse2(void *dst, const int16_t *iq_data, size_t samples)
+{
+	const __m128 k = _mm_set1_ps(32767.0f);
+	const __m128i *s = (const __m128i *) iq_data;
+	float *d = dst;
+	size_t x;
+	
+	for(x = 0; x + 4 <= samples; x += 4, s++)
+	{
+		_mm_storeu_ps(&d[x], _mm_div_ps(_mm_cvtepi32_ps(_real_epi32(_mm_loadu_si128(s))), k));
+	}
+	
+	_float_real_c(&d[x], &iq_data[x * 2], samples - x);
+}
+
+__attribute__((target("sse2")))
+static void _float_complex_sse2(void *dst, const int16_t *iq_data, size_t samples)
+{
+	const __m128 k = _mm_set1_ps(32767.0f);
+	const __m128i *s = (const __m128i *) iq_data;
+	float *d = dst;
+	__m128i v;
+	size_t x;
+	
+	for(x = 0; x + 4 <= samples; x += 4, s++)
+	{
+		v = _mm_loadu_si128(s);
+		_mm_storeu_ps(&d[x * 2 + 0], _mm_div_ps(_mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16)), k));
+		_mm_storeu_ps(&d[x * 2 + 4], _mm_div_ps(_mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16)), k));
+	}
+	
+	_float_complex_c(&d[x * 2], &iq_data[x * 2], samples - x);
+}
+
+__attribute__((target("sse2")))
+static void _planar_sse2(uint8_t *i, uint8_t *q, const int16_t *iq_data, size_t samples)
+{
+	const __m128i f = _mm_set1_epi8(0x80);
+	const __m128i *s = (const __m128i *) iq_data;
+	__m128i v[4], a, b;
+	size_t x;
+	int k;
+	
+	for(x = 0; x + 16 <= samples; x += 16, s += 4)
+	{
+		/* v / 256, rounding towards zero */
+		for(k = 0; k < 4; k++)
+		{
+			v[k] = _mm_loadu_si128(&s[k]);
+			v[k] = _mm_add_epi16(v[k], _mm_srli_epi16(_mm_srai_epi16(v[k], 15), 8));
+			v[k] = _mm_srai_epi16(v[k], 8);
+		}
+		
+		a = _mm_packs_epi32(_real_epi32(v[0]), _real_epi32(v[1]));
+		b = _mm_packs_epi32(_real_epi32(v[2]), _real_epi32(v[3]));
+		_mm_storeu_si128((__m128i *) &i[x], _mm_xor_si128(_mm_packs_epi16(a, b), f));
+		
+		a = _mm_packs_epi32(_mm_srai_epi32(v[0], 16), _mm_srai_epi32(v[1], 16));
+		b = _mm_packs_epi32(_mm_srai_epi32(v[2], 16), _mm_srai_epi32(v[3], 16));
+		_mm_storeu_si128((__m128i *) &q[x], _mm_xor_si128(_mm_packs_epi16(a, b), f));
+	}
+	
+	_planar_c(&i[x], &q[x], &iq_data[x * 2], samples - x);
+}
+
+/* x / 32767 for 32-bit x, rounding towards zero */
+__attribute__((target("sse2")))
+static inline __m128i _div32767_epi32(__m128i x)
+{
+	const __m128i one = _mm_set1_epi32(1);
+	__m128i s, y;
+	
+	s = _mm_srai_epi32(x, 31);
+	y = _mm_add_epi32(_mm_sub_epi32(_mm_xor_si128(x, s), s), one);
+	y = _mm_srai_epi32(_mm_add_epi32(y, _mm_srai_epi32(y, 15)), 15);
+	
+	return(_mm_sub_epi32(_mm_xor_si128(y, s), s));
+}
+
+__attribute__((target("sse2")))
+static void _scale_sse2(int16_t *dst, const int16_t *iq_data, int scale, size_t samples)
+{
+	const __m128i k = _mm_set1_epi32(scale);
+	const __m128i zero = _mm_setzero_si128();
+	__m128i v, a, b;
+	size_t x;
+	
+	for(x = 0; x + 4 <= samples; x += 4)
+	{
+		/* The high half of each pair is zero, so pmaddwd is a plain multiply */
+		v = _mm_loadu_si128((const __m128i *) &iq_data[x * 2]);
+		a = _div32767_epi32(_mm_madd_epi16(_mm_unpacklo_epi16(v, zero), k));
+		b = _div32767_epi32(_mm_madd_epi16(_mm_unpackhi_epi16(v, zero), k));
+		_mm_storeu_si128((__m128i *) &dst[x * 2], _mm_packs_epi32(a, b));
+	}
+	
+	_scale_c(&dst[x * 2], &iq_data[x * 2], scale, samples - x);
+}
+
+static const iqconv_kernels_t _iqconv_sse2 = {
+	"sse2",
+	{
+		[RF_UINT8]  = { _uint8_real_sse2,  _uint8_complex_sse2 },
+		[RF_INT8]   = { _int8_real_sse2,   _int8_complex_sse2 },
+		[RF_UINT16] = { _uint16_real_sse2, _uint16_complex_sse2 },
+		[RF_INT16]  = { _int16_real_sse2,  _int16_complex_c },
+		[RF_INT32]  = { _int32_real_sse2,  _int32_complex_sse2 },
+		[RF_FLOAT]  = { _float_real_sse2,  _float_complex_sse2 },
+	},
+	_planar_sse2,
+	_scale_sse2,
+};
+
+/* -=== x86 AVX2 ===- */
+
+/* Only the widening conversions have AVX2 versions */
+
+__attribute__((target("avx2")))
+static void _int32_real_avx2(void *dst, const int16_t *iq_data, size_t samples)
+{
+	const __m256i *s = (const __m256i *) iq_data;
+	__m256i *d = dst;
+	__m256i v;
+	size_t x;
+	
+	for(x = 0; x + 8 <= samples; x += 8, s++, d++)
+	{
+		v = _mm256_loadu_si256(s);
+		v = _mm256_srai_epi32(_mm256_slli_epi32(v, 16), 16);
+		_mm256_storeu_si256(d, _mm256_add_epi32(_mm256_slli_epi32(v, 16), v));
+	}
+	
+	_int32_real_c(d, &iq_data[x * 2], samples - x);
+}
+
+__attribute__((target("avx2")))
+static void _int32_complex_avx2(void *dst, const int16_t *iq_data, size_t samples)
+{
+	const __m128i *s = (const __m128i *) iq_data;
+	__m256i *d = dst;
+	__m256i v;
+	size_t x;
+	
+	for(x = 0; x + 4 <= samples; x += 4, s++, d++)
+	{
+		v = _mm256_cvtepi16_epi32(_mm_loadu_si128(s));
+		_mm256_storeu_si256(d, _mm256_add_epi32(_mm256_slli_epi32(v, 16), v));
+	}
+	
+	_int32_complex_c(d, &iq_data[x * 2], samples - x);
+}
+
+__attribute__((target("avx2")))
+static void _float_real_avx2(void *dst, const int16_t *iq_data, size_t samples)
+{
+	const __m256 k = _mm256_set1_ps(32767.0f);
+	const __m256i *s = (const __m256i *) iq_data;
+	float *d = dst;
+	__m256i v;
+	size_t x;
+	
+	for(x = 0; x + 8 <= samples; x += 8, s++)
+	{
+		v = _mm256_loadu_si256(s);
+		v = _mm256_srai_epi32(_mm256_slli_epi32(v, 16), 16);
+		_mm256_storeu_ps(&d[x], _mm256_div_ps(_mm256_cvtepi32_ps(v), k));
+	}
+	
+	_float_real_c(&d[x], &iq_data[x * 2], samples - x);
+}
+
+__attribute__((target("avx2")))
+static void _float_complex_avx2(void *dst, const int16_t *iq_data, size_t samples)
+{
+	const __m256 k = _mm256_set1_ps(32767.0f);
+	const __m128i *s = (const __m128i *) iq_data;
+	float *d = dst;
+	__m256i v;
+	size_t x;
+	
+	for(x = 0; x + 4 <= samples; x += 4, s++)
+	{
+		v = _mm256_cvtepi16_epi32(_mm_loadu_si128(s));
+		_mm256_storeu_ps(&d[x * 2], _mm256_div_ps(_mm256_cvtepi32_ps(v), k));
+	}
+	
+	_float_complex_c(&d[x * 2], &iq_data[x * 2], samples - x);
+}
+
+static const iqconv_kernels_t _iqconv_avx2 = {
+	"avx2",
+	{
+		[RF_UINT8]  = { _uint8_real_sse2,  _uint8_complex_sse2 },
+		[RF_INT8]   = { _int8_real_sse2,   _int8_complex_sse2 },
+		[RF_UINT16] = { _uint16_real_sse2, _uint16_complex_sse2 },
+		[RF_INT16]  = { _int16_real_sse2,  _int16_complex_c },
+		[RF_INT32]  = { _int32_real_avx2,  _int32_complex_avx2 },
+		[RF_FLOAT]  = { _float_real_avx2,  _float_complex_avx2 },
+	},
+	_planar_sse2,
+	_scale_sse2,
+};
+
+#endif
+
+const iqconv_kernels_t *iqconv_kernels(int features)
+{
+#ifdef CPU_X86
+	if(features & CPU_AVX2) return(&_iqconv_avx2);
+	if(features & CPU_SSE2) return(&_iqconv_sse2);
+#endif
+	
+	return(&iqconv_scalar);
+}
+
@@ -0,0 +1,49 @@
+/* hacktv - Analogue video transmitter for the HackRF                    */
+/*=======================================================================*/
+/* Copyright 2023 Philip Heron <phil@sanslogic.co.uk>                    */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* (at your option) any later version.                                   */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+#ifndef _IQCONV_H
+#define _IQCONV_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* Converts samples from int16 complex to one of the RF_* file types.
+ * The real versions only keep the I part */
+typedef void (*iqconv_t)(void *dst, const int16_t *iq_data, size_t samples);
+
+/* Converts samples to two planes of unsigned 8-bit values, 128 + v / 256 */
+typedef void (*iqconv_planar_t)(uint8_t *i, uint8_t *q, const int16_t *iq_data, size_t samples);
+
+/* Scales samples by scale / INT16_MAX, rounding towards zero.
+ * scale must be between 0 and INT16_MAX */
+typedef void (*iqconv_scale_t)(int16_t *dst, const int16_t *iq_data, int scale, size_t samples);
+
+typedef struct {
+	const char *name;
+	iqconv_t conv[6][2];	/* [RF_* type][complex] */
+	iqconv_planar_t planar;
+	iqconv_scale_t scale;
+} iqconv_kernels_t;
+
+/* The plain C version, used as the reference */
+extern const iqconv_kernels_t iqconv_scalar;
+
+/* Returns the fastest kernels for the CPU features given */
+extern const iqconv_kernels_t *iqconv_kernels(int features);
+
+#endif
+
@@ -0,0 +1,195 @@
+/* hacktv - Analogue video transmitter for the HackRF                    */
+/*=======================================================================*/
+/* Copyright 2023 Philip Heron <phil@sanslogic.co.uk>                    */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* (at your option) any later version.                                   */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+/* Checks that every sample conversion kernel this CPU can run gives
+ * exactly the same bytes as the scalar reference. Run with "make check".
+ * 
+ * Every conv[type][complex] entry, the planar split and the scaler
+ * are tried with every length from 0 to _MAX_SAMPLES, at different
+ * offsets from the vector alignment. The input is random, with a share
+ * of -32768 and 32767 values, and the first round uses only those. The
+ * whole output buffer is compared, to catch writes past the end.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "cpu.h"
+#include "rf.h"
+#include "iqconv.h"
+
+#define _MAX_SAMPLES 67
+#define _OFFSETS 16
+#define _ROUNDS 4
+
+/* Room for the longest run at the largest offset */
+#define _LEN (_MAX_SAMPLES + _OFFSETS)
+
+/* Features that can select a different backend */
+static const int _features[] = {
+	CPU_SSE2, CPU_SSSE3, CPU_AVX2, CPU_AVX512BW, 0
+};
+
+static const char *_types[] = {
+	[RF_UINT8]  = "uint8",
+	[RF_INT8]   = "int8",
+	[RF_UINT16] = "uint16",
+	[RF_INT16]  = "int16",
+	[RF_INT32]  = "int32",
+	[RF_FLOAT]  = "float",
+};
+
+static const int _sizes[] = {
+	[RF_UINT8]  = sizeof(uint8_t),
+	[RF_INT8]   = sizeof(int8_t),
+	[RF_UINT16] = sizeof(uint16_t),
+	[RF_INT16]  = sizeof(int16_t),
+	[RF_INT32]  = sizeof(int32_t),
+	[RF_FLOAT]  = sizeof(float),
+};
+
+/* Scales to try, from nothing to full level */
+static const int _scales[] = { 0, 1, 256, 12345, 32766, INT16_MAX };
+
+static uint32_t _seed = 1;
+
+static int16_t _random(int round)
+{
+	uint32_t r;
+	
+	/* A simple LCG, the same sequence on every platform */
+	_seed = _seed * 1103515245 + 12345;
+	r = _seed >> 8;
+	
+	/* The first round uses only the extremes,
+	 * the others one in eight of them */
+	switch(r & (round == 0 ? 1 : 15))
+	{
+	case 0: return(INT16_MIN);
+	case 1: return(INT16_MAX);
+	}
+	
+	return(r >> 8);
+}
+
+static int _check(const iqconv_kernels_t *k, int round)
+{
+	static int16_t iq[_LEN * 2];
+	static uint8_t ref[_LEN * 2 * sizeof(int32_t)];
+	static uint8_t out[_LEN * 2 * sizeof(int32_t)];
+	int n, o, t, c, s, size;
+	int errors = 0;
+	
+	for(n = 0; n < _LEN * 2; n++)
+	{
+		iq[n] = _random(round);
+	}
+	
+	for(n = 0; n <= _MAX_SAMPLES; n++)
+	{
+		for(o = 0; o < _OFFSETS; o++)
+		{
+			for(t = 0; t < 6; t++)
+			{
+				for(c = 0; c < 2; c++)
+				{
+					/* The output moves with the input */
+					size = _sizes[t] * (c ? 2 : 1);
+					
+					memset(ref, 0xA5, sizeof(ref));
+					memset(out, 0xA5, sizeof(out));
+					iqconv_scalar.conv[t][c](&ref[o * size], &iq[o * 2], n);
+					k->conv[t][c](&out[o * size], &iq[o * 2], n);
+					
+					if(memcmp(ref, out, sizeof(ref)) != 0)
+					{
+						fprintf(stderr, "%s %s %s: n = %d, offset %d\n", k->name, _types[t], c ? "complex" : "real", n, o);
+						errors++;
+					}
+				}
+			}
+			
+			/* The I and Q planes share the buffer */
+			memset(ref, 0xA5, sizeof(ref));
+			memset(out, 0xA5, sizeof(out));
+			iqconv_scalar.planar(&ref[o], &ref[_LEN + o], &iq[o * 2], n);
+			k->planar(&out[o], &out[_LEN + o], &iq[o * 2], n);
+			
+			if(memcmp(ref, out, sizeof(ref)) != 0)
+			{
+				fprintf(stderr, "%s planar: n = %d, offset %d\n", k->name, n, o);
+				errors++;
+			}
+			
+			for(s = 0; s < sizeof(_scales) / sizeof(int); s++)
+			{
+				memset(ref, 0xA5, sizeof(ref));
+				memset(out, 0xA5, sizeof(out));
+				iqconv_scalar.scale((int16_t *) ref + o * 2, &iq[o * 2], _scales[s], n);
+				k->scale((int16_t *) out + o * 2, &iq[o * 2], _scales[s], n);
+				
+				if(memcmp(ref, out, sizeof(ref)) != 0)
+				{
+					fprintf(stderr, "%s scale %d: n = %d, offset %d\n", k->name, _scales[s], n, o);
+					errors++;
+				}
+			}
+		}
+	}
+	
+	return(errors);
+}
+
+int main(int argc, char *argv[])
+{
+	const iqconv_kernels_t *tested[sizeof(_features) / sizeof(int)];
+	const iqconv_kernels_t *k;
+	int i, j, r, ntested = 0;
+	int errors, failed = 0;
+	
+	for(i = 0; _features[i]; i++)
+	{
+		if((cpu_features() & _features[i]) == 0) continue;
+		
+		k = iqconv_kernels(_features[i]);
+		if(k == &iqconv_scalar) continue;
+		
+		/* Some features share a backend */
+		for(j = 0; j < ntested && tested[j] != k; j++);
+		if(j < ntested) continue;
+		
+		tested[ntested++] = k;
+		
+		for(errors = r = 0; r < _ROUNDS; r++)
+		{
+			errors += _check(k, r);
+		}
+		
+		printf("iqconv %s: %s\n", k->name, errors ? "FAILED" : "OK");
+		
+		if(errors) failed = 1;
+	}
+	
+	if(ntested == 0)
+	{
+		printf("No SIMD conversion kernels for this CPU\n");
+	}
+	
+	return(failed);
+}
+
@@ -0,0 +1,299 @@
+/* hacktv - Analogue video transmitter for the HackRF                    */
+/*=======================================================================*/
+/* Copyright 2023 Philip Heron <phil@sanslogic.co.uk>                    */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* (at your option) any later version.                                   */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+/* Compressed IQ files
+ * 
+ * The samples are split into independently compressed chunks:
+ * 
+ * Header   "HIQZ", version, type, complex, filter, chunk size, 0
+ * Chunk    compressed length, raw length, zlib data
+ * ...
+ * End      0, 0
+ * 
+ * All fields are little endian, 32 bits. The raw length of each chunk
+ * is a whole number of samples. The file can only be read from the
+ * start, there is no index.
+ * Before compression the bytes of each sample component are grouped,
+ * all the low bytes and then all the high bytes. The high bytes vary
+ * slowly and compress much better on their own.
+*/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+#include "rf.h"
+#include "iqz.h"
+
+#define _VERSION 1
+#define _FILTER_SHUFFLE 1
+
+/* Maximum accepted chunk size */
+#define _MAX_CHUNK (1 << 30)
+
+static const int _sizes[] = {
+	[RF_UINT8]  = sizeof(uint8_t),
+	[RF_INT8]   = sizeof(int8_t),
+	[RF_UINT16] = sizeof(uint16_t),
+	[RF_INT16]  = sizeof(int16_t),
+	[RF_INT32]  = sizeof(int32_t),
+	[RF_FLOAT]  = sizeof(float),
+};
+
+static void _put32(uint8_t *p, uint32_t v)
+{
+	p[0] = v >> 0;
+	p[1] = v >> 8;
+	p[2] = v >> 16;
+	p[3] = v >> 24;
+}
+
+static uint32_t _get32(const uint8_t *p)
+{
+	return(p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24));
+}
+
+static void _shuffle(uint8_t *dst, const uint8_t *src, size_t len, int size)
+{
+	size_t n = len / size;
+	size_t i;
+	int b;
+	
+	for(b = 0; b < size; b++)
+	{
+		for(i = 0; i < n; i++)
+		{
+			dst[b * n + i] = src[i * size + b];
+		}
+	}
+}
+
+static void _unshuffle(uint8_t *dst, const uint8_t *src, size_t len, int size)
+{
+	size_t n = len / size;
+	size_t i;
+	int b;
+	
+	for(b = 0; b < size; b++)
+	{
+		for(i = 0; i < n; i++)
+		{
+			dst[i * size + b] = src[b * n + i];
+		}
+	}
+}
+
+void iqz_header(uint8_t *h, int type, int complex, size_t chunk_size)
+{
+	memcpy(h, "HIQZ", 4);
+	h[4] = _VERSION;
+	h[5] = type;
+	h[6] = complex;
+	h[7] = _FILTER_SHUFFLE;
+	_put32(&h[8], chunk_size);
+	_put32(&h[12], 0);
+}
+
+size_t iqz_bound(size_t len)
+{
+	return(IQZ_CHUNK_HEADER_LEN + compressBound(len));
+}
+
+int iqz_compress(uint8_t *dst, size_t *dst_len, const uint8_t *src, size_t len, uint8_t *tmp, int type, int level)
+{
+	uLongf zlen;
+	
+	if(len % _sizes[type] != 0)
+	{
+		return(-1);
+	}
+	
+	if(_sizes[type] > 1)
+	{
+		_shuffle(tmp, src, len, _sizes[type]);
+		src = tmp;
+	}
+	
+	zlen = compressBound(len);
+	
+	if(compress2(&dst[IQZ_CHUNK_HEADER_LEN], &zlen, src, len, level) != Z_OK)
+	{
+		return(-1);
+	}
+	
+	_put32(&dst[0], zlen);
+	_put32(&dst[4], len);
+	*dst_len = IQZ_CHUNK_HEADER_LEN + zlen;
+	
+	return(0);
+}
+
+void iqz_end(uint8_t *h)
+{
+	/* An empty chunk */
+	memset(h, 0, IQZ_CHUNK_HEADER_LEN);
+}
+
+int iqz_reader_open(iqz_reader_t *r, FILE *f)
+{
+	uint8_t h[IQZ_HEADER_LEN];
+	
+	memset(r, 0, sizeof(iqz_reader_t));
+	r->f = f;
+	
+	r->head_len = fread(h, 1, IQZ_HEADER_LEN, f);
+	
+	if(r->head_len != IQZ_HEADER_LEN || memcmp(h, "HIQZ", 4) != 0)
+	{
+		/* Keep the bytes already read, f may be a pipe */
+		memcpy(r->head, h, r->head_len);
+		return(1);
+	}
+	
+	r->compressed = 1;
+	r->head_len = 0;
+	
+	r->type = h[5];
+	r->complex = h[6];
+	r->chunk_size = _get32(&h[8]);
+	
+	if(h[4] != _VERSION || h[7] != _FILTER_SHUFFLE || r->type > RF_FLOAT ||
+	   r->chunk_size == 0 || r->chunk_size > _MAX_CHUNK)
+	{
+		fprintf(stderr, "Unsupported compressed IQ file.\n");
+		return(-1);
+	}
+	
+	r->zdata = malloc(compressBound(r->chunk_size));
+	r->tmp = malloc(r->chunk_size);
+	r->raw = malloc(r->chunk_size);
+	
+	if(!r->zdata || !r->tmp || !r->raw)
+	{
+		perror("malloc");
+		iqz_reader_close(r);
+		return(-1);
+	}
+	
+	return(0);
+}
+
+static int _next_chunk(iqz_reader_t *r)
+{
+	uint8_t h[IQZ_CHUNK_HEADER_LEN];
+	uLongf len;
+	uint32_t zlen, hlen;
+	
+	r->raw_len = 0;
+	r->raw_pos = 0;
+	
+	if(fread(h, 1, IQZ_CHUNK_HEADER_LEN, r->f) != IQZ_CHUNK_HEADER_LEN)
+	{
+		return(-1);
+	}
+	
+	zlen = _get32(&h[0]);
+	len = hlen = _get32(&h[4]);
+	
+	/* The end marker */
+	if(zlen == 0)
+	{
+		return(-1);
+	}
+	
+	if(zlen > compressBound(r->chunk_size) || len > r->chunk_size ||
+	   fread(r->zdata, 1, zlen, r->f) != zlen)
+	{
+		fprintf(stderr, "Truncated or corrupt compressed IQ file.\n");
+		return(-1);
+	}
+	
+	/* A partial sample can't be unshuffled */
+	if(uncompress(r->tmp, &len, r->zdata, zlen) != Z_OK ||
+	   len != hlen || len % _sizes[r->type] != 0)
+	{
+		fprintf(stderr, "Corrupt chunk in compressed IQ file.\n");
+		return(-1);
+	}
+	
+	if(_sizes[r->type] > 1)
+	{
+		_unshuffle(r->raw, r->tmp, len, _sizes[r->type]);
+	}
+	else
+	{
+		memcpy(r->raw, r->tmp, len);
+	}
+	
+	r->raw_len = len;
+	
+	return(0);
+}
+
+size_t iqz_read(iqz_reader_t *r, void *dst, size_t len)
+{
+	uint8_t *d = dst;
+	size_t n, total = 0;
+	
+	if(!r->compressed)
+	{
+		/* Return the bytes read by iqz_reader_open() first */
+		n = r->head_len - r->head_pos;
+		if(n > len) n = len;
+		
+		memcpy(d, &r->head[r->head_pos], n);
+		r->head_pos += n;
+		
+		total = n + fread(d + n, 1, len - n, r->f);
+		if(total < len) r->eof = 1;
+		
+		return(total);
+	}
+	
+	while(len > 0 && !r->eof)
+	{
+		if(r->raw_pos == r->raw_len && _next_chunk(r) != 0)
+		{
+			r->eof = 1;
+			break;
+		}
+		
+		n = r->raw_len - r->raw_pos;
+		if(n > len) n = len;
+		
+		memcpy(d, &r->raw[r->raw_pos], n);
+		
+		r->raw_pos += n;
+		d += n;
+		len -= n;
+		total += n;
+	}
+	
+	return(total);
+}
+
+void iqz_reader_close(iqz_reader_t *r)
+{
+	free(r->zdata);
+	free(r->tmp);
+	free(r->raw);
+	r->zdata = NULL;
+	r->tmp = NULL;
+	r->raw = NULL;
+}
+
@@ -0,0 +1,63 @@
+/* hacktv - Analogue video transmitter for the HackRF                    */
+/*=======================================================================*/
+/* Copyright 2023 Philip Heron <phil@sanslogic.co.uk>                    */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* (at your option) any later version.                                   */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+#ifndef _IQZ_H
+#define _IQZ_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#define IQZ_HEADER_LEN       16
+#define IQZ_CHUNK_HEADER_LEN 8
+
+typedef struct {
+	FILE *f;
+	int compressed;
+	int type;
+	int complex;
+	size_t chunk_size;
+	
+	uint8_t *zdata;
+	uint8_t *tmp;
+	uint8_t *raw;
+	size_t raw_len;
+	size_t raw_pos;
+	int eof;
+	
+	/* The bytes read to look for the header of an uncompressed file,
+	 * which can't be put back on a pipe */
+	uint8_t head[IQZ_HEADER_LEN];
+	size_t head_len;
+	size_t head_pos;
+	
+} iqz_reader_t;
+
+/* Writer */
+extern void iqz_header(uint8_t *h, int type, int complex, size_t chunk_size);
+extern size_t iqz_bound(size_t len);
+extern int iqz_compress(uint8_t *dst, size_t *dst_len, const uint8_t *src, size_t len, uint8_t *tmp, int type, int level);
+extern void iqz_end(uint8_t *h);
+
+/* Reader. Returns 1 if f is not a compressed file, iqz_read() then
+ * returns its contents unchanged. f doesn't need to be seekable */
+extern int iqz_reader_open(iqz_reader_t *r, FILE *f);
+extern size_t iqz_read(iqz_reader_t *r, void *dst, size_t len);
+extern void iqz_reader_close(iqz_reader_t *r);
+
+#endif
+
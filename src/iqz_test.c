@@ -0,0 +1,198 @@
+/* hacktv - Analogue video transmitter for the HackRF                    */
+/*=======================================================================*/
+/* Copyright 2023 Philip Heron <phil@sanslogic.co.uk>                    */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* (at your option) any later version.                                   */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+/* Checks the compressed IQ file reader. Run with "make check".
+ * 
+ * Plain and compressed int16 I/Q data are read back through a regular
+ * file and through a pipe, which can't be rewound after the header is
+ * looked for. Both must return exactly the bytes that were written.
+ * 
+ * A chunk holding a partial sample is corrupt, reading stops before it.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include "rf.h"
+#include "iqz.h"
+
+/* Small enough to fit in a pipe without a reader */
+#define _SAMPLES 3000
+#define _CHUNK 4096
+
+static uint8_t _data[_SAMPLES * 4];
+
+/* Returns a stream holding the len bytes of buf */
+static FILE *_stream(const uint8_t *buf, size_t len, int pipe_input)
+{
+	FILE *f;
+	int fd[2];
+	
+	if(!pipe_input)
+	{
+		f = tmpfile();
+		if(!f) return(NULL);
+		
+		fwrite(buf, 1, len, f);
+		rewind(f);
+		
+		return(f);
+	}
+	
+	if(pipe(fd) != 0) return(NULL);
+	
+	if(write(fd[1], buf, len) != (ssize_t) len)
+	{
+		close(fd[0]);
+		close(fd[1]);
+		return(NULL);
+	}
+	
+	close(fd[1]);
+	
+	return(fdopen(fd[0], "rb"));
+}
+
+/* Writes the test data as a compressed file into buf, returns its length.
+ * Chunks are compressed as chunk_type, to write invalid lengths */
+static size_t _compress(uint8_t *buf, size_t chunk, int chunk_type)
+{
+	static uint8_t tmp[_CHUNK];
+	size_t len, zlen, x;
+	
+	iqz_header(buf, RF_INT16, 1, chunk);
+	len = IQZ_HEADER_LEN;
+	
+	for(x = 0; x < sizeof(_data); x += chunk)
+	{
+		if(chunk > sizeof(_data) - x) chunk = sizeof(_data) - x;
+		
+		if(iqz_compress(&buf[len], &zlen, &_data[x], chunk, tmp, chunk_type, 6) != 0)
+		{
+			return(0);
+		}
+		
+		len += zlen;
+	}
+	
+	iqz_end(&buf[len]);
+	
+	return(len + IQZ_CHUNK_HEADER_LEN);
+}
+
+/* Reads back the stream in odd sized pieces, returns the number
+ * of bytes that matched the test data or -1 on a mismatch */
+static int _read(const char *name, const uint8_t *buf, size_t len, int pipe_input, int compressed)
+{
+	static uint8_t out[sizeof(_data) + 1];
+	iqz_reader_t r;
+	size_t n, total;
+	FILE *f;
+	int i;
+	
+	f = _stream(buf, len, pipe_input);
+	if(!f)
+	{
+		perror(name);
+		return(-1);
+	}
+	
+	i = iqz_reader_open(&r, f);
+	
+	if(i != (compressed ? 0 : 1))
+	{
+		fprintf(stderr, "%s: iqz_reader_open() returned %d\n", name, i);
+		iqz_reader_close(&r);
+		fclose(f);
+		return(-1);
+	}
+	
+	for(total = 0; total < sizeof(out); total += n)
+	{
+		n = sizeof(out) - total;
+		if(n > 997) n = 997;
+		
+		n = iqz_read(&r, &out[total], n);
+		if(n == 0) break;
+	}
+	
+	iqz_reader_close(&r);
+	fclose(f);
+	
+	if(memcmp(out, _data, total < sizeof(_data) ? total : sizeof(_data)) != 0)
+	{
+		fprintf(stderr, "%s: The data read back differs\n", name);
+		return(-1);
+	}
+	
+	return(total);
+}
+
+static int _check(const char *name, int r, int expected)
+{
+	if(r != expected)
+	{
+		printf("%s: FAILED\n", name);
+		return(1);
+	}
+	
+	printf("%s: OK\n", name);
+	
+	return(0);
+}
+
+int main(int argc, char *argv[])
+{
+	static uint8_t z[sizeof(_data) * 2];
+	size_t zlen;
+	uint32_t seed = 1;
+	int i, p, failed = 0;
+	
+	/* Start with bytes that look a little like a header */
+	for(i = 0; i < sizeof(_data); i++)
+	{
+		seed = seed * 1103515245 + 12345;
+		_data[i] = i < 3 ? "HIQ"[i] : seed >> 16;
+	}
+	
+	for(p = 0; p < 2; p++)
+	{
+		const char *t = p ? "pipe" : "file";
+		char name[64];
+		
+		snprintf(name, sizeof(name), "plain %s", t);
+		failed |= _check(name, _read(name, _data, sizeof(_data), p, 0), sizeof(_data));
+		
+		/* Shorter than the header */
+		snprintf(name, sizeof(name), "short %s", t);
+		failed |= _check(name, _read(name, _data, 10, p, 0), 10);
+		
+		snprintf(name, sizeof(name), "compressed %s", t);
+		zlen = _compress(z, _CHUNK, RF_INT16);
+		failed |= _check(name, _read(name, z, zlen, p, 1), sizeof(_data));
+		
+		/* An odd number of bytes in the first chunk */
+		snprintf(name, sizeof(name), "odd chunk %s", t);
+		zlen = _compress(z, 1001, RF_UINT8);
+		failed |= _check(name, _read(name, z, zlen, p, 1), 0);
+	}
+	
+	return(failed);
+}
+
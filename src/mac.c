@@ -1820,6 +1820,7 @@ int mac_next_line(vid_t *s, void *arg, int nlines, vid_line_t **lines)
 	uint8_t data[MAC_LINE_BYTES];
 	vid_line_t *l = lines[1];
 	int x, y, vy;
+	int c, n;
 	
 	l->width    = s->width;
 	l->frame    = s->bframe;
@@ -1832,6 +1833,8 @@ int mac_next_line(vid_t *s, void *arg, int nlines, vid_line_t **lines)
 		lines[2]->output[x * 2] = s->blanking_level;
 	}
 	
+	lines[2]->width = s->width;
+	
 	if(l->line == 1 && s->mac.eurocrypt)
 	{
 		eurocrypt_next_frame(s, l->frame);
@@ -2005,17 +2008,19 @@ int mac_next_line(vid_t *s, void *arg, int nlines, vid_line_t **lines)
 		
 		for(x = s->active_left; x < s->active_left + s->vframe_x; x++)
 		{
-			l->output[x * 2] = s->yiq_level_lookup[0x000000].y;
+			l->output[x * 2] = s->yiq_black.y;
 		}
 		
-		for(; x < s->active_left + s->vframe_x + s->vframe.width; x++, px += stride)
+		vid_rgb_to_yiq_line(s, s->yiq_line, px, stride, s->vframe.width);
+		
+		for(c = 0; c < s->vframe.width; x++, c++)
 		{
-			l->output[x * 2] = s->yiq_level_lookup[*px & 0xFFFFFF].y;
+			l->output[x * 2] = s->yiq_line[c].y;
 		}
 		
 		for(; x < s->active_left + s->active_width; x++)
 		{
-			l->output[x * 2] = s->yiq_level_lookup[0x000000].y;
+			l->output[x * 2] = s->yiq_black.y;
 		}
 	}
 	
@@ -2034,9 +2039,14 @@ int mac_next_line(vid_t *s, void *arg, int nlines, vid_line_t **lines)
 			stride = s->vframe.pixel_stride * 2;
 		}
 		
-		for(x = s->mac.chrominance_left + s->vframe_x / 2; x < s->mac.chrominance_left + (s->vframe_x + s->vframe.width) / 2; x++, px += stride)
+		x = s->mac.chrominance_left + s->vframe_x / 2;
+		n = s->mac.chrominance_left + (s->vframe_x + s->vframe.width) / 2 - x;
+		
+		vid_rgb_to_yiq_line(s, s->yiq_line, px, stride, n);
+		
+		for(c = 0; c < n; x++, c++)
 		{
-			l->output[x * 2] += (l->line & 1 ? s->yiq_level_lookup[*px & 0xFFFFFF].i : s->yiq_level_lookup[*px & 0xFFFFFF].q);
+			l->output[x * 2] += (l->line & 1 ? s->yiq_line[c].i : s->yiq_line[c].q);
 		}
 	}
 	
@@ -0,0 +1,388 @@
+/* hacktv - Analogue video transmitter for the HackRF                    */
+/*=======================================================================*/
+/* Copyright 2023 Philip Heron <phil@sanslogic.co.uk>                    */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* (at your option) any later version.                                   */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+#include <stdint.h>
+#include <math.h>
+#include "cpu.h"
+#include "nco.h"
+
+#ifdef CPU_X86
+#include <immintrin.h>
+#endif
+
+/* The phase is rounded to 15 bits per quadrant, 17 bits per turn.
+ * 
+ * Within the quadrant sin(pi / 2 * t) is approximated by an odd
+ * polynomial in t, evaluated with Q15 rounding multiplies. These are
+ * single pmulhrsw instructions on x86, so every version gives exactly
+ * the same result. The error is at most 2 LSB, 0.4 LSB RMS. The cos is
+ * the same polynomial at 1 - t, and the quadrant then sets the signs:
+ * 
+ * 0: ( cos,  sin)
+ * 1: (-sin,  cos)
+ * 2: (-cos, -sin)
+ * 3: ( sin, -cos)
+ * 
+ * sin(pi / 2 * t) = t + t * (_C1 + u * (_C3 + u * (_C5 + u * _C7)))
+ * where u = t * t, and _C1 is the first coefficient less one so it
+ * fits in 16 bits.
+*/
+#define _C1 18702
+#define _C3 -21163
+#define _C5 2601
+#define _C7 -141
+
+/* -=== Scalar reference ===- */
+
+static inline int16_t _mulhrs(int16_t a, int16_t b)
+{
+	return((a * b + 0x4000) >> 15);
+}
+
+static inline int16_t _adds(int16_t a, int16_t b)
+{
+	int32_t r = a + b;
+	return(r > INT16_MAX ? INT16_MAX : (r < INT16_MIN ? INT16_MIN : r));
+}
+
+static inline int16_t _sin_c(int16_t t)
+{
+	int16_t u, a;
+	
+	u = _mulhrs(t, t);
+	a = _C7;
+	a = _C5 + _mulhrs(a, u);
+	a = _C3 + _mulhrs(a, u);
+	a = _C1 + _mulhrs(a, u);
+	
+	return(_adds(t, _mulhrs(t, a)));
+}
+
+static void _cexp_c(cint16_t *out, const uint32_t *phase, int n)
+{
+	int16_t t, s, c;
+	uint32_t p, q;
+	int x;
+	
+	for(x = 0; x < n; x++)
+	{
+		p = phase[x] + (1 << 14);
+		q = p >> 30;
+		t = (p >> 15) & 0x7FFF;
+		
+		s = _sin_c(t);
+		c = _sin_c(_adds(0x7FFF - t, 1));
+		
+		switch(q)
+		{
+		case 0: out[x].i =  c; out[x].q =  s; break;
+		case 1: out[x].i = -s; out[x].q =  c; break;
+		case 2: out[x].i = -c; out[x].q = -s; break;
+		default: out[x].i =  s; out[x].q = -c; break;
+		}
+	}
+}
+
+static void _mix_c(cint16_t *out, const cint16_t *in, const cint16_t *lo, int swap, int n)
+{
+	cint16_t t;
+	int x;
+	
+	for(x = 0; x < n; x++)
+	{
+		t.i = swap ? in[x].q : in[x].i;
+		t.q = swap ? in[x].i : in[x].q;
+		
+		cint16_mul(&out[x], &t, &lo[x]);
+	}
+}
+
+const nco_kernels_t nco_scalar = {
+	"scalar", _cexp_c, _mix_c
+};
+
+#ifdef CPU_X86
+
+/* -=== x86 SSSE3 ===- */
+
+__attribute__((target("ssse3")))
+static inline __m128i _sin_ssse3(__m128i t)
+{
+	__m128i u, a;
+	
+	u = _mm_mulhrs_epi16(t, t);
+	a = _mm_set1_epi16(_C7);
+	a = _mm_add_epi16(_mm_set1_epi16(_C5), _mm_mulhrs_epi16(a, u));
+	a = _mm_add_epi16(_mm_set1_epi16(_C3), _mm_mulhrs_epi16(a, u));
+	a = _mm_add_epi16(_mm_set1_epi16(_C1), _mm_mulhrs_epi16(a, u));
+	
+	return(_mm_adds_epi16(t, _mm_mulhrs_epi16(t, a)));
+}
+
+__attribute__((target("ssse3")))
+static void _cexp_ssse3(cint16_t *out, const uint32_t *phase, int n)
+{
+	const __m128i r = _mm_set1_epi32(1 << 14);
+	const __m128i m = _mm_set1_epi32(0x7FFF);
+	const __m128i one = _mm_set1_epi16(1);
+	const __m128i two = _mm_set1_epi16(2);
+	__m128i p0, p1, t, q, s, c, a, b, swap, ni, nq;
+	int x;
+	
+	for(x = 0; x + 8 <= n; x += 8)
+	{
+		p0 = _mm_add_epi32(_mm_loadu_si128((const __m128i *) &phase[x + 0]), r);
+		p1 = _mm_add_epi32(_mm_loadu_si128((const __m128i *) &phase[x + 4]), r);
+		
+		t = _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(p0, 15), m), _mm_and_si128(_mm_srli_epi32(p1, 15), m));
+		q = _mm_packs_epi32(_mm_srli_epi32(p0, 30), _mm_srli_epi32(p1, 30));
+		
+		s = _sin_ssse3(t);
+		c = _sin_ssse3(_mm_adds_epi16(_mm_sub_epi16(_mm_set1_epi16(0x7FFF), t), one));
+		
+		/* Swap on odd quadrants */
+		swap = _mm_cmpeq_epi16(_mm_and_si128(q, one), one);
+		a = _mm_or_si128(_mm_and_si128(swap, s), _mm_andnot_si128(swap, c));
+		b = _mm_or_si128(_mm_and_si128(swap, c), _mm_andnot_si128(swap, s));
+		
+		/* Negate I in quadrants 1 and 2, Q in 2 and 3 */
+		ni = _mm_cmpeq_epi16(_mm_and_si128(_mm_add_epi16(q, one), two), two);
+		nq = _mm_cmpeq_epi16(_mm_and_si128(q, two), two);
+		a = _mm_sub_epi16(_mm_xor_si128(a, ni), ni);
+		b = _mm_sub_epi16(_mm_xor_si128(b, nq), nq);
+		
+		_mm_storeu_si128((__m128i *) &out[x + 0], _mm_unpacklo_epi16(a, b));
+		_mm_storeu_si128((__m128i *) &out[x + 4], _mm_unpackhi_epi16(a, b));
+	}
+	
+	_cexp_c(&out[x], &phase[x], n - x);
+}
+
+/* The products are summed with pmaddwd against (lo.i, -lo.q) and
+ * (lo.q, lo.i). The low 16 bits of each result are kept, as in the
+ * scalar version, rather than saturating with packs */
+__attribute__((target("ssse3")))
+static void _mix_ssse3(cint16_t *out, const cint16_t *in, const cint16_t *lo, int swap, int n)
+{
+	const __m128i conj = _mm_set1_epi32(0xFFFF0001);
+	const __m128i m = _mm_set1_epi32(0xFFFF);
+	__m128i a, c, i, q;
+	int x;
+	
+	for(x = 0; x + 4 <= n; x += 4)
+	{
+		a = _mm_loadu_si128((const __m128i *) &in[x]);
+		c = _mm_loadu_si128((const __m128i *) &lo[x]);
+		
+		if(swap)
+		{
+			a = _mm_shufflehi_epi16(_mm_shufflelo_epi16(a, 0xB1), 0xB1);
+		}
+		
+		i = _mm_madd_epi16(a, _mm_sign_epi16(c, conj));
+		q = _mm_madd_epi16(a, _mm_shufflehi_epi16(_mm_shufflelo_epi16(c, 0xB1), 0xB1));
+		
+		i = _mm_and_si128(_mm_srai_epi32(i, 15), m);
+		q = _mm_slli_epi32(_mm_srai_epi32(q, 15), 16);
+		
+		_mm_storeu_si128((__m128i *) &out[x], _mm_or_si128(i, q));
+	}
+	
+	_mix_c(&out[x], &in[x], &lo[x], swap, n - x);
+}
+
+/* -=== x86 AVX2 ===- */
+
+__attribute__((target("avx2")))
+static inline __m256i _sin_avx2(__m256i t)
+{
+	__m256i u, a;
+	
+	u = _mm256_mulhrs_epi16(t, t);
+	a = _mm256_set1_epi16(_C7);
+	a = _mm256_add_epi16(_mm256_set1_epi16(_C5), _mm256_mulhrs_epi16(a, u));
+	a = _mm256_add_epi16(_mm256_set1_epi16(_C3), _mm256_mulhrs_epi16(a, u));
+	a = _mm256_add_epi16(_mm256_set1_epi16(_C1), _mm256_mulhrs_epi16(a, u));
+	
+	return(_mm256_adds_epi16(t, _mm256_mulhrs_epi16(t, a)));
+}
+
+__attribute__((target("avx2")))
+static void _cexp_avx2(cint16_t *out, const uint32_t *phase, int n)
+{
+	const __m256i r = _mm256_set1_epi32(1 << 14);
+	const __m256i m = _mm256_set1_epi32(0x7FFF);
+	const __m256i one = _mm256_set1_epi16(1);
+	const __m256i two = _mm256_set1_epi16(2);
+	__m256i p0, p1, t, q, s, c, a, b, swap, ni, nq;
+	int x;
+	
+	for(x = 0; x + 16 <= n; x += 16)
+	{
+		p0 = _mm256_add_epi32(_mm256_loadu_si256((const __m256i *) &phase[x + 0]), r);
+		p1 = _mm256_add_epi32(_mm256_loadu_si256((const __m256i *) &phase[x + 8]), r);
+		
+		/* The packs work within each 128-bit lane, the permute
+		 * puts the samples back in order */
+		t = _mm256_packs_epi32(_mm256_and_si256(_mm256_srli_epi32(p0, 15), m), _mm256_and_si256(_mm256_srli_epi32(p1, 15), m));
+		q = _mm256_packs_epi32(_mm256_srli_epi32(p0, 30), _mm256_srli_epi32(p1, 30));
+		t = _mm256_permute4x64_epi64(t, 0xD8);
+		q = _mm256_permute4x64_epi64(q, 0xD8);
+		
+		s = _sin_avx2(t);
+		c = _sin_avx2(_mm256_adds_epi16(_mm256_sub_epi16(_mm256_set1_epi16(0x7FFF), t), one));
+		
+		/* Swap on odd quadrants */
+		swap = _mm256_cmpeq_epi16(_mm256_and_si256(q, one), one);
+		a = _mm256_blendv_epi8(c, s, swap);
+		b = _mm256_blendv_epi8(s, c, swap);
+		
+		/* Negate I in quadrants 1 and 2, Q in 2 and 3 */
+		ni = _mm256_cmpeq_epi16(_mm256_and_si256(_mm256_add_epi16(q, one), two), two);
+		nq = _mm256_cmpeq_epi16(_mm256_and_si256(q, two), two);
+		a = _mm256_sub_epi16(_mm256_xor_si256(a, ni), ni);
+		b = _mm256_sub_epi16(_mm256_xor_si256(b, nq), nq);
+		
+		/* Interleave, again within each lane */
+		s = _mm256_unpacklo_epi16(a, b);
+		c = _mm256_unpackhi_epi16(a, b);
+		
+		_mm256_storeu_si256((__m256i *) &out[x + 0], _mm256_permute2x128_si256(s, c, 0x20));
+		_mm256_storeu_si256((__m256i *) &out[x + 8], _mm256_permute2x128_si256(s, c, 0x31));
+	}
+	
+	_cexp_ssse3(&out[x], &phase[x], n - x);
+}
+
+__attribute__((target("avx2")))
+static void _mix_avx2(cint16_t *out, const cint16_t *in, const cint16_t *lo, int swap, int n)
+{
+	const __m256i conj = _mm256_set1_epi32(0xFFFF0001);
+	const __m256i m = _mm256_set1_epi32(0xFFFF);
+	__m256i a, c, i, q;
+	int x;
+	
+	for(x = 0; x + 8 <= n; x += 8)
+	{
+		a = _mm256_loadu_si256((const __m256i *) &in[x]);
+		c = _mm256_loadu_si256((const __m256i *) &lo[x]);
+		
+		if(swap)
+		{
+			a = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(a, 0xB1), 0xB1);
+		}
+		
+		i = _mm256_madd_epi16(a, _mm256_sign_epi16(c, conj));
+		q = _mm256_madd_epi16(a, _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(c, 0xB1), 0xB1));
+		
+		i = _mm256_and_si256(_mm256_srai_epi32(i, 15), m);
+		q = _mm256_slli_epi32(_mm256_srai_epi32(q, 15), 16);
+		
+		_mm256_storeu_si256((__m256i *) &out[x], _mm256_or_si256(i, q));
+	}
+	
+	_mix_ssse3(&out[x], &in[x], &lo[x], swap, n - x);
+}
+
+static const nco_kernels_t _nco_ssse3 = {
+	"ssse3", _cexp_ssse3, _mix_ssse3
+};
+
+static const nco_kernels_t _nco_avx2 = {
+	"avx2", _cexp_avx2, _mix_avx2
+};
+
+#endif
+
+const nco_kernels_t *nco_kernels(int features)
+{
+#ifdef CPU_X86
+	if(features & CPU_AVX2)  return(&_nco_avx2);
+	if(features & CPU_SSSE3) return(&_nco_ssse3);
+#endif
+	
+	return(&nco_scalar);
+}
+
+/* -=== Oscillator ===- */
+
+int nco_init(nco_t *n, double sample_rate, double frequency, double deviation)
+{
+	n->kernels = nco_kernels(cpu_features());
+	
+	/* Negative frequencies wrap to the top half of the range */
+	n->phase = 0;
+	n->step = (uint32_t) llround(fmod(frequency / sample_rate, 1.0) * 4294967296.0);
+	n->deviation = llround(deviation / sample_rate / INT16_MAX * 281474976710656.0);
+	
+	return(0);
+}
+
+void nco_tone(nco_t *n, cint16_t *out, size_t samples)
+{
+	uint32_t phase[NCO_BLOCK];
+	size_t i, l;
+	
+	for(; samples > 0; samples -= l, out += l)
+	{
+		l = samples < NCO_BLOCK ? samples : NCO_BLOCK;
+		
+		for(i = 0; i < l; i++)
+		{
+			phase[i] = n->phase + n->step * (uint32_t) (i + 1);
+		}
+		
+		n->phase = phase[l - 1];
+		
+		n->kernels->cexp(out, phase, l);
+	}
+}
+
+void nco_fm(nco_t *n, cint16_t *out, const int16_t *in, int step, size_t samples)
+{
+	uint32_t phase[NCO_BLOCK];
+	uint32_t p, hi;
+	int32_t lo;
+	size_t i, l;
+	
+	/* Split the deviation so the steps can be calculated in 32-bits,
+	 * the high part only needs to be right modulo 2^32 */
+	hi = (uint32_t) (n->deviation >> 16);
+	lo = n->deviation & 0xFFFF;
+	
+	for(; samples > 0; samples -= l, out += l, in += l * step)
+	{
+		l = samples < NCO_BLOCK ? samples : NCO_BLOCK;
+		
+		/* The phase steps have no dependency on each other */
+		for(i = 0; i < l; i++)
+		{
+			phase[i] = n->step + (uint32_t) in[i * step] * hi + ((in[i * step] * lo) >> 16);
+		}
+		
+		/* The running sum is the only serial part */
+		for(p = n->phase, i = 0; i < l; i++)
+		{
+			phase[i] = p += phase[i];
+		}
+		
+		n->phase = p;
+		
+		n->kernels->cexp(out, phase, l);
+	}
+}
+
@@ -0,0 +1,74 @@
+/* hacktv - Analogue video transmitter for the HackRF                    */
+/*=======================================================================*/
+/* Copyright 2023 Philip Heron <phil@sanslogic.co.uk>                    */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* (at your option) any later version.                                   */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+/* Numerically controlled oscillator
+ * 
+ * The phase is a 32-bit accumulator where a full turn is 2^32, so it
+ * wraps naturally and never needs correcting. The phase for a block
+ * of samples is found first, the running sum of the phase steps is
+ * the only serial part. The phases are then converted to I/Q with a
+ * short polynomial, which the SIMD kernels evaluate several samples
+ * at a time without any table lookups.
+*/
+
+#ifndef _NCO_H
+#define _NCO_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "common.h"
+
+/* Largest block the callers should need to buffer in one go */
+#define NCO_BLOCK 256
+
+/* Convert n phases to complex samples with an amplitude of INT16_MAX */
+typedef void (*nco_cexp_t)(cint16_t *out, const uint32_t *phase, int n);
+
+/* Multiply n samples by the carrier, out = in * lo. The I and Q of
+ * the input are exchanged first if swap is set. out may equal in */
+typedef void (*nco_mix_t)(cint16_t *out, const cint16_t *in, const cint16_t *lo, int swap, int n);
+
+typedef struct {
+	const char *name;
+	nco_cexp_t cexp;
+	nco_mix_t mix;
+} nco_kernels_t;
+
+/* The plain C version, used as the reference */
+extern const nco_kernels_t nco_scalar;
+
+/* Returns the fastest kernels for the CPU features given */
+extern const nco_kernels_t *nco_kernels(int features);
+
+typedef struct {
+	const nco_kernels_t *kernels;
+	uint32_t phase;		/* Current phase */
+	uint32_t step;		/* Phase step per sample at the centre frequency */
+	int64_t deviation;	/* Phase step per unit of input, Q16 */
+} nco_t;
+
+extern int nco_init(nco_t *n, double sample_rate, double frequency, double deviation);
+
+/* Generate samples of the unmodulated carrier */
+extern void nco_tone(nco_t *n, cint16_t *out, size_t samples);
+
+/* Generate samples of the carrier frequency modulated by the input.
+ * An input of +/-INT16_MAX is the full deviation */
+extern void nco_fm(nco_t *n, cint16_t *out, const int16_t *in, int step, size_t samples);
+
+#endif
+
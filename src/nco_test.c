@@ -0,0 +1,205 @@
+/* hacktv - Analogue video transmitter for the HackRF                    */
+/*=======================================================================*/
+/* Copyright 2023 Philip Heron <phil@sanslogic.co.uk>                    */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* (at your option) any later version.                                   */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+/* Checks the NCO kernels this CPU can run. Run with "make check".
+ * 
+ * The phase to I/Q conversion is compared with sin() and cos() over
+ * a sweep of the whole turn. The largest error of every kernel must
+ * be within _MAX_ERROR LSB, and the SIMD kernels must also match the
+ * scalar one exactly. The sweep is done in blocks of every length up
+ * to NCO_BLOCK, to cover the scalar tails.
+ * 
+ * The mixer is compared with the scalar version on random samples,
+ * with and without the I/Q swap and writing over its input.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include "common.h"
+#include "cpu.h"
+#include "nco.h"
+
+/* The documented error bound of the polynomial */
+#define _MAX_ERROR 2
+
+/* Phase step of the sweep, an odd number hits every low bit pattern */
+#define _SWEEP_STEP 4093
+
+#define _MIX_SAMPLES 67
+#define _OFFSETS 16
+
+/* Features that can select a different backend */
+static const int _features[] = {
+	CPU_SSE2, CPU_SSSE3, CPU_AVX2, CPU_AVX512BW, 0
+};
+
+static uint32_t _seed = 1;
+
+static uint32_t _random(void)
+{
+	/* A simple LCG, the same sequence on every platform */
+	_seed = _seed * 1103515245 + 12345;
+	return(_seed >> 8);
+}
+
+static int _check_cexp(const nco_kernels_t *k)
+{
+	static uint32_t phase[NCO_BLOCK];
+	static cint16_t ref[NCO_BLOCK];
+	static cint16_t out[NCO_BLOCK];
+	uint64_t p;
+	double a, err, max_err = 0;
+	int n = 1, x;
+	int errors = 0;
+	
+	for(p = 0; p < (1ULL << 32); p += (uint64_t) _SWEEP_STEP * n)
+	{
+		/* Every block length in turn */
+		n = n % NCO_BLOCK + 1;
+		
+		for(x = 0; x < n; x++)
+		{
+			phase[x] = p + (uint64_t) _SWEEP_STEP * x;
+		}
+		
+		k->cexp(out, phase, n);
+		nco_scalar.cexp(ref, phase, n);
+		
+		for(x = 0; x < n; x++)
+		{
+			if(out[x].i != ref[x].i || out[x].q != ref[x].q)
+			{
+				if(errors++ < 10)
+				{
+					fprintf(stderr, "%s cexp: phase 0x%08X: %d,%d != %d,%d\n", k->name, phase[x], out[x].i, out[x].q, ref[x].i, ref[x].q);
+				}
+			}
+			
+			a = phase[x] * (2.0 * M_PI / 4294967296.0);
+			
+			err = fabs(out[x].i - INT16_MAX * cos(a));
+			if(err > max_err) max_err = err;
+			
+			err = fabs(out[x].q - INT16_MAX * sin(a));
+			if(err > max_err) max_err = err;
+		}
+	}
+	
+	printf("nco %s: cexp max error %.2f LSB\n", k->name, max_err);
+	
+	if(max_err > _MAX_ERROR)
+	{
+		fprintf(stderr, "%s cexp: error over %d LSB\n", k->name, _MAX_ERROR);
+		errors++;
+	}
+	
+	return(errors);
+}
+
+static int _check_mix(const nco_kernels_t *k)
+{
+	static cint16_t in[_MIX_SAMPLES + _OFFSETS];
+	static cint16_t lo[_MIX_SAMPLES + _OFFSETS];
+	static cint16_t ref[_MIX_SAMPLES + _OFFSETS];
+	static cint16_t out[_MIX_SAMPLES + _OFFSETS];
+	int n, o, x, swap, inplace;
+	int errors = 0;
+	
+	for(x = 0; x < _MIX_SAMPLES + _OFFSETS; x++)
+	{
+		/* The first samples are the extremes */
+		in[x].i = x < 4 ? (x & 1 ? INT16_MAX : INT16_MIN) : (int16_t) _random();
+		in[x].q = x < 4 ? (x & 2 ? INT16_MAX : INT16_MIN) : (int16_t) _random();
+		
+		/* The carrier never holds INT16_MIN */
+		lo[x].i = x < 4 ? (x & 2 ? INT16_MAX : -INT16_MAX) : (int16_t) _random();
+		lo[x].q = x < 4 ? (x & 1 ? INT16_MAX : -INT16_MAX) : (int16_t) _random();
+		if(lo[x].i == INT16_MIN) lo[x].i = -INT16_MAX;
+		if(lo[x].q == INT16_MIN) lo[x].q = -INT16_MAX;
+	}
+	
+	for(n = 0; n <= _MIX_SAMPLES; n++)
+	{
+		for(o = 0; o < _OFFSETS; o++)
+		{
+			for(swap = 0; swap < 2; swap++)
+			{
+				for(inplace = 0; inplace < 2; inplace++)
+				{
+					/* Outside the n samples the buffer is unchanged */
+					memcpy(ref, in, sizeof(ref));
+					memcpy(out, in, sizeof(out));
+					
+					/* The carrier starts at its own offset */
+					x = (o * 7 + n) % _OFFSETS;
+					
+					nco_scalar.mix(&ref[o], &in[o], &lo[x], swap, n);
+					k->mix(&out[o], inplace ? &out[o] : &in[o], &lo[x], swap, n);
+					
+					if(memcmp(ref, out, sizeof(ref)) != 0)
+					{
+						fprintf(stderr, "%s mix: n = %d, offset %d, swap %d, in place %d\n", k->name, n, o, swap, inplace);
+						errors++;
+					}
+				}
+			}
+		}
+	}
+	
+	return(errors);
+}
+
+int main(int argc, char *argv[])
+{
+	const nco_kernels_t *tested[sizeof(_features) / sizeof(int) + 1];
+	const nco_kernels_t *k;
+	int i, j, ntested = 0;
+	int errors, failed = 0;
+	
+	/* The scalar version is checked against sin() and cos() too */
+	for(i = -1; i < 0 || _features[i]; i++)
+	{
+		if(i < 0)
+		{
+			k = &nco_scalar;
+		}
+		else
+		{
+			if((cpu_features() & _features[i]) == 0) continue;
+			k = nco_kernels(_features[i]);
+		}
+		
+		/* Some features share a backend */
+		for(j = 0; j < ntested && tested[j] != k; j++);
+		if(j < ntested) continue;
+		
+		tested[ntested++] = k;
+		
+		errors = _check_cexp(k);
+		if(k != &nco_scalar) errors += _check_mix(k);
+		
+		printf("nco %s: %s\n", k->name, errors ? "FAILED" : "OK");
+		
+		if(errors) failed = 1;
+	}
+	
+	return(failed);
+}
+
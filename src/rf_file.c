@@ -15,281 +15,577 @@
 /* You should have received a copy of the GNU General Public License     */
 /* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
 
+#define _GNU_SOURCE 1
 #include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <pthread.h>
 #include "rf.h"
+#include "cpu.h"
+#include "iqconv.h"
+#include "iqz.h"
+
+/* Alignment of the buffers and of the writes for O_DIRECT */
+#define _DIRECT_ALIGN 4096
+
+/* Writer thread buffers used for regular files by default */
+#define _DEFAULT_BUFFERS 4
+
+/* Compression threads used by default, at most one per CPU. More
+ * rarely keep up better and each one adds a buffer to the ring */
+#define _DEFAULT_COMPRESS_THREADS 4
+
+typedef struct {
+	uint8_t *data;
+	size_t len;
+	
+	/* Compressed copy of the buffer */
+	uint8_t *zdata;
+	size_t zlen;
+	int busy;		/* Claimed by a worker */
+	int done;		/* Ready to write */
+	
+} _rf_file_buffer_t;
 
 /* File sink */
 typedef struct {
 	FILE *f;
+	int fd;
 	void *data;
 	size_t data_size;
 	size_t samples;
 	int complex;
 	int type;
+	iqconv_t conv;
+	
+	/* Writer thread, when nbuffers > 0 */
+	int nbuffers;
+	size_t buffer_size;
+	_rf_file_buffer_t *buffers;
+	int head;		/* The buffer being filled */
+	int tail;		/* The next buffer to write */
+	int queued;		/* Buffers waiting to be written */
+	int max_queued;
+	int direct;		/* O_DIRECT is set on fd */
+	int fadvise;		/* Drop written data from the page cache */
+	off_t written;
+	off_t cached;		/* Start of the written data still cached */
+	int error;
+	int exit;
+	double stall;		/* Seconds spent waiting for a free buffer */
+	pthread_t thread;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	int thread_running;
+	
+	/* Compression workers, when compress > 0 */
+	int compress;		/* zlib level */
+	int nworkers;
+	int workers_running;
+	pthread_t *workers;
+	uint64_t raw_written;
+	
 } rf_file_t;
 
-static int _rf_file_write_uint8_real(void *private, int16_t *iq_data, size_t samples)
+static double _now(void)
 {
-	rf_file_t *rf = private;
-	uint8_t *u8 = rf->data;
-	int i;
+	struct timespec ts;
 	
-	while(samples)
-	{
-		for(i = 0; i < rf->samples && i < samples; i++, iq_data += 2)
-		{
-			u8[i] = (iq_data[0] - INT16_MIN) >> 8;
-		}
-		
-		fwrite(rf->data, rf->data_size, i, rf->f);
-		
-		samples -= i;
-	}
+	clock_gettime(CLOCK_MONOTONIC, &ts);
 	
-	return(RF_OK);
+	return(ts.tv_sec + ts.tv_nsec * 1e-9);
 }
 
-static int _rf_file_write_int8_real(void *private, int16_t *iq_data, size_t samples)
+/* -=== Synchronous writer ===- */
+
+static int _rf_file_write_sync(void *private, int16_t *iq_data, size_t samples)
 {
 	rf_file_t *rf = private;
-	int8_t *i8 = rf->data;
-	int i;
+	size_t n;
+	
+	if(rf->type == RF_INT16 && rf->complex)
+	{
+		/* Write straight from the line buffer */
+		fwrite(iq_data, sizeof(int16_t) * 2, samples, rf->f);
+		return(RF_OK);
+	}
 	
 	while(samples)
 	{
-		for(i = 0; i < rf->samples && i < samples; i++, iq_data += 2)
-		{
-			i8[i] = iq_data[0] >> 8;
-		}
+		n = samples < rf->samples ? samples : rf->samples;
 		
-		fwrite(rf->data, rf->data_size, i, rf->f);
+		rf->conv(rf->data, iq_data, n);
+		fwrite(rf->data, rf->data_size, n, rf->f);
 		
-		samples -= i;
+		iq_data += n * 2;
+		samples -= n;
 	}
 	
 	return(RF_OK);
 }
 
-static int _rf_file_write_uint16_real(void *private, int16_t *iq_data, size_t samples)
+/* -=== Writer thread ===- */
+
+static int _rf_file_write_all(rf_file_t *rf, const uint8_t *data, size_t len)
 {
-	rf_file_t *rf = private;
-	uint16_t *u16 = rf->data;
-	int i;
+	off_t start = rf->written;
+	ssize_t r;
 	
-	while(samples)
+#ifdef O_DIRECT
+	if(rf->direct && len % _DIRECT_ALIGN != 0)
+	{
+		/* Only the last buffer can be partial. O_DIRECT
+		 * can't write it, so turn it off for the tail */
+		fcntl(rf->fd, F_SETFL, fcntl(rf->fd, F_GETFL) & ~O_DIRECT);
+		rf->direct = 0;
+	}
+#endif
+	
+	while(len > 0)
 	{
-		for(i = 0; i < rf->samples && i < samples; i++, iq_data += 2)
+		r = write(rf->fd, data, len);
+		
+		if(r < 0)
 		{
-			u16[i] = (iq_data[0] - INT16_MIN);
+			if(errno == EINTR) continue;
+			perror("write");
+			return(RF_ERROR);
 		}
 		
-		fwrite(rf->data, rf->data_size, i, rf->f);
+		rf->written += r;
+		data += r;
+		len -= r;
+	}
+	
+#ifdef SYNC_FILE_RANGE_WRITE
+	if(rf->fadvise)
+	{
+		/* Dirty pages can't be dropped. Start writing this buffer
+		 * back, then wait for the one before it, which has had a
+		 * buffer's time to finish, and drop that from the cache */
+		sync_file_range(rf->fd, start, rf->written - start, SYNC_FILE_RANGE_WRITE);
 		
-		samples -= i;
+		if(start > rf->cached)
+		{
+			sync_file_range(rf->fd, rf->cached, start - rf->cached, SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+			posix_fadvise(rf->fd, rf->cached, start - rf->cached, POSIX_FADV_DONTNEED);
+			rf->cached = start;
+		}
 	}
+#endif
 	
 	return(RF_OK);
 }
 
-static int _rf_file_write_int16_real(void *private, int16_t *iq_data, size_t samples)
+static void *_rf_file_thread(void *arg)
 {
-	rf_file_t *rf = private;
-	int16_t *i16 = rf->data;
-	int i;
+	rf_file_t *rf = arg;
+	_rf_file_buffer_t *b;
+	int r, error;
 	
-	while(samples)
+	pthread_mutex_lock(&rf->mutex);
+	
+	while(1)
 	{
-		for(i = 0; i < rf->samples && i < samples; i++, iq_data += 2)
+		while(rf->queued == 0 && rf->exit == 0)
 		{
-			i16[i] = iq_data[0];
+			pthread_cond_wait(&rf->cond, &rf->mutex);
 		}
 		
-		fwrite(rf->data, rf->data_size, i, rf->f);
+		if(rf->queued == 0)
+		{
+			break;
+		}
 		
-		samples -= i;
+		b = &rf->buffers[rf->tail];
+		
+		/* Compressed buffers are still written in order */
+		if(rf->compress && !b->done)
+		{
+			pthread_cond_wait(&rf->cond, &rf->mutex);
+			continue;
+		}
+		
+		error = rf->error;
+		
+		pthread_mutex_unlock(&rf->mutex);
+		
+		/* After an error the buffers are still released,
+		 * so the render thread never waits forever */
+		if(error)
+		{
+			r = RF_ERROR;
+		}
+		else if(rf->compress)
+		{
+			r = _rf_file_write_all(rf, b->zdata, b->zlen);
+			rf->raw_written += b->len;
+		}
+		else
+		{
+			r = _rf_file_write_all(rf, b->data, b->len);
+		}
+		
+		pthread_mutex_lock(&rf->mutex);
+		
+		if(r != RF_OK) rf->error = 1;
+		
+		b->len = 0;
+		b->busy = 0;
+		b->done = 0;
+		rf->tail = (rf->tail + 1) % rf->nbuffers;
+		rf->queued--;
+		
+		pthread_cond_broadcast(&rf->cond);
 	}
 	
-	return(RF_OK);
+	pthread_mutex_unlock(&rf->mutex);
+	
+	return(NULL);
 }
 
-static int _rf_file_write_int32_real(void *private, int16_t *iq_data, size_t samples)
+/* Compresses queued buffers, oldest first */
+static void *_rf_file_worker(void *arg)
 {
-	rf_file_t *rf = private;
-	int32_t *i32 = rf->data;
-	int i;
+	rf_file_t *rf = arg;
+	_rf_file_buffer_t *b;
+	uint8_t *tmp;
+	int i, r, error;
 	
-	while(samples)
+	tmp = malloc(rf->buffer_size);
+	if(!tmp)
+	{
+		perror("malloc");
+	}
+	
+	pthread_mutex_lock(&rf->mutex);
+	
+	while(1)
 	{
-		for(i = 0; i < rf->samples && i < samples; i++, iq_data += 2)
+		for(b = NULL, i = 0; i < rf->queued && b == NULL; i++)
 		{
-			i32[i] = (iq_data[0] << 16) + iq_data[0];
+			b = &rf->buffers[(rf->tail + i) % rf->nbuffers];
+			if(b->busy || b->done) b = NULL;
 		}
 		
-		fwrite(rf->data, rf->data_size, i, rf->f);
+		if(b == NULL)
+		{
+			if(rf->exit) break;
+			
+			pthread_cond_wait(&rf->cond, &rf->mutex);
+			continue;
+		}
+		
+		b->busy = 1;
+		error = rf->error || tmp == NULL;
+		
+		pthread_mutex_unlock(&rf->mutex);
 		
-		samples -= i;
+		/* After an error the buffers are just passed on */
+		r = error ? -1 : iqz_compress(b->zdata, &b->zlen, b->data, b->len, tmp, rf->type, rf->compress);
+		
+		pthread_mutex_lock(&rf->mutex);
+		
+		if(r != 0 && !error)
+		{
+			fprintf(stderr, "File compression failed.\n");
+		}
+		
+		if(r != 0) rf->error = 1;
+		
+		b->done = 1;
+		
+		pthread_cond_broadcast(&rf->cond);
 	}
 	
-	return(RF_OK);
+	pthread_mutex_unlock(&rf->mutex);
+	
+	free(tmp);
+	
+	return(NULL);
 }
 
-static int _rf_file_write_float_real(void *private, int16_t *iq_data, size_t samples)
+static int _rf_file_queue(rf_file_t *rf)
 {
-	rf_file_t *rf = private;
-	float *f32 = rf->data;
-	int i;
+	double t;
+	int r;
 	
-	while(samples)
+	pthread_mutex_lock(&rf->mutex);
+	
+	/* Hand the current buffer to the writer */
+	rf->queued++;
+	if(rf->queued > rf->max_queued)
+	{
+		rf->max_queued = rf->queued;
+	}
+	
+	rf->head = (rf->head + 1) % rf->nbuffers;
+	
+	pthread_cond_broadcast(&rf->cond);
+	
+	/* Wait for the next buffer to be free */
+	if(rf->queued == rf->nbuffers)
 	{
-		for(i = 0; i < rf->samples && i < samples; i++, iq_data += 2)
+		t = _now();
+		
+		while(rf->queued == rf->nbuffers && rf->error == 0)
 		{
-			f32[i] = (float) iq_data[0] * (1.0 / 32767.0);
+			pthread_cond_wait(&rf->cond, &rf->mutex);
 		}
 		
-		fwrite(rf->data, rf->data_size, i, rf->f);
-		
-		samples -= i;
+		rf->stall += _now() - t;
 	}
 	
-	return(RF_OK);
+	r = rf->error ? RF_ERROR : RF_OK;
+	
+	pthread_mutex_unlock(&rf->mutex);
+	
+	return(r);
 }
 
-static int _rf_file_write_uint8_complex(void *private, int16_t *iq_data, size_t samples)
+static int _rf_file_write_async(void *private, int16_t *iq_data, size_t samples)
 {
 	rf_file_t *rf = private;
-	uint8_t *u8 = rf->data;
-	int i;
+	_rf_file_buffer_t *b;
+	size_t n;
 	
 	while(samples)
 	{
-		for(i = 0; i < rf->samples && i < samples; i++, iq_data += 2)
-		{
-			u8[i * 2 + 0] = (iq_data[0] - INT16_MIN) >> 8;
-			u8[i * 2 + 1] = (iq_data[1] - INT16_MIN) >> 8;
-		}
+		b = &rf->buffers[rf->head];
 		
-		fwrite(rf->data, rf->data_size, i, rf->f);
+		n = (rf->buffer_size - b->len) / rf->data_size;
+		if(n > samples) n = samples;
 		
-		samples -= i;
+		rf->conv(b->data + b->len, iq_data, n);
+		b->len += n * rf->data_size;
+		
+		iq_data += n * 2;
+		samples -= n;
+		
+		if(b->len == rf->buffer_size)
+		{
+			if(_rf_file_queue(rf) != RF_OK)
+			{
+				return(RF_ERROR);
+			}
+		}
 	}
 	
 	return(RF_OK);
 }
 
-static int _rf_file_write_int8_complex(void *private, int16_t *iq_data, size_t samples)
+static void _rf_file_flush(rf_file_t *rf)
 {
-	rf_file_t *rf = private;
-	int8_t *i8 = rf->data;
+	uint8_t end[IQZ_CHUNK_HEADER_LEN];
 	int i;
 	
-	while(samples)
+	if(rf->buffers[rf->head].len > 0)
+	{
+		_rf_file_queue(rf);
+	}
+	
+	pthread_mutex_lock(&rf->mutex);
+	rf->exit = 1;
+	pthread_cond_broadcast(&rf->cond);
+	pthread_mutex_unlock(&rf->mutex);
+	
+	pthread_join(rf->thread, NULL);
+	rf->thread_running = 0;
+	
+	for(i = 0; i < rf->workers_running; i++)
 	{
-		for(i = 0; i < rf->samples && i < samples; i++, iq_data += 2)
+		pthread_join(rf->workers[i], NULL);
+	}
+	
+	rf->workers_running = 0;
+	
+	fprintf(stderr, "File writer: %d x %zu KiB buffers, peak queue %d, render stalled for %.3f s\n",
+		rf->nbuffers, rf->buffer_size / 1024, rf->max_queued, rf->stall
+	);
+	
+	if(rf->compress && !rf->error)
+	{
+		iqz_end(end);
+		
+		if(_rf_file_write_all(rf, end, IQZ_CHUNK_HEADER_LEN) != RF_OK)
 		{
-			i8[i * 2 + 0] = iq_data[0] >> 8;
-			i8[i * 2 + 1] = iq_data[1] >> 8;
+			fprintf(stderr, "Error writing the compressed file end marker.\n");
 		}
 		
-		fwrite(rf->data, rf->data_size, i, rf->f);
-		
-		samples -= i;
+		fprintf(stderr, "File compression: %.1f MiB to %.1f MiB (%.1f%%) with %d thread%s\n",
+			rf->raw_written / 1048576.0, rf->written / 1048576.0,
+			rf->raw_written > 0 ? 100.0 * rf->written / rf->raw_written : 0.0,
+			rf->nworkers, rf->nworkers == 1 ? "" : "s"
+		);
 	}
-	
-	return(RF_OK);
 }
 
-static int _rf_file_write_uint16_complex(void *private, int16_t *iq_data, size_t samples)
+static int _rf_file_close(void *private)
 {
 	rf_file_t *rf = private;
-	uint16_t *u16 = rf->data;
 	int i;
 	
-	while(samples)
+	if(rf->thread_running)
 	{
-		for(i = 0; i < rf->samples && i < samples; i++, iq_data += 2)
+		_rf_file_flush(rf);
+	}
+	
+	if(rf->buffers)
+	{
+		for(i = 0; i < rf->nbuffers; i++)
 		{
-			u16[i * 2 + 0] = (iq_data[0] - INT16_MIN);
-			u16[i * 2 + 1] = (iq_data[1] - INT16_MIN);
+			free(rf->buffers[i].data);
+			free(rf->buffers[i].zdata);
 		}
 		
-		fwrite(rf->data, rf->data_size, i, rf->f);
+		free(rf->buffers);
 		
-		samples -= i;
+		pthread_cond_destroy(&rf->cond);
+		pthread_mutex_destroy(&rf->mutex);
 	}
 	
+	if(rf->f && rf->f != stdout) fclose(rf->f);
+	else if(rf->fd >= 0 && rf->f == NULL) close(rf->fd);
+	if(rf->data) free(rf->data);
+	free(rf->workers);
+	free(rf);
+	
 	return(RF_OK);
 }
 
-static int _rf_file_write_int16_complex(void *private, int16_t *iq_data, size_t samples)
+static int _rf_file_open_direct(rf_file_t *rf, const char *filename)
 {
-	rf_file_t *rf = private;
+#ifdef O_DIRECT
+	rf->fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0666);
 	
-	fwrite(iq_data, sizeof(int16_t) * 2, samples, rf->f);
+	if(rf->fd >= 0)
+	{
+		rf->direct = 1;
+		return(RF_OK);
+	}
+	
+	/* Some filesystems don't support O_DIRECT */
+	if(errno != EINVAL)
+	{
+		perror("open");
+		return(RF_ERROR);
+	}
+#endif
+	
+	rf->fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	
+	if(rf->fd < 0)
+	{
+		perror("open");
+		return(RF_ERROR);
+	}
+	
+#ifdef SYNC_FILE_RANGE_WRITE
+	/* Fall back to dropping the pages after they're written */
+	rf->fadvise = 1;
+	
+	fprintf(stderr, "O_DIRECT is not available for '%s', using sync_file_range().\n", filename);
+#else
+	fprintf(stderr, "O_DIRECT is not available for '%s', using the page cache.\n", filename);
+#endif
 	
 	return(RF_OK);
 }
 
-static int _rf_file_write_int32_complex(void *private, int16_t *iq_data, size_t samples)
+static int _rf_file_init_thread(rf_file_t *rf, int buffers, size_t buffer_size)
 {
-	rf_file_t *rf = private;
-	int32_t *i32 = rf->data;
 	int i;
 	
-	while(samples)
+	/* Whole samples and whole O_DIRECT blocks in each buffer */
+	buffer_size -= buffer_size % _DIRECT_ALIGN;
+	if(buffer_size < _DIRECT_ALIGN) buffer_size = _DIRECT_ALIGN;
+	
+	rf->nbuffers = buffers < 2 ? 2 : buffers;
+	rf->buffer_size = buffer_size;
+	rf->buffers = calloc(rf->nbuffers, sizeof(_rf_file_buffer_t));
+	
+	if(!rf->buffers)
+	{
+		perror("calloc");
+		return(RF_ERROR);
+	}
+	
+	pthread_mutex_init(&rf->mutex, NULL);
+	pthread_cond_init(&rf->cond, NULL);
+	
+	for(i = 0; i < rf->nbuffers; i++)
 	{
-		for(i = 0; i < rf->samples && i < samples; i++, iq_data += 2)
+#ifndef WIN32
+		if(posix_memalign((void **) &rf->buffers[i].data, _DIRECT_ALIGN, rf->buffer_size) != 0)
 		{
-			i32[i * 2 + 0] = (iq_data[0] << 16) + iq_data[0];
-			i32[i * 2 + 1] = (iq_data[1] << 16) + iq_data[1];
+			rf->buffers[i].data = NULL;
 		}
+#else
+		rf->buffers[i].data = malloc(rf->buffer_size);
+#endif
 		
-		fwrite(rf->data, rf->data_size, i, rf->f);
+		if(!rf->buffers[i].data)
+		{
+			perror("malloc");
+			return(RF_ERROR);
+		}
 		
-		samples -= i;
+		if(rf->compress)
+		{
+			rf->buffers[i].zdata = malloc(iqz_bound(rf->buffer_size));
+			
+			if(!rf->buffers[i].zdata)
+			{
+				perror("malloc");
+				return(RF_ERROR);
+			}
+		}
 	}
 	
-	return(RF_OK);
-}
-
-static int _rf_file_write_float_complex(void *private, int16_t *iq_data, size_t samples)
-{
-	rf_file_t *rf = private;
-	float *f32 = rf->data;
-	int i;
-	
-	while(samples)
+	if(rf->compress)
 	{
-		for(i = 0; i < rf->samples && i < samples; i++, iq_data += 2)
-		{
-			f32[i * 2 + 0] = (float) iq_data[0] * (1.0 / 32767.0);
-			f32[i * 2 + 1] = (float) iq_data[1] * (1.0 / 32767.0);
-		}
+		uint8_t h[IQZ_HEADER_LEN];
 		
-		fwrite(rf->data, rf->data_size, i, rf->f);
+		iqz_header(h, rf->type, rf->complex, rf->buffer_size);
 		
-		samples -= i;
+		if(_rf_file_write_all(rf, h, IQZ_HEADER_LEN) != RF_OK)
+		{
+			return(RF_ERROR);
+		}
 	}
 	
-	return(RF_OK);
-}
-
-static int _rf_file_close(void *private)
-{
-	rf_file_t *rf = private;
+	if(pthread_create(&rf->thread, NULL, _rf_file_thread, rf) != 0)
+	{
+		perror("pthread_create");
+		return(RF_ERROR);
+	}
 	
-	if(rf->f && rf->f != stdout) fclose(rf->f);
-	if(rf->data) free(rf->data);
-	free(rf);
+	rf->thread_running = 1;
+	
+	for(i = 0; i < rf->nworkers; i++)
+	{
+		if(pthread_create(&rf->workers[i], NULL, _rf_file_worker, rf) != 0)
+		{
+			perror("pthread_create");
+			return(RF_ERROR);
+		}
+		
+		rf->workers_running++;
+	}
 	
 	return(RF_OK);
 }
 
-int rf_file_open(rf_t *s, char *filename, int type, int complex)
+int rf_file_open(rf_t *s, char *filename, int type, int complex, int buffers, size_t buffer_size, int direct, int compress, int compress_threads)
 {
 	rf_file_t *rf = calloc(1, sizeof(rf_file_t));
+	long ncpus;
 	
 	if(!rf)
 	{
@@ -299,6 +595,49 @@ int rf_file_open(rf_t *s, char *filename, int type, int complex)
 	
 	rf->complex = complex != 0;
 	rf->type = type;
+	rf->fd = -1;
+	
+	/* Direct I/O needs the aligned buffers of the writer thread */
+	if(direct && buffers <= 0)
+	{
+		buffers = 2;
+	}
+	
+	if(compress > 0)
+	{
+		if(direct)
+		{
+			fprintf(stderr, "Compressed output can't be written with direct I/O.\n");
+			_rf_file_close(rf);
+			return(RF_ERROR);
+		}
+		
+		if(compress_threads <= 0)
+		{
+			compress_threads = _DEFAULT_COMPRESS_THREADS;
+#ifdef _SC_NPROCESSORS_ONLN
+			ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+			if(ncpus > 0 && ncpus < compress_threads) compress_threads = ncpus;
+#endif
+		}
+		
+		rf->compress = compress;
+		rf->nworkers = compress_threads > 0 ? compress_threads : 1;
+		rf->workers = calloc(rf->nworkers, sizeof(pthread_t));
+		
+		if(!rf->workers)
+		{
+			perror("calloc");
+			_rf_file_close(rf);
+			return(RF_ERROR);
+		}
+		
+		/* Enough buffers to keep every worker busy */
+		if(buffers < rf->nworkers + 2)
+		{
+			buffers = rf->nworkers + 2;
+		}
+	}
 	
 	if(filename == NULL)
 	{
@@ -309,6 +648,15 @@ int rf_file_open(rf_t *s, char *filename, int type, int complex)
 	else if(strcmp(filename, "-") == 0)
 	{
 		rf->f = stdout;
+		rf->fd = fileno(stdout);
+	}
+	else if(direct)
+	{
+		if(_rf_file_open_direct(rf, filename) != RF_OK)
+		{
+			_rf_file_close(rf);
+			return(RF_ERROR);
+		}
 	}
 	else
 	{
@@ -320,6 +668,17 @@ int rf_file_open(rf_t *s, char *filename, int type, int complex)
 			_rf_file_close(rf);
 			return(RF_ERROR);
 		}
+		
+		rf->fd = fileno(rf->f);
+	}
+	
+	if(buffers < 0)
+	{
+		struct stat st;
+		
+		/* A pipe reader would see the ring's large buffers arrive
+		 * in bursts, long after they were rendered */
+		buffers = fstat(rf->fd, &st) == 0 && S_ISREG(st.st_mode) ? _DEFAULT_BUFFERS : 0;
 	}
 	
 	/* Find the size of the output data type */
@@ -340,6 +699,25 @@ int rf_file_open(rf_t *s, char *filename, int type, int complex)
 	/* Double the size for complex types */
 	if(rf->complex) rf->data_size *= 2;
 	
+	rf->conv = iqconv_kernels(cpu_features())->conv[type][rf->complex];
+	
+	/* Register the callback functions */
+	s->ctx = rf;
+	s->close = _rf_file_close;
+	
+	if(buffers > 0)
+	{
+		if(_rf_file_init_thread(rf, buffers, buffer_size) != RF_OK)
+		{
+			_rf_file_close(rf);
+			return(RF_ERROR);
+		}
+		
+		s->write = _rf_file_write_async;
+		
+		return(RF_OK);
+	}
+	
 	/* Number of samples in the temporary buffer */
 	rf->samples = 4096;
 	
@@ -355,19 +733,7 @@ int rf_file_open(rf_t *s, char *filename, int type, int complex)
 		}
 	}
 	
-	/* Register the callback functions */
-	s->ctx = rf;
-	s->close = _rf_file_close;
-	
-	switch(type)
-	{
-	case RF_UINT8:  s->write = rf->complex ? _rf_file_write_uint8_complex  : _rf_file_write_uint8_real;  break;
-	case RF_INT8:   s->write = rf->complex ? _rf_file_write_int8_complex   : _rf_file_write_int8_real;   break;
-	case RF_UINT16: s->write = rf->complex ? _rf_file_write_uint16_complex : _rf_file_write_uint16_real; break;
-	case RF_INT16:  s->write = rf->complex ? _rf_file_write_int16_complex  : _rf_file_write_int16_real;  break;
-	case RF_INT32:  s->write = rf->complex ? _rf_file_write_int32_complex  : _rf_file_write_int32_real;  break;
-	case RF_FLOAT:  s->write = rf->complex ? _rf_file_write_float_complex  : _rf_file_write_float_real;  break;
-	}
+	s->write = _rf_file_write_sync;
 	
 	return(RF_OK);
 }
@@ -18,7 +18,16 @@
 #ifndef _FILE_H
 #define _FILE_H
 
-extern int rf_file_open(rf_t *s, char *filename, int type, int complex);
+/* With buffers > 0, samples are converted into a ring of buffers of
+ * buffer_size bytes and written out by a separate thread. buffers < 0
+ * uses the thread for regular files only, pipes and stdout are written
+ * as the samples arrive to keep the latency low. direct opens the file
+ * with O_DIRECT where it's supported.
+ * 
+ * With compress (zlib level 1-9) > 0, each buffer is compressed as
+ * one chunk of an iqz.h file by compress_threads workers. 0 threads
+ * uses one per CPU, up to 4 */
+extern int rf_file_open(rf_t *s, char *filename, int type, int complex, int buffers, size_t buffer_size, int direct, int compress, int compress_threads);
 
 #endif
 
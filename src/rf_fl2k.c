@@ -21,6 +21,8 @@
 #include <osmo-fl2k.h>
 #include <pthread.h>
 #include "rf.h"
+#include "cpu.h"
+#include "iqconv.h"
 
 #define BUFFERS 4
 
@@ -31,6 +33,7 @@ typedef struct {
 	
 	uint8_t buffer_r[BUFFERS][FL2K_BUF_LEN];
 	uint8_t buffer_g[BUFFERS][FL2K_BUF_LEN];
+	iqconv_planar_t conv;
 	pthread_mutex_t mutex[BUFFERS];
 	int len;
 	int in;
@@ -73,6 +76,7 @@ static void _callback(fl2k_data_info_t *data_info)
 static int _rf_write(void *private, int16_t *iq_data, size_t samples)
 {
 	fl2k_t *rf = private;
+	size_t l;
 	int i;
 	
 	if(rf->abort)
@@ -82,11 +86,14 @@ static int _rf_write(void *private, int16_t *iq_data, size_t samples)
 	
 	while(samples > 0)
 	{
-		for(; rf->len < FL2K_BUF_LEN && samples > 0; rf->len++, samples--)
-		{
-			rf->buffer_r[rf->in][rf->len] = 128 + (*(iq_data++) / 256);
-			rf->buffer_g[rf->in][rf->len] = 128 + (*(iq_data++) / 256);
-		}
+		l = FL2K_BUF_LEN - rf->len;
+		if(l > samples) l = samples;
+		
+		rf->conv(&rf->buffer_r[rf->in][rf->len], &rf->buffer_g[rf->in][rf->len], iq_data, l);
+		
+		iq_data += l * 2;
+		samples -= l;
+		rf->len += l;
 		
 		if(rf->len == FL2K_BUF_LEN)
 		{
@@ -134,6 +141,7 @@ int rf_fl2k_open(rf_t *s, const char *device, unsigned int sample_rate)
 	}
 	
 	rf->abort = 0;
+	rf->conv = iqconv_kernels(cpu_features())->planar;
 	
 	r = device ? atoi(device) : 0;
 	
@@ -22,6 +22,8 @@
 #include <pthread.h>
 #include <unistd.h>
 #include "rf.h"
+#include "cpu.h"
+#include "iqconv.h"
 
 /* Value from host/libhackrf/src/hackrf.c */
 #define TRANSFER_BUFFER_SIZE 262144
@@ -70,6 +72,7 @@ typedef struct {
 	
 	/* Buffers */
 	buffers_t buffers;
+	iqconv_t conv;
 	
 } hackrf_t;
 
@@ -242,23 +245,20 @@ static int _rf_write(void *private, int16_t *iq_data, size_t samples)
 {
 	hackrf_t *rf = private;
 	int8_t *iq8 = NULL;
-	int i, r;
-	
-	samples *= 2;
+	size_t l;
 	
 	while(samples > 0)
 	{
-		r = _buffer_write_ptr(&rf->buffers, &iq8);
+		/* The buffers always hold whole samples */
+		l = _buffer_write_ptr(&rf->buffers, &iq8) / 2;
+		if(l > samples) l = samples;
 		
-		for(i = 0; i < r && i < samples; i++)
-		{
-			iq8[i] = iq_data[i] >> 8;
-		}
+		rf->conv(iq8, iq_data, l);
 		
-		_buffer_write(&rf->buffers, i);
+		_buffer_write(&rf->buffers, l * 2);
 		
-		iq_data += i;
-		samples -= i;
+		iq_data += l * 2;
+		samples -= l;
 	}
 	
 	return(RF_OK);
@@ -308,6 +308,8 @@ int rf_hackrf_open(rf_t *s, const char *serial, uint32_t sample_rate, uint64_t f
 		return(RF_OUT_OF_MEMORY);
 	}
 	
+	rf->conv = iqconv_kernels(cpu_features())->conv[RF_INT8][1];
+	
 	/* Print the library version number */
 	fprintf(stderr, "libhackrf version: %s (%s)\n",
 		hackrf_library_release(),
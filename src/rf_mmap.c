@@ -0,0 +1,420 @@
+/* hacktv - Analogue video transmitter for the HackRF                    */
+/*=======================================================================*/
+/* Copyright 2023 Philip Heron <phil@sanslogic.co.uk>                    */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* (at your option) any later version.                                   */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+/* Memory mapped file sink
+ * 
+ * The file is mapped a window at a time and the samples converted
+ * straight into the page cache. Space is reserved with fallocate()
+ * before it's mapped, so running out of disk is reported as an error
+ * rather than a SIGBUS. Any space reserved past the last sample is
+ * truncated away on close.
+*/
+
+#define _GNU_SOURCE 1
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "rf.h"
+#include "cpu.h"
+#include "iqconv.h"
+
+#ifndef WIN32
+
+#include <sys/mman.h>
+
+/* Size of each mapping. A multiple of the page and sample sizes */
+#define _MAP_WINDOW (64 << 20)
+
+typedef struct {
+	
+	const char *filename;
+	size_t sample_size;
+	iqconv_t conv;
+	
+	/* Bytes per segment, 0 for a single file */
+	size_t segment_size;
+	int segment;
+	
+	/* The current file */
+	int fd;
+	char *path;
+	char *part;
+	off_t length;		/* Bytes reserved */
+	
+	/* The current mapping */
+	uint8_t *map;
+	off_t map_offset;
+	size_t map_len;
+	size_t map_used;
+	
+} rf_mmap_t;
+
+/* Check the filename has exactly one integer conversion */
+static int _valid_pattern(const char *s)
+{
+	int n = 0;
+	
+	for(; *s; s++)
+	{
+		if(*s != '%') continue;
+		if(*(++s) == '%') continue;
+		
+		while(*s == '0' || *s == '-' || *s == '+' || *s == ' ') s++;
+		while(*s >= '0' && *s <= '9') s++;
+		
+		if(*s != 'd' && *s != 'i' && *s != 'u') return(0);
+		n++;
+	}
+	
+	return(n == 1);
+}
+
+static int _reserve(rf_mmap_t *rf, off_t length)
+{
+	int r;
+	
+	if(length <= rf->length)
+	{
+		return(RF_OK);
+	}
+	
+#ifdef __linux__
+	r = fallocate(rf->fd, 0, rf->length, length - rf->length) == 0 ? 0 : errno;
+#else
+	r = posix_fallocate(rf->fd, rf->length, length - rf->length);
+#endif
+	
+	/* Not every filesystem can preallocate, extend the file instead */
+	if(r == EOPNOTSUPP || r == ENOSYS || r == EINVAL)
+	{
+		r = ftruncate(rf->fd, length) == 0 ? 0 : errno;
+	}
+	
+	if(r != 0)
+	{
+		fprintf(stderr, "Error reserving space in '%s': %s\n", rf->part, strerror(r));
+		return(RF_ERROR);
+	}
+	
+	rf->length = length;
+	
+	return(RF_OK);
+}
+
+static int _unmap(rf_mmap_t *rf)
+{
+	if(rf->map)
+	{
+		munmap(rf->map, rf->map_len);
+		rf->map = NULL;
+	}
+	
+	return(RF_OK);
+}
+
+static int _close_file(rf_mmap_t *rf)
+{
+	off_t length;
+	int r = RF_OK;
+	
+	if(rf->fd < 0)
+	{
+		return(RF_OK);
+	}
+	
+	length = rf->map_offset + rf->map_used;
+	_unmap(rf);
+	
+	/* Drop any space reserved past the last sample */
+	if(length < rf->length && ftruncate(rf->fd, length) != 0)
+	{
+		perror("ftruncate");
+		r = RF_ERROR;
+	}
+	
+	if(close(rf->fd) != 0)
+	{
+		perror("close");
+		r = RF_ERROR;
+	}
+	
+	rf->fd = -1;
+	
+	if(rf->segment_size > 0 && rename(rf->part, rf->path) != 0)
+	{
+		perror("rename");
+		r = RF_ERROR;
+	}
+	
+	return(r);
+}
+
+static int _open_file(rf_mmap_t *rf)
+{
+	int l;
+	
+	if(rf->segment_size > 0)
+	{
+		/* The pattern was checked on open */
+		l = snprintf(NULL, 0, rf->filename, rf->segment);
+		
+		free(rf->path);
+		free(rf->part);
+		rf->path = malloc(l + 1);
+		rf->part = malloc(l + 6);
+		
+		if(!rf->path || !rf->part)
+		{
+			perror("malloc");
+			return(RF_ERROR);
+		}
+		
+		sprintf(rf->path, rf->filename, rf->segment);
+		sprintf(rf->part, "%s.part", rf->path);
+		
+		rf->segment++;
+	}
+	
+	rf->fd = open(rf->part, O_RDWR | O_CREAT | O_TRUNC, 0666);
+	
+	if(rf->fd < 0)
+	{
+		fprintf(stderr, "Error opening '%s': %s\n", rf->part, strerror(errno));
+		return(RF_ERROR);
+	}
+	
+	rf->length = 0;
+	rf->map_offset = 0;
+	rf->map_len = 0;
+	rf->map_used = 0;
+	
+	/* Reserve the whole segment up front */
+	if(rf->segment_size > 0)
+	{
+		return(_reserve(rf, rf->segment_size));
+	}
+	
+	return(RF_OK);
+}
+
+/* Map the next window, moving on to the next segment if this one is full */
+static int _next_window(rf_mmap_t *rf)
+{
+	off_t offset;
+	size_t len;
+	
+	offset = rf->map_offset + rf->map_used;
+	_unmap(rf);
+	
+	if(rf->fd >= 0 && rf->segment_size > 0 && offset == rf->segment_size)
+	{
+		if(_close_file(rf) != RF_OK)
+		{
+			return(RF_ERROR);
+		}
+	}
+	
+	if(rf->fd < 0)
+	{
+		if(_open_file(rf) != RF_OK)
+		{
+			return(RF_ERROR);
+		}
+		
+		offset = 0;
+	}
+	
+	len = _MAP_WINDOW;
+	
+	if(rf->segment_size > 0 && rf->segment_size - offset < len)
+	{
+		len = rf->segment_size - offset;
+	}
+	
+	if(_reserve(rf, offset + len) != RF_OK)
+	{
+		return(RF_ERROR);
+	}
+	
+	rf->map = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, rf->fd, offset);
+	
+	if(rf->map == MAP_FAILED)
+	{
+		rf->map = NULL;
+		perror("mmap");
+		return(RF_ERROR);
+	}
+	
+	rf->map_offset = offset;
+	rf->map_len = len;
+	rf->map_used = 0;
+	
+	return(RF_OK);
+}
+
+static int _rf_mmap_write(void *private, int16_t *iq_data, size_t samples)
+{
+	rf_mmap_t *rf = private;
+	size_t n;
+	
+	while(samples > 0)
+	{
+		if(rf->map_used == rf->map_len)
+		{
+			if(_next_window(rf) != RF_OK)
+			{
+				return(RF_ERROR);
+			}
+		}
+		
+		n = (rf->map_len - rf->map_used) / rf->sample_size;
+		if(n > samples) n = samples;
+		
+		rf->conv(rf->map + rf->map_used, iq_data, n);
+		
+		rf->map_used += n * rf->sample_size;
+		iq_data += n * 2;
+		samples -= n;
+	}
+	
+	return(RF_OK);
+}
+
+static int _rf_mmap_close(void *private)
+{
+	rf_mmap_t *rf = private;
+	int r;
+	
+	r = _close_file(rf);
+	
+	if(rf->part != rf->path) free(rf->part);
+	free(rf->path);
+	free(rf);
+	
+	return(r);
+}
+
+int rf_mmap_open(rf_t *s, const char *filename, int type, int complex, size_t segment_size, size_t segment_samples)
+{
+	rf_mmap_t *rf;
+	
+	if(filename == NULL)
+	{
+		fprintf(stderr, "No output filename provided.\n");
+		return(RF_ERROR);
+	}
+	
+	if(strcmp(filename, "-") == 0)
+	{
+		fprintf(stderr, "Memory mapped output needs a regular file.\n");
+		return(RF_ERROR);
+	}
+	
+	rf = calloc(1, sizeof(rf_mmap_t));
+	if(!rf)
+	{
+		perror("calloc");
+		return(RF_ERROR);
+	}
+	
+	rf->filename = filename;
+	rf->fd = -1;
+	complex = complex != 0;
+	
+	switch(type)
+	{
+	case RF_UINT8:  rf->sample_size = sizeof(uint8_t);  break;
+	case RF_INT8:   rf->sample_size = sizeof(int8_t);   break;
+	case RF_UINT16: rf->sample_size = sizeof(uint16_t); break;
+	case RF_INT16:  rf->sample_size = sizeof(int16_t);  break;
+	case RF_INT32:  rf->sample_size = sizeof(int32_t);  break;
+	case RF_FLOAT:  rf->sample_size = sizeof(float);    break;
+	default:
+		fprintf(stderr, "%s: Unrecognised data type %d\n", __func__, type);
+		free(rf);
+		return(RF_ERROR);
+	}
+	
+	if(complex) rf->sample_size *= 2;
+	
+	rf->conv = iqconv_kernels(cpu_features())->conv[type][complex];
+	
+	/* Use whichever segment limit is reached first, in whole samples */
+	if(segment_samples > 0 && (segment_size == 0 || segment_samples < segment_size / rf->sample_size))
+	{
+		segment_size = segment_samples * rf->sample_size;
+	}
+	
+	rf->segment_size = segment_size - segment_size % rf->sample_size;
+	
+	if(segment_size > 0 && rf->segment_size == 0)
+	{
+		fprintf(stderr, "The segment size is smaller than one sample.\n");
+		free(rf);
+		return(RF_ERROR);
+	}
+	
+	if(rf->segment_size > 0 && !_valid_pattern(filename))
+	{
+		fprintf(stderr, "Segmented output needs one %%d in the filename, eg. out-%%05d.iq\n");
+		free(rf);
+		return(RF_ERROR);
+	}
+	
+	/* A single file is written in place */
+	if(rf->segment_size == 0)
+	{
+		rf->path = strdup(filename);
+		rf->part = rf->path;
+		
+		if(!rf->path)
+		{
+			perror("strdup");
+			free(rf);
+			return(RF_ERROR);
+		}
+	}
+	
+	/* Open the first file now to catch any errors early */
+	if(_open_file(rf) != RF_OK)
+	{
+		_rf_mmap_close(rf);
+		return(RF_ERROR);
+	}
+	
+	/* Register the callback functions */
+	s->ctx = rf;
+	s->write = _rf_mmap_write;
+	s->close = _rf_mmap_close;
+	
+	return(RF_OK);
+}
+
+#else
+
+int rf_mmap_open(rf_t *s, const char *filename, int type, int complex, size_t segment_size, size_t segment_samples)
+{
+	fprintf(stderr, "Memory mapped output is not supported on this platform.\n");
+	return(RF_ERROR);
+}
+
+#endif
+
@@ -0,0 +1,30 @@
+/* hacktv - Analogue video transmitter for the HackRF                    */
+/*=======================================================================*/
+/* Copyright 2023 Philip Heron <phil@sanslogic.co.uk>                    */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* (at your option) any later version.                                   */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+#ifndef _RF_MMAP_H
+#define _RF_MMAP_H
+
+/* Samples are converted directly into the file through a memory map.
+ * 
+ * With segment_size (bytes) or segment_samples set, a new file is
+ * started whenever either limit is reached. filename must then hold
+ * one integer conversion for the segment number, eg. "out-%05d.iq".
+ * Each segment is written as <name>.part and renamed once complete */
+extern int rf_mmap_open(rf_t *s, const char *filename, int type, int complex, size_t segment_size, size_t segment_samples);
+
+#endif
+
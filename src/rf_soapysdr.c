@@ -23,6 +23,8 @@
 #include <SoapySDR/Formats.h>
 #include <SoapySDR/Version.h>
 #include "rf.h"
+#include "cpu.h"
+#include "iqconv.h"
 
 #define BUF_LEN 4096
 
@@ -33,6 +35,7 @@ typedef struct {
 	SoapySDRStream *s;
 	
 	int scale;
+	iqconv_scale_t conv;
 	int16_t txbuf[BUF_LEN * 2];
 	
 } soapysdr_t;
@@ -52,10 +55,7 @@ static int _rf_write(void *private, int16_t *iq_data, size_t samples)
 			buffs[0] = rf->txbuf;
 			l = (samples > BUF_LEN ? BUF_LEN : samples);
 			
-			for(r = 0; r < 2 * l; r++)
-			{
-				rf->txbuf[r] = iq_data[r] * rf->scale / INT16_MAX;
-			}
+			rf->conv(rf->txbuf, iq_data, rf->scale, l);
 		}
 		else
 		{
@@ -188,6 +188,8 @@ int rf_soapysdr_open(rf_t *s, const char *device, unsigned int sample_rate, unsi
 		{
 			rf->scale = 0;
 		}
+		
+		rf->conv = iqconv_kernels(cpu_features())->scale;
 	}
 	
 #if defined(SOAPY_SDR_API_VERSION) && (SOAPY_SDR_API_VERSION >= 0x00080000)
@@ -0,0 +1,228 @@
+/* hacktv - Analogue video transmitter for the HackRF                    */
+/*=======================================================================*/
+/* Copyright 2023 Philip Heron <phil@sanslogic.co.uk>                    */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* (at your option) any later version.                                   */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+/* SECAM chrominance sub-carrier
+ * 
+ * The sub-carrier is FM modulated by the NCO, and then shaped by the
+ * "bell" filter. The bell filter's gain depends on the instantaneous
+ * frequency, so it's applied per sample from a short table.
+ * 
+ * Each SIMD version gives exactly the same result as the scalar
+ * version. The interpolation uses the same rounding multiply as
+ * pmulhrsw, and the bell gain never holds INT16_MIN.
+ * 
+ * There's no AVX2 version. The table loads are most of the work, and
+ * neither gathers nor wider vectors built from single loads were any
+ * faster than SSSE3.
+*/
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "common.h"
+#include "cpu.h"
+#include "nco.h"
+#include "secam.h"
+
+#ifdef CPU_X86
+#include <immintrin.h>
+#endif
+
+#define _FRAC_MASK ((1 << SECAM_BELL_SHIFT) - 1)
+
+/* Calculate the complex gain for the SECAM chrominance
+ * sub-carrier at f Hz (bell curve) */
+static void _secam_g(double *g, double f)
+{
+	const double f0 = 4.286e6;
+	double lq, rq, d;
+	
+	f = f / f0 - f0 / f;
+	
+	lq = 16.0 * f;
+	rq = 1.26 * f;
+	d = 1.0 + rq * rq;
+	
+	g[0] = 0.115 * (1.0 + lq * rq) / d;
+	g[1] = 0.115 * (lq - rq) / d;
+}
+
+int secam_bell_init(secam_bell_t *b, double frequency, double deviation, int16_t min, int16_t max, double level)
+{
+	double g[2];
+	int i, d;
+	
+	/* The offset into the table must fit in 16 bits */
+	if(max < min || max - min > INT16_MAX)
+	{
+		return(-1);
+	}
+	
+	b->base = min;
+	b->len = ((max - min) >> SECAM_BELL_SHIFT) + 2;
+	b->gain = malloc(sizeof(cint16_t) * b->len);
+	
+	if(!b->gain)
+	{
+		return(-1);
+	}
+	
+	for(i = 0; i < b->len; i++)
+	{
+		d = min + (i << SECAM_BELL_SHIFT);
+		
+		_secam_g(g, frequency + (double) d * deviation / INT16_MAX);
+		b->gain[i].i =  lround(g[0] * level * INT16_MAX);
+		b->gain[i].q = -lround(g[1] * level * INT16_MAX);
+	}
+	
+	return(0);
+}
+
+void secam_bell_free(secam_bell_t *b)
+{
+	free(b->gain);
+	b->gain = NULL;
+}
+
+/* -=== Scalar reference ===- */
+
+static inline int16_t _mulhrs(int16_t a, int16_t b)
+{
+	return((a * b + 0x4000) >> 15);
+}
+
+static inline int16_t _sat16(int32_t a)
+{
+	return(a > INT16_MAX ? INT16_MAX : (a < INT16_MIN ? INT16_MIN : a));
+}
+
+static void _mod_c(int16_t *o, const cint16_t *c, const int16_t *d, const int16_t *win, const secam_bell_t *bell, int n)
+{
+	const cint16_t *t = bell->gain;
+	const cint16_t *g;
+	int16_t u, f, gi, gq, v;
+	int x;
+	
+	for(x = 0; x < n; x++)
+	{
+		u = d[x] - bell->base;
+		g = &t[u >> SECAM_BELL_SHIFT];
+		f = (u & _FRAC_MASK) << (15 - SECAM_BELL_SHIFT);
+		
+		gi = g[0].i + _mulhrs(g[1].i - g[0].i, f);
+		gq = g[0].q + _mulhrs(g[1].q - g[0].q, f);
+		
+		v = _sat16((c[x].i * gi + c[x].q * gq) >> 15);
+		
+		o[x * 2] += (v * win[x]) >> 15;
+	}
+}
+
+const secam_kernels_t secam_scalar = {
+	"scalar", _mod_c
+};
+
+#ifdef CPU_X86
+
+/* -=== x86 SSSE3 ===- */
+
+static inline int32_t _load32(const cint16_t *p)
+{
+	int32_t v;
+	memcpy(&v, p, sizeof(v));
+	return(v);
+}
+
+__attribute__((target("ssse3")))
+static void _mod_ssse3(int16_t *o, const cint16_t *c, const int16_t *d, const int16_t *win, const secam_bell_t *bell, int n)
+{
+	const __m128i base = _mm_set1_epi16(bell->base);
+	const __m128i mask = _mm_set1_epi16(_FRAC_MASK);
+	const __m128i lo = _mm_set1_epi32(0xFFFF);
+	const __m128i zero = _mm_setzero_si128();
+	const cint16_t *t = bell->gain;
+	__m128i u, f, g, g1, v, r;
+	int x, k0, k1, k2, k3;
+	
+	for(x = 0; x + 4 <= n; x += 4)
+	{
+		/* There's no gather, the entries are loaded one at a time */
+		k0 = (uint16_t) (d[x + 0] - bell->base) >> SECAM_BELL_SHIFT;
+		k1 = (uint16_t) (d[x + 1] - bell->base) >> SECAM_BELL_SHIFT;
+		k2 = (uint16_t) (d[x + 2] - bell->base) >> SECAM_BELL_SHIFT;
+		k3 = (uint16_t) (d[x + 3] - bell->base) >> SECAM_BELL_SHIFT;
+		
+		g  = _mm_setr_epi32(_load32(&t[k0]), _load32(&t[k1]), _load32(&t[k2]), _load32(&t[k3]));
+		g1 = _mm_setr_epi32(_load32(&t[k0 + 1]), _load32(&t[k1 + 1]), _load32(&t[k2 + 1]), _load32(&t[k3 + 1]));
+		
+		u = _mm_sub_epi16(_mm_loadl_epi64((const __m128i *) &d[x]), base);
+		f = _mm_slli_epi16(_mm_and_si128(u, mask), 15 - SECAM_BELL_SHIFT);
+		f = _mm_unpacklo_epi16(f, f);
+		
+		g = _mm_add_epi16(g, _mm_mulhrs_epi16(_mm_sub_epi16(g1, g), f));
+		
+		v = _mm_srai_epi32(_mm_madd_epi16(_mm_loadu_si128((const __m128i *) &c[x]), g), 15);
+		v = _mm_unpacklo_epi16(_mm_packs_epi32(v, v), zero);
+		
+		/* The high half of each pair is zero, so pmaddwd is a plain multiply */
+		r = _mm_unpacklo_epi16(_mm_loadl_epi64((const __m128i *) &win[x]), zero);
+		r = _mm_srai_epi32(_mm_madd_epi16(v, r), 15);
+		
+		r = _mm_add_epi16(_mm_loadu_si128((const __m128i *) &o[x * 2]), _mm_and_si128(r, lo));
+		_mm_storeu_si128((__m128i *) &o[x * 2], r);
+	}
+	
+	_mod_c(&o[x * 2], &c[x], &d[x], &win[x], bell, n - x);
+}
+
+static const secam_kernels_t _secam_ssse3 = {
+	"ssse3", _mod_ssse3
+};
+
+#endif
+
+const secam_kernels_t *secam_kernels(int features)
+{
+#ifdef CPU_X86
+	if(features & CPU_SSSE3) return(&_secam_ssse3);
+#endif
+	
+	return(&secam_scalar);
+}
+
+void secam_modulate(const secam_kernels_t *k, nco_t *nco, const secam_bell_t *bell, int16_t *dst, const int16_t *src, const int16_t *win, int16_t dmin, int16_t dmax, int samples)
+{
+	cint16_t c[NCO_BLOCK];
+	int16_t d[NCO_BLOCK];
+	int i, n;
+	
+	for(; samples > 0; samples -= n, src += n, win += n, dst += n * 2)
+	{
+		n = samples < NCO_BLOCK ? samples : NCO_BLOCK;
+		
+		for(i = 0; i < n; i++)
+		{
+			d[i] = src[i] < dmin ? dmin : (src[i] > dmax ? dmax : src[i]);
+		}
+		
+		nco_fm(nco, c, d, 1, n);
+		k->mod(dst, c, d, win, bell, n);
+	}
+}
+
@@ -0,0 +1,68 @@
+/* hacktv - Analogue video transmitter for the HackRF                    */
+/*=======================================================================*/
+/* Copyright 2023 Philip Heron <phil@sanslogic.co.uk>                    */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* (at your option) any later version.                                   */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+#ifndef _SECAM_H
+#define _SECAM_H
+
+#include <stdint.h>
+#include "common.h"
+#include "nco.h"
+
+/* Log2 of the deviation between bell filter table entries */
+#define SECAM_BELL_SHIFT 7
+
+/* The complex gain of the bell filter, indexed by the FM deviation.
+ * Only the range the deviation is limited to is covered, with the
+ * gain between entries linearly interpolated. The Q part is stored
+ * negated, and both include the sub-carrier level */
+typedef struct {
+	int16_t base;
+	int len;
+	cint16_t *gain;
+} secam_bell_t;
+
+extern int secam_bell_init(secam_bell_t *b, double frequency, double deviation, int16_t min, int16_t max, double level);
+extern void secam_bell_free(secam_bell_t *b);
+
+/* Sub-carrier modulation: for each of the n samples, shape the FM
+ * carrier c with the bell gain g for deviation d[x], then add it to
+ * the I samples of o through the window:
+ * 
+ * v = sat16((c.i * g.i + c.q * g.q) >> 15)
+ * o[x * 2] += (v * win[x]) >> 15
+ * 
+ * d must already be limited to the range of the bell table */
+typedef void (*secam_mod_t)(int16_t *o, const cint16_t *c, const int16_t *d, const int16_t *win, const secam_bell_t *bell, int n);
+
+typedef struct {
+	const char *name;
+	secam_mod_t mod;
+} secam_kernels_t;
+
+/* The plain C version, used as the reference */
+extern const secam_kernels_t secam_scalar;
+
+/* Returns the fastest kernels for the CPU features given */
+extern const secam_kernels_t *secam_kernels(int features);
+
+/* Limit the deviation of the src samples to dmin..dmax, FM modulate
+ * them with nco, apply the bell filter and window, and add the result
+ * to the I samples of dst. The work is done in blocks of NCO_BLOCK */
+extern void secam_modulate(const secam_kernels_t *k, nco_t *nco, const secam_bell_t *bell, int16_t *dst, const int16_t *src, const int16_t *win, int16_t dmin, int16_t dmax, int samples);
+
+#endif
+
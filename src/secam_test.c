@@ -0,0 +1,196 @@
+/* hacktv - Analogue video transmitter for the HackRF                    */
+/*=======================================================================*/
+/* Copyright 2023 Philip Heron <phil@sanslogic.co.uk>                    */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* (at your option) any later version.                                   */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+/* Checks the SECAM sub-carrier modulator. Run with "make check".
+ * 
+ * Several lines are modulated in blocks by secam_modulate(), with the
+ * scalar kernels and with those selected for each CPU feature. Each
+ * line is compared with a reference made one sample at a time with
+ * the scalar kernels, which keeps its own phase accumulator in 64-bit
+ * arithmetic. The phase is reset at the start of every line the way
+ * video.c does it, so a block path that kept the phase from the last
+ * line would fail. The lines are of different lengths, most not a
+ * multiple of NCO_BLOCK or of the vector width.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "common.h"
+#include "cpu.h"
+#include "nco.h"
+#include "secam.h"
+
+/* The sub-carrier settings used by video.c for 625 line SECAM */
+#define _SAMPLE_RATE 13500000
+#define _FM_FREQ 4328125
+#define _FM_DEV 1000e3
+#define _LEVEL 0.25
+
+#define _LINES 8
+#define _MAX_SAMPLES 1100
+
+/* Features that can select a different backend */
+static const int _features[] = {
+	CPU_SSE2, CPU_SSSE3, CPU_AVX2, CPU_AVX512BW, 0
+};
+
+/* Deviation limits for the Db and Dr lines */
+static const int16_t _dmin[2] = { -14030, -14020 };
+static const int16_t _dmax[2] = {  14020,  14030 };
+
+static uint32_t _seed = 1;
+
+static int16_t _random(void)
+{
+	/* A simple LCG, the same sequence on every platform */
+	_seed = _seed * 1103515245 + 12345;
+	return(_seed >> 12);
+}
+
+static int _line_samples(int line)
+{
+	/* Odd lengths, shorter and longer than one NCO block */
+	return(line == 0 ? 1 : (line * 137 + 3) % _MAX_SAMPLES);
+}
+
+static uint32_t _line_phase(int line)
+{
+	/* As video.c resets it, alternating every third line */
+	return(line % 3 == 0 ? 0 : 1U << 31);
+}
+
+/* Modulate one line one sample at a time */
+static void _reference(int16_t *dst, const int16_t *src, const int16_t *win, const nco_t *nco, const secam_bell_t *bell, int line, int n)
+{
+	uint32_t phase = _line_phase(line);
+	int16_t d;
+	cint16_t c;
+	int x;
+	
+	for(x = 0; x < n; x++)
+	{
+		d = src[x] < _dmin[line & 1] ? _dmin[line & 1] : (src[x] > _dmax[line & 1] ? _dmax[line & 1] : src[x]);
+		
+		phase += nco->step + (uint32_t) (((int64_t) d * nco->deviation) >> 16);
+		
+		nco_scalar.cexp(&c, &phase, 1);
+		secam_scalar.mod(&dst[x * 2], &c, &d, &win[x], bell, 1);
+	}
+}
+
+static int _check(const secam_kernels_t *k, const nco_kernels_t *nk, const secam_bell_t *bell)
+{
+	static int16_t src[_MAX_SAMPLES];
+	static int16_t win[_MAX_SAMPLES];
+	static int16_t init[_MAX_SAMPLES * 2];
+	static int16_t ref[_MAX_SAMPLES * 2];
+	static int16_t out[_MAX_SAMPLES * 2];
+	nco_t nco;
+	int line, n, x;
+	int errors = 0;
+	
+	nco_init(&nco, _SAMPLE_RATE, _FM_FREQ, _FM_DEV);
+	nco.kernels = nk;
+	
+	for(line = 0; line < _LINES; line++)
+	{
+		n = _line_samples(line);
+		
+		/* The input goes past the deviation limits */
+		for(x = 0; x < _MAX_SAMPLES; x++)
+		{
+			src[x] = _random();
+			win[x] = _random() & INT16_MAX;
+			init[x * 2 + 0] = _random() >> 2;
+			init[x * 2 + 1] = _random() >> 2;
+		}
+		
+		memcpy(ref, init, sizeof(ref));
+		memcpy(out, init, sizeof(out));
+		
+		_reference(ref, src, win, &nco, bell, line, n);
+		
+		nco.phase = _line_phase(line);
+		secam_modulate(k, &nco, bell, out, src, win, _dmin[line & 1], _dmax[line & 1], n);
+		
+		if(memcmp(ref, out, sizeof(ref)) != 0)
+		{
+			for(x = 0; x < _MAX_SAMPLES * 2 && ref[x] == out[x]; x++);
+			fprintf(stderr, "%s/%s: line %d, %d samples: differs at sample %d\n", k->name, nk->name, line, n, x / 2);
+			errors++;
+		}
+	}
+	
+	return(errors);
+}
+
+int main(int argc, char *argv[])
+{
+	const secam_kernels_t *tested[sizeof(_features) / sizeof(int) + 1];
+	const nco_kernels_t *tested_nco[sizeof(_features) / sizeof(int) + 1];
+	const secam_kernels_t *k;
+	const nco_kernels_t *nk;
+	secam_bell_t bell;
+	int i, j, f, ntested = 0;
+	int errors, failed = 0;
+	
+	if(secam_bell_init(&bell, _FM_FREQ, _FM_DEV, -14030, 14030, _LEVEL) != 0)
+	{
+		fprintf(stderr, "secam_bell_init() failed\n");
+		return(1);
+	}
+	
+	/* The scalar block path is checked too */
+	for(i = -1; i < 0 || _features[i]; i++)
+	{
+		if(i < 0)
+		{
+			k = &secam_scalar;
+			nk = &nco_scalar;
+		}
+		else
+		{
+			if((cpu_features() & _features[i]) == 0) continue;
+			
+			/* This feature and those below it, as
+			 * video.c would select them */
+			f = cpu_features() & ((_features[i] << 1) - 1);
+			k = secam_kernels(f);
+			nk = nco_kernels(f);
+		}
+		
+		/* Some features share both backends */
+		for(j = 0; j < ntested && (tested[j] != k || tested_nco[j] != nk); j++);
+		if(j < ntested) continue;
+		
+		tested[ntested] = k;
+		tested_nco[ntested++] = nk;
+		
+		errors = _check(k, nk, &bell);
+		
+		printf("secam %s with nco %s: %s\n", k->name, nk->name, errors ? "FAILED" : "OK");
+		
+		if(errors) failed = 1;
+	}
+	
+	secam_bell_free(&bell);
+	
+	return(failed);
+}
+
@@ -0,0 +1,248 @@
+/* hacktv - Analogue video transmitter for the HackRF                    */
+/*=======================================================================*/
+/* Copyright 2023 Philip Heron <phil@sanslogic.co.uk>                    */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* (at your option) any later version.                                   */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+/* SigMF metadata for file output
+ * 
+ * The metadata is written alongside the data as <name>.sigmf-meta,
+ * or with the extension replaced if the data is <name>.sigmf-data.
+ * Each frame gets an annotation giving its first sample and length,
+ * so a reader can seek straight to a frame.
+ * 
+ * The video timing is recorded in the global object under the
+ * optional "hacktv" extension namespace.
+*/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <time.h>
+#include "common.h"
+#include "rf.h"
+#include "video.h"
+#include "sigmf.h"
+
+static const char *_datatypes[] = {
+	[RF_UINT8]  = "u8",
+	[RF_INT8]   = "i8",
+	[RF_UINT16] = "u16",
+	[RF_INT16]  = "i16",
+	[RF_INT32]  = "i32",
+	[RF_FLOAT]  = "f32",
+};
+
+static char *_meta_filename(const char *filename)
+{
+	const char *ext = ".sigmf-data";
+	size_t l = strlen(filename);
+	char *s;
+	
+	s = malloc(l + 12);
+	if(!s)
+	{
+		return(NULL);
+	}
+	
+	strcpy(s, filename);
+	
+	if(l > strlen(ext) && strcmp(&s[l - strlen(ext)], ext) == 0)
+	{
+		l -= strlen(ext);
+	}
+	
+	strcpy(&s[l], ".sigmf-meta");
+	
+	return(s);
+}
+
+static void _annotation(sigmf_t *s, uint64_t end)
+{
+	fprintf(s->f,
+		"%s\n    {\n"
+		"      \"core:sample_start\": %" PRIu64 ",\n"
+		"      \"core:sample_count\": %" PRIu64 ",\n"
+		"      \"core:label\": \"frame %" PRIu32 "\"\n"
+		"    }",
+		s->nannotations > 0 ? "," : "",
+		s->frame_start,
+		end - s->frame_start,
+		s->frame
+	);
+	
+	s->nannotations++;
+}
+
+int sigmf_open(sigmf_t *s, const char *filename, const char *mode, int type, int complex, const vid_t *vid, uint64_t frequency)
+{
+	const vid_configs_t *vc;
+	const char *dataset;
+	char *meta;
+	char datetime[32];
+	time_t t;
+	int le = 1;
+	
+	memset(s, 0, sizeof(sigmf_t));
+	
+	if(strcmp(filename, "-") == 0)
+	{
+		fprintf(stderr, "SigMF metadata needs a regular file for output.\n");
+		return(-1);
+	}
+	
+	meta = _meta_filename(filename);
+	if(!meta)
+	{
+		perror("malloc");
+		return(-1);
+	}
+	
+	s->f = fopen(meta, "w");
+	
+	if(!s->f)
+	{
+		perror(meta);
+		free(meta);
+		return(-1);
+	}
+	
+	free(meta);
+	
+	for(vc = vid_configs; vc->id != NULL; vc++)
+	{
+		if(strcmp(mode, vc->id) == 0) break;
+	}
+	
+	t = time(NULL);
+	strftime(datetime, sizeof(datetime), "%Y-%m-%dT%H:%M:%SZ", gmtime(&t));
+	
+	fprintf(s->f,
+		"{\n"
+		"  \"global\": {\n"
+		"    \"core:datatype\": \"%c%s%s\",\n"
+		"    \"core:sample_rate\": %d,\n"
+		"    \"core:version\": \"1.0.0\",\n"
+		"    \"core:num_channels\": 1,\n"
+		"    \"core:recorder\": \"hacktv %s\",\n",
+		complex ? 'c' : 'r',
+		_datatypes[type],
+		type == RF_UINT8 || type == RF_INT8 ? "" : (*(uint8_t *) &le ? "_le" : "_be"),
+		vid->sample_rate,
+		VERSION
+	);
+	
+	if(vc->id && vc->desc)
+	{
+		fputs("    \"core:description\": \"", s->f);
+		fputs_json(vc->desc, s->f);
+		fputs("\",\n", s->f);
+	}
+	
+	/* Name the data file if it doesn't follow the SigMF naming */
+	if(strlen(filename) <= 11 || strcmp(&filename[strlen(filename) - 11], ".sigmf-data") != 0)
+	{
+		dataset = strrchr(filename, '/');
+		dataset = dataset ? dataset + 1 : filename;
+		
+		fputs("    \"core:dataset\": \"", s->f);
+		fputs_json(dataset, s->f);
+		fputs("\",\n", s->f);
+	}
+	
+	fputs(
+		"    \"core:extensions\": [\n"
+		"      { \"name\": \"hacktv\", \"version\": \"1.0.0\", \"optional\": true }\n"
+		"    ],\n"
+		"    \"hacktv:mode\": \"", s->f
+	);
+	fputs_json(mode, s->f);
+	fprintf(s->f,
+		"\",\n"
+		"    \"hacktv:lines\": %d,\n"
+		"    \"hacktv:frame_rate\": %.9g\n"
+		"  },\n"
+		"  \"captures\": [\n"
+		"    {\n"
+		"      \"core:sample_start\": 0,\n",
+		vid->conf.lines,
+		(double) vid->conf.frame_rate.num / vid->conf.frame_rate.den
+	);
+	
+	if(frequency > 0)
+	{
+		fprintf(s->f, "      \"core:frequency\": %" PRIu64 ",\n", frequency);
+	}
+	
+	fprintf(s->f,
+		"      \"core:datetime\": \"%s\"\n"
+		"    }\n"
+		"  ],\n"
+		"  \"annotations\": [",
+		datetime
+	);
+	
+	return(0);
+}
+
+void sigmf_block(sigmf_t *s, const vid_t *vid, size_t samples)
+{
+	int i;
+	
+	if(s->f == NULL)
+	{
+		return;
+	}
+	
+	for(i = 0; i < vid->nframe_starts; i++)
+	{
+		/* The previous frame ends where this one starts */
+		if(s->pending)
+		{
+			_annotation(s, s->samples + vid->frame_starts[i].offset);
+		}
+		
+		s->frame_start = s->samples + vid->frame_starts[i].offset;
+		s->frame = vid->frame_starts[i].frame;
+		s->pending = 1;
+	}
+	
+	s->samples += samples;
+}
+
+int sigmf_close(sigmf_t *s)
+{
+	int r;
+	
+	if(s->f == NULL)
+	{
+		return(0);
+	}
+	
+	/* The last frame may be incomplete */
+	if(s->pending && s->samples > s->frame_start)
+	{
+		_annotation(s, s->samples);
+	}
+	
+	fprintf(s->f, "%s]\n}\n", s->nannotations > 0 ? "\n  " : "");
+	
+	r = fclose(s->f);
+	s->f = NULL;
+	
+	return(r == 0 ? 0 : -1);
+}
+
@@ -0,0 +1,48 @@
+/* hacktv - Analogue video transmitter for the HackRF                    */
+/*=======================================================================*/
+/* Copyright 2023 Philip Heron <phil@sanslogic.co.uk>                    */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* (at your option) any later version.                                   */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+#ifndef _SIGMF_H
+#define _SIGMF_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include "video.h"
+
+typedef struct {
+	FILE *f;
+	uint64_t samples;	/* Samples written so far */
+	int nannotations;
+	
+	/* The frame waiting for its length */
+	int pending;
+	uint64_t frame_start;
+	uint32_t frame;
+	
+} sigmf_t;
+
+/* Write a SigMF metadata file for the recording in filename. The
+ * annotations are added as the output is written, the file is only
+ * complete once sigmf_close() is called */
+extern int sigmf_open(sigmf_t *s, const char *filename, const char *mode, int type, int complex, const vid_t *vid, uint64_t frequency);
+
+/* Record a block returned by vid_next_block() */
+extern void sigmf_block(sigmf_t *s, const vid_t *vid, size_t samples);
+
+extern int sigmf_close(sigmf_t *s);
+
+#endif
+
@@ -23,7 +23,12 @@
 #include "dance.h"
 #include "hacktv.h"
 #include <sys/time.h>
+#include <unistd.h>
+#ifndef WIN32
+#include <sys/mman.h>
+#endif
 #include "av.h"
+#include "cpu.h"
 
 /* 
  * Video generation
@@ -2307,28 +2312,248 @@ const static double fm_audio_j17_taps[65] = {
 	-0.000175,-0.000119
 };
 
-/* Calculate the complex gain for the SECAM chrominance
- * sub-carrier at f Hz (bell curve) */
-static void _secam_g(double *g, double f)
+static double _dlimit(double v, double min, double max)
+{
+	if(v < min) return(min);
+	if(v > max) return(max);
+	return(v);
+}
+
+/* -=== Table generation ===- */
+
+typedef void (*_table_fn_t)(void *arg, int start, int end);
+
+typedef struct {
+	_table_fn_t fn;
+	void *arg;
+	int start;
+	int end;
+} _table_job_t;
+
+static void *_table_thread(void *arg)
+{
+	_table_job_t *job = arg;
+	
+	job->fn(job->arg, job->start, job->end);
+	
+	return(NULL);
+}
+
+/* Call fn over the range [start, end) split across the available
+ * CPUs. Falls back to the calling thread if threads can't be created */
+static void _table_parallel(_table_fn_t fn, void *arg, int start, int end)
 {
-	const double f0 = 4.286e6;
-	double lq, rq, d;
+	_table_job_t job[16];
+	pthread_t thread[16];
+	long ncpu;
+	int i, n, len, started;
+	
+	#ifdef _SC_NPROCESSORS_ONLN
+	ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+	#else
+	ncpu = 1;
+	#endif
+	n = ncpu < 1 ? 1 : (ncpu > 16 ? 16 : ncpu);
+	len = (end - start + n - 1) / n;
+	
+	for(i = 0; i < n; i++)
+	{
+		job[i].fn = fn;
+		job[i].arg = arg;
+		job[i].start = start + len * i;
+		job[i].end = job[i].start + len;
+		
+		if(job[i].start > end) job[i].start = end;
+		if(job[i].end > end) job[i].end = end;
+	}
+	
+	/* Job 0 runs on this thread */
+	for(i = 1; i < n; i++)
+	{
+		if(pthread_create(&thread[i], NULL, &_table_thread, &job[i]) != 0)
+		{
+			break;
+		}
+	}
 	
-	f = f / f0 - f0 / f;
+	started = i;
 	
-	lq = 16.0 * f;
-	rq = 1.26 * f;
-	d = 1.0 + rq * rq;
+	fn(arg, job[0].start, job[0].end);
 	
-	g[0] = 0.115 * (1.0 + lq * rq) / d;
-	g[1] = 0.115 * (lq - rq) / d;
+	/* Any jobs that didn't get a thread also run here */
+	for(i = started; i < n; i++)
+	{
+		fn(arg, job[i].start, job[i].end);
+	}
+	
+	for(i = 1; i < started; i++)
+	{
+		pthread_join(thread[i], NULL);
+	}
 }
 
-static double _dlimit(double v, double min, double max)
+/* -=== Colour conversion ===- */
+
+/* The full lookup table holds the signal levels for every 24-bit RGB
+ * value (96 MiB). The compact version splits the conversion into one
+ * table per channel, each holding that channel's gamma corrected
+ * contribution to Y, I and Q in fixed point. The composite yiq kernel
+ * adds the three and rounds them for each pixel. The result can differ
+ * from the full table by at most +/-1, when the exact level falls
+ * within a rounding error of a half step. */
+
+static void _rgb_to_yiq_levels(vid_t *s, double level, double r, double g, double b, double yiq[3])
 {
-	if(v < min) return(min);
-	if(v > max) return(max);
-	return(v);
+	double y, u, v;
+	double i, q;
+	
+	/* Calculate Y, Cb and Cr values */
+	y = r * s->conf.rw_co
+	  + g * s->conf.gw_co
+	  + b * s->conf.bw_co;
+	u = (b - y);
+	v = (r - y);
+	
+	i = s->conf.eu_co * u;
+	q = s->conf.ev_co * v;
+	
+	/* Adjust values to correct signal level */
+	y = (s->conf.black_level + (y * (s->conf.white_level - s->conf.black_level))) * level;
+	
+	if(s->conf.colour_mode != VID_SECAM)
+	{
+		i *= (s->conf.white_level - s->conf.black_level) * level;
+		q *= (s->conf.white_level - s->conf.black_level) * level;
+	}
+	else
+	{
+		i = (i + SECAM_CB_FREQ - SECAM_FM_FREQ) / SECAM_FM_DEV;
+		q = (q + SECAM_CR_FREQ - SECAM_FM_FREQ) / SECAM_FM_DEV;
+	}
+	
+	yiq[0] = y;
+	yiq[1] = i;
+	yiq[2] = q;
+}
+
+typedef struct {
+	vid_t *s;
+	double level;
+	const double *glut;
+} _yiq_lookup_job_t;
+
+static void _yiq_lookup_range(void *arg, int start, int end)
+{
+	_yiq_lookup_job_t *job = arg;
+	vid_t *s = job->s;
+	double yiq[3];
+	int c;
+	
+	for(c = start; c < end; c++)
+	{
+		_rgb_to_yiq_levels(s, job->level,
+			job->glut[(c & 0xFF0000) >> 16],
+			job->glut[(c & 0x00FF00) >> 8],
+			job->glut[(c & 0x0000FF) >> 0],
+			yiq
+		);
+		
+		/* Convert to INT16 range and store in tables */
+		s->yiq_level_lookup[c].y = round(_dlimit(yiq[0], -1, 1) * INT16_MAX);
+		s->yiq_level_lookup[c].i = round(_dlimit(yiq[1], -1, 1) * INT16_MAX);
+		s->yiq_level_lookup[c].q = round(_dlimit(yiq[2], -1, 1) * INT16_MAX);
+	}
+}
+
+static int _init_yiq_lookup(vid_t *s, double level, const double glut[0x100])
+{
+	_yiq_lookup_job_t job = { s, level, glut };
+	
+	/* Allocate memory for YUV lookup tables */
+	s->yiq_level_lookup = malloc(0x1000000 * sizeof(_yiq16_t));
+	if(s->yiq_level_lookup == NULL)
+	{
+		return(VID_OUT_OF_MEMORY);
+	}
+	
+	/* Generate the RGB > signal level lookup tables */
+	_table_parallel(_yiq_lookup_range, &job, 0x000000, 0x1000000);
+	
+	return(VID_OK);
+}
+
+static int _init_yiq_channel_lookup(vid_t *s, double level, const double glut[0x100])
+{
+	double yiq[3], zero[3];
+	double rgb[3];
+	_yiq32_t *l;
+	int ch, c;
+	
+	s->yiq_channel_lookup = malloc(3 * 0x100 * sizeof(_yiq32_t));
+	if(s->yiq_channel_lookup == NULL)
+	{
+		return(VID_OUT_OF_MEMORY);
+	}
+	
+	/* The conversion is linear after gamma correction, so each channel
+	 * can be done on its own. The constant part goes in the red table */
+	_rgb_to_yiq_levels(s, level, 0, 0, 0, zero);
+	
+	for(ch = 0; ch < 3; ch++)
+	{
+		for(c = 0; c < 0x100; c++)
+		{
+			rgb[0] = rgb[1] = rgb[2] = 0;
+			rgb[ch] = glut[c];
+			
+			_rgb_to_yiq_levels(s, level, rgb[0], rgb[1], rgb[2], yiq);
+			
+			if(ch > 0)
+			{
+				yiq[0] -= zero[0];
+				yiq[1] -= zero[1];
+				yiq[2] -= zero[2];
+			}
+			
+			l = &s->yiq_channel_lookup[ch * 0x100 + c];
+			l->y = lround(yiq[0] * INT16_MAX * (1 << COMPOSITE_YIQ_SHIFT));
+			l->i = lround(yiq[1] * INT16_MAX * (1 << COMPOSITE_YIQ_SHIFT));
+			l->q = lround(yiq[2] * INT16_MAX * (1 << COMPOSITE_YIQ_SHIFT));
+		}
+	}
+	
+	return(VID_OK);
+}
+
+_yiq16_t vid_rgb_to_yiq(vid_t *s, uint32_t rgb)
+{
+	if(s->yiq_level_lookup)
+	{
+		return(s->yiq_level_lookup[rgb & 0xFFFFFF]);
+	}
+	
+	_yiq16_t yiq;
+	
+	composite_scalar.yiq(&yiq.y, &rgb, 1, (const int32_t *) s->yiq_channel_lookup, 1);
+	
+	return(yiq);
+}
+
+void vid_rgb_to_yiq_line(vid_t *s, _yiq16_t *yiq, const uint32_t *rgb, int stride, int n)
+{
+	int x;
+	
+	if(s->yiq_level_lookup)
+	{
+		for(x = 0; x < n; x++, rgb += stride)
+		{
+			yiq[x] = s->yiq_level_lookup[*rgb & 0xFFFFFF];
+		}
+		
+		return;
+	}
+	
+	s->composite->yiq(&yiq->y, rgb, stride, (const int32_t *) s->yiq_channel_lookup, n);
 }
 
 static int16_t *_burstwin(unsigned int sample_rate, double width, double rise, double level, int *len)
@@ -2355,29 +2580,11 @@ static int16_t *_burstwin(unsigned int sample_rate, double width, double rise, d
 
 /* FM modulator
  * deviation = peak deviation in Hz (+/-) from frequency */
-static int _init_fm_modulator(_mod_fm_t *fm, int sample_rate, double frequency, double deviation, double level)
+static int _init_fm_modulator(vid_t *s, _mod_fm_t *fm, int sample_rate, double frequency, double deviation, double level)
 {
-	int r;
-	double d;
-	
-	fm->level   = round(INT16_MAX * level);
-	fm->counter = INT16_MAX;
-	fm->phase.i = INT32_MAX;
-	fm->phase.q = 0;
-	fm->lut     = malloc(sizeof(cint32_t) * (UINT16_MAX + 1));
+	fm->level = round(INT16_MAX * level);
 	
-	if(!fm->lut)
-	{
-		return(VID_OUT_OF_MEMORY);
-	}
-	
-	for(r = INT16_MIN; r <= INT16_MAX; r++)
-	{
-		d = 2.0 * M_PI / sample_rate * (frequency + (double) r / INT16_MAX * deviation);
-		
-		fm->lut[r - INT16_MIN].i = lround(cos(d) * INT32_MAX);
-		fm->lut[r - INT16_MIN].q = lround(sin(d) * INT32_MAX);
-	}
+	nco_init(&fm->nco, sample_rate, frequency, deviation);
 	
 	return(VID_OK);
 }
@@ -2396,124 +2603,101 @@ static int _init_fm_energy_dispersal(_mod_fm_t *fm, int sample_rate, rational_t
 	return(VID_OK);
 }
 
-static void inline _fm_modulator_add(_mod_fm_t *fm, int16_t *dst, int16_t sample)
+static void _fm_modulator_add(_mod_fm_t *fm, int16_t *dst, const int16_t *src, int samples)
 {
-	cint32_mul(&fm->phase, &fm->phase, &fm->lut[sample - INT16_MIN]);
-	
-	dst[0] += ((fm->phase.i >> 16) * fm->level) >> 15;
-	dst[1] += ((fm->phase.q >> 16) * fm->level) >> 15;
+	cint16_t c[NCO_BLOCK];
+	int i, n;
 	
-	/* Correct the amplitude after INT16_MAX samples */
-	if(--fm->counter == 0)
+	for(; samples > 0; samples -= n, src += n, dst += n * 2)
 	{
-		double ra = atan2(fm->phase.q, fm->phase.i);
+		n = samples < NCO_BLOCK ? samples : NCO_BLOCK;
 		
-		fm->phase.i = lround(cos(ra) * INT32_MAX);
-		fm->phase.q = lround(sin(ra) * INT32_MAX);
+		nco_fm(&fm->nco, c, src, 1, n);
 		
-		fm->counter = INT16_MAX;
+		for(i = 0; i < n; i++)
+		{
+			dst[i * 2 + 0] += (c[i].i * fm->level) >> 15;
+			dst[i * 2 + 1] += (c[i].q * fm->level) >> 15;
+		}
 	}
 }
 
-static void inline _fm_modulator_cgain(_mod_fm_t *fm, int16_t *dst, int16_t sample, const cint16_t *g)
+static void _fm_modulator(_mod_fm_t *fm, int16_t *dst, int samples)
 {
-	/* Only used by SECAM */
-	
-	cint32_mul(&fm->phase, &fm->phase, &fm->lut[sample - INT16_MIN]);
-	
-	dst[0] = (((((fm->phase.i >> 16) * fm->level) >> 15) * g->i) >> 15)
-	       - (((((fm->phase.q >> 16) * fm->level) >> 15) * g->q) >> 15);
+	/* Modulates the I samples of dst in place */
+	cint16_t c[NCO_BLOCK];
+	int i, n;
 	
-	/* Correct the amplitude after INT16_MAX samples */
-	if(--fm->counter == 0)
-	{
-		double ra = atan2(fm->phase.q, fm->phase.i);
-		
-		fm->phase.i = lround(cos(ra) * INT32_MAX);
-		fm->phase.q = lround(sin(ra) * INT32_MAX);
-		
-		fm->counter = INT16_MAX;
-	}
-}
-
-static void inline _fm_modulator(_mod_fm_t *fm, int16_t *dst, int16_t sample)
-{
 	if(fm->ed_overflow.quot != 0)
 	{
-		sample += abs(fm->ed_counter.quot + -fm->ed_overflow.quot / 2) - fm->ed_overflow.quot / 4;
-		
-		fm->ed_counter.quot += fm->ed_delta.quot;
-		fm->ed_counter.rem  += fm->ed_delta.rem;
-		
-		if(fm->ed_counter.rem >= fm->ed_overflow.rem)
-		{
-			fm->ed_counter.quot++;
-			fm->ed_counter.rem -= fm->ed_overflow.rem;
-		}
-		
-		if(fm->ed_counter.quot >= fm->ed_overflow.quot)
+		for(i = 0; i < samples; i++)
 		{
-			fm->ed_counter.quot -= fm->ed_overflow.quot;
+			dst[i * 2] += abs(fm->ed_counter.quot + -fm->ed_overflow.quot / 2) - fm->ed_overflow.quot / 4;
+			
+			fm->ed_counter.quot += fm->ed_delta.quot;
+			fm->ed_counter.rem  += fm->ed_delta.rem;
+			
+			if(fm->ed_counter.rem >= fm->ed_overflow.rem)
+			{
+				fm->ed_counter.quot++;
+				fm->ed_counter.rem -= fm->ed_overflow.rem;
+			}
+			
+			if(fm->ed_counter.quot >= fm->ed_overflow.quot)
+			{
+				fm->ed_counter.quot -= fm->ed_overflow.quot;
+			}
 		}
 	}
 	
-	cint32_mul(&fm->phase, &fm->phase, &fm->lut[sample - INT16_MIN]);
-	
-	dst[0] = ((fm->phase.i >> 16) * fm->level) >> 15;
-	dst[1] = ((fm->phase.q >> 16) * fm->level) >> 15;
-	
-	/* Correct the amplitude after INT16_MAX samples */
-	if(--fm->counter == 0)
+	for(; samples > 0; samples -= n, dst += n * 2)
 	{
-		double ra = atan2(fm->phase.q, fm->phase.i);
+		n = samples < NCO_BLOCK ? samples : NCO_BLOCK;
 		
-		fm->phase.i = lround(cos(ra) * INT32_MAX);
-		fm->phase.q = lround(sin(ra) * INT32_MAX);
+		nco_fm(&fm->nco, c, dst, 2, n);
 		
-		fm->counter = INT16_MAX;
+		for(i = 0; i < n; i++)
+		{
+			dst[i * 2 + 0] = (c[i].i * fm->level) >> 15;
+			dst[i * 2 + 1] = (c[i].q * fm->level) >> 15;
+		}
 	}
 }
 
 static void _free_fm_modulator(_mod_fm_t *fm)
 {
-	free(fm->lut);
+	/* Nothing */
 }
 
 /* AM modulator */
 static int _init_am_modulator(_mod_am_t *am, int sample_rate, double frequency, double level)
 {
-	double d;
-	
-	am->level   = round(INT16_MAX * level);
-	am->counter = INT16_MAX;
-	am->phase.i = INT32_MAX;
-	am->phase.q = 0;
+	am->level = round(INT16_MAX * level);
 	
-	d = 2.0 * M_PI / sample_rate * frequency;
-	am->delta.i = lround(cos(d) * INT32_MAX);
-	am->delta.q = lround(sin(d) * INT32_MAX);
+	nco_init(&am->nco, sample_rate, frequency, 0);
 	
 	return(VID_OK);
 }
 
-static void inline _am_modulator_add(_mod_am_t *am, int16_t *dst, int16_t sample)
+static void _am_modulator_add(_mod_am_t *am, int16_t *dst, const int16_t *src, int step, int samples)
 {
-	cint32_mul(&am->phase, &am->phase, &am->delta);
-	
-	sample = ((int32_t) sample - INT16_MIN) / 2;
-	
-	dst[0] += ((((am->phase.i >> 16) * sample) >> 15) * am->level) >> 15;
-	dst[1] += ((((am->phase.q >> 16) * sample) >> 15) * am->level) >> 15;
+	cint16_t c[NCO_BLOCK];
+	int32_t sample;
+	int i, n;
 	
-	/* Correct the amplitude after INT16_MAX samples */
-	if(--am->counter == 0)
+	for(; samples > 0; samples -= n, src += n * step, dst += n * 2)
 	{
-		double ra = atan2(am->phase.q, am->phase.i);
+		n = samples < NCO_BLOCK ? samples : NCO_BLOCK;
 		
-		am->phase.i = lround(cos(ra) * INT32_MAX);
-		am->phase.q = lround(sin(ra) * INT32_MAX);
+		nco_tone(&am->nco, c, n);
 		
-		am->counter = INT16_MAX;
+		for(i = 0; i < n; i++)
+		{
+			sample = ((int32_t) src[i * step] - INT16_MIN) / 2;
+			
+			dst[i * 2 + 0] += (((c[i].i * sample) >> 15) * am->level) >> 15;
+			dst[i * 2 + 1] += (((c[i].q * sample) >> 15) * am->level) >> 15;
+		}
 	}
 }
 
@@ -2583,447 +2767,379 @@ static int _vid_next_line_rawbb(vid_t *s, void *arg, int nlines, vid_line_t **li
 	return(1);
 }
 
-static int _vid_next_line_raster(vid_t *s, void *arg, int nlines, vid_line_t **lines)
-{
+/* Raster definitions
+ * 
+ * Each line is described by a sequence code: abcd
+ * 
+ * a: first sync
+ *    h = horizontal sync pulse
+ *    v = short vertical sync pulse
+ *    V = long vertical sync pulse
+ *    _ = no sync pulse
+ * 
+ * b: colour burst
+ *    0 = line always has a colour burst
+ *    _ = line never has a colour burst
+ *    1 = line has a colour burst on odd frames
+ *    2 = line has a colour burst on even frames
+ * 
+ * c: left content
+ *    _ = blanking
+ *    a = active video
+ * 
+ * d: right content
+ *    _ = blanking
+ *    a = active video
+ *    v = short vertical sync pulse
+ *    V = long vertical sync pulse
+ * 
+ * Lines not covered by a range use the default sequence. These are
+ * decoded into a _vid_raster_line_t per line by _init_raster().
+*/
+
+typedef struct {
+	int first;
+	int last;
 	const char *seq;
-	int x;
-	int vy;
-	int pal = 0;
-	int fsc = 0;
-	uint8_t sc = 0;
-	int al, ar;
-	vid_line_t *l = lines[1];
-	
-	l->width    = s->width;
-	l->frame    = s->bframe;
-	l->line     = s->bline;
-	l->vbialloc = 0;
-	l->lut      = NULL;
-	
-	/* Sequence codes: abcd
-	 * 
-	 * a: first sync
-	 *    h = horizontal sync pulse
-	 *    v = short vertical sync pulse
-	 *    V = long vertical sync pulse
-	 *    _ = no sync pulse
-	 * 
-	 * b: colour burst
-	 *    0 = line always has a colour burst
-	 *    _ = line never has a colour burst
-	 *    1 = line has a colour burst on odd frames
-	 *    2 = line has a colour burst on even frames
-	 * 
-	 * c: left content
-	 *    _ = blanking
-	 *    a = active video
-	 * 
-	 * d: right content
-	 *    _ = blanking
-	 *    a = active video
-	 *    v = short vertical sync pulse
-	 *    V = long vertical sync pulse
-	 * 
-	 **** I don't like this code, it's overly complicated for all it does.
-	*/
-	
-	vy = -1;
-	seq = "____";
-	
-	if(s->conf.type == VID_RASTER_625)
-	{
-		switch(l->line)
-		{
-		case 1:   seq = "V__V"; break;
-		case 2:   seq = "V__V"; break;
-		case 3:   seq = "V__v"; break;
-		case 4:   seq = "v__v"; break;
-		case 5:   seq = "v__v"; break;
-		case 6:   seq = "h1__"; break;
-		case 7:   seq = "h0__"; break;
-		case 8:   seq = "h0__"; break;
-		case 9:   seq = "h0__"; break;
-		case 10:  seq = "h0__"; break;
-		case 11:  seq = "h0__"; break;
-		case 12:  seq = "h0__"; break;
-		case 13:  seq = "h0__"; break;
-		case 14:  seq = "h0__"; break;
-		case 15:  seq = "h0__"; break;
-		case 16:  seq = "h0__"; break;
-		case 17:  seq = "h0__"; break;
-		case 18:  seq = "h0__"; break;
-		case 19:  seq = "h0__"; break;
-		case 20:  seq = "h0__"; break;
-		case 21:  seq = "h0__"; break;
-		case 22:  seq = "h0__"; break;
-		case 23:  seq = "h0_a"; break;
-		
-		case 310: seq = "h1aa"; break;
-		case 311: seq = "v__v"; break;
-		case 312: seq = "v__v"; break;
-		case 313: seq = "v__V"; break;
-		case 314: seq = "V__V"; break;
-		case 315: seq = "V__V"; break;
-		case 316: seq = "v__v"; break;
-		case 317: seq = "v__v"; break;
-		case 318: seq = "v___"; break;
-		case 319: seq = "h2__"; break;
-		case 320: seq = "h0__"; break;
-		case 321: seq = "h0__"; break;
-		case 322: seq = "h0__"; break;
-		case 323: seq = "h0__"; break;
-		case 324: seq = "h0__"; break;
-		case 325: seq = "h0__"; break;
-		case 326: seq = "h0__"; break;
-		case 327: seq = "h0__"; break;
-		case 328: seq = "h0__"; break;
-		case 329: seq = "h0__"; break;
-		case 330: seq = "h0__"; break;
-		case 331: seq = "h0__"; break;
-		case 332: seq = "h0__"; break;
-		case 333: seq = "h0__"; break;
-		case 334: seq = "h0__"; break;
-		case 335: seq = "h0__"; break;
-		
-		case 622: seq = "h1aa"; break;
-		case 623: seq = "h_av"; break;
-		case 624: seq = "v__v"; break;
-		case 625: seq = "v__v"; break;
-		
-		default:  seq = "h0aa"; break;
-		}
-		
-		/* Calculate the active line number */
-		vy = (l->line < 313 ? (l->line - 23) * 2 : (l->line - 336) * 2 + 1);
-	}
-	else if(s->conf.type == VID_RASTER_525)
-	{
-		switch(l->line)
-		{
-		case 1:   seq = "v__v"; break;
-		case 2:   seq = "v__v"; break;
-		case 3:   seq = "v__v"; break;
-		case 4:   seq = "V__V"; break;
-		case 5:   seq = "V__V"; break;
-		case 6:   seq = "V__V"; break;
-		case 7:   seq = "v__v"; break;
-		case 8:   seq = "v__v"; break;
-		case 9:   seq = "v__v"; break;
-		case 10:  seq = "h0__"; break;
-		case 11:  seq = "h0__"; break;
-		case 12:  seq = "h0__"; break;
-		case 13:  seq = "h0__"; break;
-		case 14:  seq = "h0__"; break;
-		case 15:  seq = "h0__"; break;
-		case 16:  seq = "h0__"; break;
-		case 17:  seq = "h0__"; break;
-		case 18:  seq = "h0__"; break;
-		case 19:  seq = "h0__"; break;
-		case 20:  seq = "h0__"; break;
-		
-		case 263: seq = "h0av"; break;
-		case 264: seq = "v__v"; break;
-		case 265: seq = "v__v"; break;
-		case 266: seq = "v__V"; break;
-		case 267: seq = "V__V"; break;
-		case 268: seq = "V__V"; break;
-		case 269: seq = "V__v"; break;
-		case 270: seq = "v__v"; break;
-		case 271: seq = "v__v"; break;
-		case 272: seq = "v___"; break;
-		case 273: seq = "h0__"; break;
-		case 274: seq = "h0__"; break;
-		case 275: seq = "h0__"; break;
-		case 276: seq = "h0__"; break;
-		case 277: seq = "h0__"; break;
-		case 278: seq = "h0__"; break;
-		case 279: seq = "h0__"; break;
-		case 280: seq = "h0__"; break;
-		case 281: seq = "h0__"; break;
-		case 282: seq = "h0__"; break;
-		case 283: seq = "h0_a"; break;
-		
-		default:  seq = "h0aa"; break;
-		}
-		
-		/* Calculate the active line number */
-		
+} _raster_range_t;
+
+typedef struct {
+	int type;
+	const char *seq; /* Default sequence */
+	int field2; /* First line of the second field, 0 if progressive */
+	int top[2]; /* First active line of each field */
+	int bounded; /* Limit the active line number to conf.active_lines */
+	_raster_range_t ranges[20];
+} _raster_def_t;
+
+static const _raster_def_t _raster_defs[] = {
+	{
+		VID_RASTER_625, "h0aa", 313, { 23, 336 }, 0,
+		{
+			{   1,   2, "V__V" },
+			{   3,   3, "V__v" },
+			{   4,   5, "v__v" },
+			{   6,   6, "h1__" },
+			{   7,  22, "h0__" },
+			{  23,  23, "h0_a" },
+			{ 310, 310, "h1aa" },
+			{ 311, 312, "v__v" },
+			{ 313, 313, "v__V" },
+			{ 314, 315, "V__V" },
+			{ 316, 317, "v__v" },
+			{ 318, 318, "v___" },
+			{ 319, 319, "h2__" },
+			{ 320, 335, "h0__" },
+			{ 622, 622, "h1aa" },
+			{ 623, 623, "h_av" },
+			{ 624, 625, "v__v" },
+		},
+	},
+	{
 		/* There are 486 lines in this mode with some active video,
 		 * but encoded files normally only have 480 of these. Here
 		 * we use the line numbers suggested by SMPTE Recommended
 		 * Practice RP-202. Lines 23-262 from the first field and
 		 * 286-525 from the second. */
-		
-		vy = (l->line < 265 ? (l->line - 23) * 2 : (l->line - 286) * 2 + 1);
-	}
-	else if(s->conf.type == VID_RASTER_819)
-	{
-		switch(l->line)
-		{
-		case 817: seq = "h___"; break;
-		case 818: seq = "h___"; break;
-		case 819: seq = "h___"; break;
-		case 1:   seq = "V___"; break;
-		case 2:   seq = "h___"; break;
-		case 3:   seq = "h___"; break;
-		case 4:   seq = "h___"; break;
-		case 5:   seq = "h___"; break;
-		case 6:   seq = "h___"; break;
-		case 7:   seq = "h___"; break;
-		case 8:   seq = "h___"; break;
-		case 9:   seq = "h___"; break;
-		case 10:  seq = "h___"; break;
-		case 11:  seq = "h___"; break;
-		case 12:  seq = "h___"; break;
-		case 13:  seq = "h___"; break;
-		case 14:  seq = "h___"; break;
-		case 15:  seq = "h___"; break;
-		case 16:  seq = "h___"; break;
-		case 17:  seq = "h___"; break;
-		case 18:  seq = "h___"; break;
-		case 19:  seq = "h___"; break;
-		case 20:  seq = "h___"; break;
-		case 21:  seq = "h___"; break;
-		case 22:  seq = "h___"; break;
-		case 23:  seq = "h___"; break;
-		case 24:  seq = "h___"; break;
-		case 25:  seq = "h___"; break;
-		case 26:  seq = "h___"; break;
-		case 27:  seq = "h___"; break;
-		case 28:  seq = "h___"; break;
-		case 29:  seq = "h___"; break;
-		case 30:  seq = "h___"; break;
-		case 31:  seq = "h___"; break;
-		case 32:  seq = "h___"; break;
-		case 33:  seq = "h___"; break;
-		case 34:  seq = "h___"; break;
-		case 35:  seq = "h___"; break;
-		case 36:  seq = "h___"; break;
-		case 37:  seq = "h___"; break;
-		case 38:  seq = "h___"; break;
-		
-		case 406: seq = "h_a_"; break;
-		case 407: seq = "h___"; break;
-		case 408: seq = "h___"; break;
-		case 409: seq = "h__V"; break;
-		case 410: seq = "h___"; break;
-		case 411: seq = "h___"; break;
-		case 412: seq = "h___"; break;
-		case 413: seq = "h___"; break;
-		case 414: seq = "h___"; break;
-		case 415: seq = "h___"; break;
-		case 416: seq = "h___"; break;
-		case 417: seq = "h___"; break;
-		case 418: seq = "h___"; break;
-		case 419: seq = "h___"; break;
-		case 420: seq = "h___"; break;
-		case 421: seq = "h___"; break;
-		case 422: seq = "h___"; break;
-		case 423: seq = "h___"; break;
-		case 424: seq = "h___"; break;
-		case 425: seq = "h___"; break;
-		case 426: seq = "h___"; break;
-		case 427: seq = "h___"; break;
-		case 428: seq = "h___"; break;
-		case 429: seq = "h___"; break;
-		case 430: seq = "h___"; break;
-		case 431: seq = "h___"; break;
-		case 432: seq = "h___"; break;
-		case 433: seq = "h___"; break;
-		case 434: seq = "h___"; break;
-		case 435: seq = "h___"; break;
-		case 436: seq = "h___"; break;
-		case 437: seq = "h___"; break;
-		case 438: seq = "h___"; break;
-		case 439: seq = "h___"; break;
-		case 440: seq = "h___"; break;
-		case 441: seq = "h___"; break;
-		case 442: seq = "h___"; break;
-		case 443: seq = "h___"; break;
-		case 444: seq = "h___"; break;
-		case 445: seq = "h___"; break;
-		case 446: seq = "h___"; break;
-		case 447: seq = "h__a"; break;
-		
-		default:  seq = "h_aa"; break;
-		}
-		
-		/* Calculate the active line number */
-		vy = (l->line < 406 ? (l->line - 48) * 2 : (l->line - 457) * 2 + 1);
-	}
-	else if(s->conf.type == VID_RASTER_405)
-	{
-		switch(l->line)
-		{
-		case 1:   seq = "V__V"; break;
-		case 2:   seq = "V__V"; break;
-		case 3:   seq = "V__V"; break;
-		case 4:   seq = "V__V"; break;
-		case 5:   seq = "h0__"; break;
-		case 6:   seq = "h0__"; break;
-		case 7:   seq = "h0__"; break;
-		case 8:   seq = "h0__"; break;
-		case 9:   seq = "h0__"; break;
-		case 10:  seq = "h0__"; break;
-		case 11:  seq = "h0__"; break;
-		case 12:  seq = "h0__"; break;
-		case 13:  seq = "h0__"; break;
-		case 14:  seq = "h0__"; break;
-		case 15:  seq = "h0__"; break;
-		
-		case 203: seq = "h0aV"; break;
-		case 204: seq = "V__V"; break;
-		case 205: seq = "V__V"; break;
-		case 206: seq = "V__V"; break;
-		case 207: seq = "V___"; break;
-		case 208: seq = "h0__"; break;
-		case 209: seq = "h0__"; break;
-		case 210: seq = "h0__"; break;
-		case 211: seq = "h0__"; break;
-		case 212: seq = "h0__"; break;
-		case 213: seq = "h0__"; break;
-		case 214: seq = "h0__"; break;
-		case 215: seq = "h0__"; break;
-		case 216: seq = "h0__"; break;
-		case 217: seq = "h0__"; break;
-		case 218: seq = "h0_a"; break;
-		
-		default:  seq = "h0aa"; break;
-		}
-		
-		/* Calculate the active line number */
-		vy = (l->line < 210 ? (l->line - 16) * 2 : (l->line - 219) * 2 + 1);
-	}
-	else if(s->conf.type == VID_CBS_405)
-	{
-		switch(l->line)
-		{
-		case 1:   seq = "v__v"; break;
-		case 2:   seq = "v__v"; break;
-		case 3:   seq = "v__v"; break;
-		case 4:   seq = "V__V"; break;
-		case 5:   seq = "V__V"; break;
-		case 6:   seq = "V__V"; break;
-		case 7:   seq = "v__v"; break;
-		case 8:   seq = "v__v"; break;
-		case 9:   seq = "v__v"; break;
-		case 10:  seq = "h___"; break;
-		case 11:  seq = "h___"; break;
-		case 12:  seq = "h___"; break;
-		case 13:  seq = "h___"; break;
-		case 14:  seq = "h___"; break;
-		
-		case 203: seq = "h_av"; break;
-		case 204: seq = "v__v"; break;
-		case 205: seq = "v__v"; break;
-		case 206: seq = "v__V"; break;
-		case 207: seq = "V__V"; break;
-		case 208: seq = "V__V"; break;
-		case 209: seq = "V__v"; break;
-		case 210: seq = "v__v"; break;
-		case 211: seq = "v__v"; break;
-		case 212: seq = "v___"; break;
-		case 213: seq = "h___"; break;
-		case 214: seq = "h___"; break;
-		case 215: seq = "h___"; break;
-		case 216: seq = "h___"; break;
-		case 217: seq = "h__a"; break;
-		
-		default:  seq = "h_aa"; break;
-		}
-		
-		/* Calculate the active line number */
-		vy = (l->line < 210 ? (l->line - 16) * 2 : (l->line - 219) * 2 + 1);
-	}
-	else if(s->conf.type == VID_APOLLO_320)
+		VID_RASTER_525, "h0aa", 265, { 23, 286 }, 0,
+		{
+			{   1,   3, "v__v" },
+			{   4,   6, "V__V" },
+			{   7,   9, "v__v" },
+			{  10,  20, "h0__" },
+			{ 263, 263, "h0av" },
+			{ 264, 265, "v__v" },
+			{ 266, 266, "v__V" },
+			{ 267, 268, "V__V" },
+			{ 269, 269, "V__v" },
+			{ 270, 271, "v__v" },
+			{ 272, 272, "v___" },
+			{ 273, 282, "h0__" },
+			{ 283, 283, "h0_a" },
+		},
+	},
 	{
-		if(l->line <= 8) seq = "V__v";
-		else seq = "h_aa";
-		
-		vy = l->line - 9;
-		if(vy < 0 || vy >= s->conf.active_lines) vy = -1;
-	}
-	else if(s->conf.type == VID_BAIRD_240)
+		VID_RASTER_819, "h_aa", 406, { 48, 457 }, 0,
+		{
+			{   1,   1, "V___" },
+			{   2,  38, "h___" },
+			{ 406, 406, "h_a_" },
+			{ 407, 408, "h___" },
+			{ 409, 409, "h__V" },
+			{ 410, 446, "h___" },
+			{ 447, 447, "h__a" },
+			{ 817, 819, "h___" },
+		},
+	},
 	{
-		switch(l->line)
+		VID_RASTER_405, "h0aa", 210, { 16, 219 }, 0,
 		{
-		case 1:   seq = "V__V"; break;
-		case 2:   seq = "V__V"; break;
-		case 3:   seq = "V__V"; break;
-		case 4:   seq = "V__V"; break;
-		case 5:   seq = "V__V"; break;
-		case 6:   seq = "V__V"; break;
-		case 7:   seq = "V__V"; break;
-		case 8:   seq = "V__V"; break;
-		case 9:   seq = "V__V"; break;
-		case 10:  seq = "V__V"; break;
-		case 11:  seq = "V__V"; break;
-		case 12:  seq = "V__V"; break;
-		case 13:  seq = "h___"; break;
-		case 14:  seq = "h___"; break;
-		case 15:  seq = "h___"; break;
-		case 16:  seq = "h___"; break;
-		case 17:  seq = "h___"; break;
-		case 18:  seq = "h___"; break;
-		case 19:  seq = "h___"; break;
-		case 20:  seq = "h___"; break;
-		
-		default:  seq = "h_aa"; break;
-		}
-		
-		/* Calculate the active line number */
-		vy = l->line - 20;
-	}
-	else if(s->conf.type == VID_BAIRD_30)
+			{   1,   4, "V__V" },
+			{   5,  15, "h0__" },
+			{ 203, 203, "h0aV" },
+			{ 204, 206, "V__V" },
+			{ 207, 207, "V___" },
+			{ 208, 217, "h0__" },
+			{ 218, 218, "h0_a" },
+		},
+	},
+	{
+		VID_CBS_405, "h_aa", 210, { 16, 219 }, 0,
+		{
+			{   1,   3, "v__v" },
+			{   4,   6, "V__V" },
+			{   7,   9, "v__v" },
+			{  10,  14, "h___" },
+			{ 203, 203, "h_av" },
+			{ 204, 205, "v__v" },
+			{ 206, 206, "v__V" },
+			{ 207, 208, "V__V" },
+			{ 209, 209, "V__v" },
+			{ 210, 211, "v__v" },
+			{ 212, 212, "v___" },
+			{ 213, 216, "h___" },
+			{ 217, 217, "h__a" },
+		},
+	},
+	{
+		VID_APOLLO_320, "h_aa", 0, { 9, 0 }, 1,
+		{
+			{   1,   8, "V__v" },
+		},
+	},
+	{
+		VID_BAIRD_240, "h_aa", 0, { 20, 0 }, 0,
+		{
+			{   1,  12, "V__V" },
+			{  13,  20, "h___" },
+		},
+	},
 	{
 		/* The original Baird 30 line standard has no sync pulses */
-		seq = "__aa";
-		vy = l->line - 1;
-	}
-	else if(s->conf.type == VID_NBTV_32)
+		VID_BAIRD_30, "__aa", 0, { 1, 0 }, 0,
+		{ { 0 } },
+	},
 	{
-		switch(l->line)
+		VID_NBTV_32, "h_aa", 0, { 1, 0 }, 0,
 		{
-		case 1:  seq = "__aa"; break;
-		default: seq = "h_aa"; break;
-		}
-		
-		vy = l->line - 1;
+			{   1,   1, "__aa" },
+		},
+	},
+	{
+		/* Unknown raster, blank lines only */
+		-1, "____", 0, { 0, 0 }, 0,
+		{ { 0 } },
+	},
+};
+
+static int _init_raster_template(vid_t *s, _vid_line_template_t *t, uint8_t sc)
+{
+	vid_line_t z, a, b, c;
+	int16_t *buf;
+	int x, i0, i1;
+	
+	/* Render the pulses into three blank lines and keep
+	 * whatever lands in the middle one and its neighbours */
+	buf = calloc(s->width * 2 * 3, sizeof(int16_t));
+	if(!buf)
+	{
+		return(VID_OUT_OF_MEMORY);
 	}
 	
-	/* Shift the lines by one if the source
-	 * video has the bottom field first */
-	if(vy >= 0 && s->vframe.interlaced == 2) vy += 1;
+	z = (vid_line_t) { .width = 0, .next = &a };
+	a = (vid_line_t) { .output = &buf[s->width * 0], .width = s->width, .previous = &z, .next = &b };
+	b = (vid_line_t) { .output = &buf[s->width * 2], .width = s->width, .previous = &a, .next = &c };
+	c = (vid_line_t) { .output = &buf[s->width * 4], .width = s->width, .previous = &b, .next = &z };
 	
-	/* Centre the video vertically */
-	vy -= s->vframe_y;
+	for(x = 0; x < s->width; x++)
+	{
+		b.output[x * 2] = s->blanking_level;
+	}
 	
-	/* Check for out of bounds */
-	if(vy < 0 || vy >= s->vframe.height) vy = -1;
+	if(sc)
+	{
+		vbidata_render(s->syncs, &sc, 0, 5, VBIDATA_LSB_FIRST, &b);
+	}
 	
-	if(s->conf.colour_mode == VID_PAL ||
-	   s->conf.colour_mode == VID_NTSC)
+	/* Find how far the pulses ran into the neighbouring lines */
+	for(i0 = 0; i0 < s->width && a.output[i0 * 2] == 0; i0++);
+	for(i1 = s->width; i1 > 0 && c.output[(i1 - 1) * 2] == 0; i1--);
+	
+	t->nprev = s->width - i0;
+	t->nnext = i1;
+	t->line = malloc(sizeof(int16_t) * (s->width * 2 + t->nprev + t->nnext));
+	if(!t->line)
 	{
-		/* Does this line use colour? */
-		pal  = seq[1] == '0';
-		pal |= seq[1] == '1' && (l->frame & 1) == 0;
-		pal |= seq[1] == '2' && (l->frame & 1) == 1;
-		
-		/* Calculate colour sub-carrier lookup-positions for the start of this line */
-		l->lut = &s->colour_lookup[s->colour_lookup_offset];
-		
-		/* Update offset for the next line */
-		s->colour_lookup_offset += s->width;
-		s->colour_lookup_offset %= s->colour_lookup_width;
-		
-		if(s->conf.colour_mode == VID_PAL && pal &&
-		   (l->frame + l->line) & 1)
-		{
+		free(buf);
+		return(VID_OUT_OF_MEMORY);
+	}
+	
+	t->prev = &t->line[s->width * 2];
+	t->next = &t->prev[t->nprev];
+	
+	memcpy(t->line, b.output, sizeof(int16_t) * 2 * s->width);
+	
+	for(x = 0; x < t->nprev; x++)
+	{
+		t->prev[x] = a.output[(i0 + x) * 2];
+	}
+	
+	for(x = 0; x < t->nnext; x++)
+	{
+		t->next[x] = c.output[x * 2];
+	}
+	
+	free(buf);
+	
+	return(VID_OK);
+}
+
+static int _init_raster(vid_t *s)
+{
+	const _raster_def_t *def;
+	const _raster_range_t *rr;
+	_vid_raster_line_t *rl;
+	const char *seq;
+	int line;
+	int r;
+	
+	for(def = _raster_defs; def->type != -1 && def->type != s->conf.type; def++);
+	
+	s->raster = calloc(s->conf.lines, sizeof(_vid_raster_line_t));
+	if(!s->raster)
+	{
+		return(VID_OUT_OF_MEMORY);
+	}
+	
+	for(line = 1; line <= s->conf.lines; line++)
+	{
+		rl = &s->raster[line - 1];
+		
+		seq = def->seq;
+		
+		for(rr = def->ranges; rr->seq; rr++)
+		{
+			if(line >= rr->first && line <= rr->last)
+			{
+				seq = rr->seq;
+				break;
+			}
+		}
+		
+		/* Left sync pulse */
+		if(seq[0] == 'h')      rl->sync |= 1 << 0;
+		else if(seq[0] == 'v') rl->sync |= 1 << 1;
+		else if(seq[0] == 'V') rl->sync |= 1 << 2;
+		
+		/* Middle sync pulse */
+		if(seq[3] == 'v')      rl->sync |= 1 << 3;
+		else if(seq[3] == 'V') rl->sync |= 1 << 4;
+		
+		/* Colour burst */
+		if(seq[1] == '0')      rl->burst = 3;
+		else if(seq[1] == '1') rl->burst = 1;
+		else if(seq[1] == '2') rl->burst = 2;
+		
+		/* Active video */
+		rl->active = (seq[2] == 'a' ? 1 : 0) | (seq[3] == 'a' ? 2 : 0);
+		rl->al = (seq[2] == 'a' ? s->active_left : (seq[3] == 'a' ? s->half_width : -1));
+		rl->ar = (seq[3] == 'a' ? s->active_left + s->active_width : (seq[2] == 'a' ? s->half_width : -1));
+		
+		/* Don't run past the end of the line */
+		if(rl->ar > s->width) rl->ar = s->width;
+		
+		/* Calculate the active line number */
+		if(def->field2 == 0)
+		{
+			rl->vy = line - def->top[0];
+		}
+		else
+		{
+			rl->vy = (line < def->field2 ? (line - def->top[0]) * 2 : (line - def->top[1]) * 2 + 1);
+		}
+		
+		if(def->bounded && (rl->vy < 0 || rl->vy >= s->conf.active_lines))
+		{
+			rl->vy = -1;
+		}
+		
+		/* Render the template for this line type if needed */
+		if(s->raster_tmpl[rl->sync].line == NULL)
+		{
+			r = _init_raster_template(s, &s->raster_tmpl[rl->sync], rl->sync);
+			if(r != VID_OK)
+			{
+				return(r);
+			}
+		}
+	}
+	
+	return(VID_OK);
+}
+
+static inline void _vid_chroma_mix(vid_t *s, vid_line_t *l, const int16_t *oc, int x0, int x1, int pal)
+{
+	if(x1 > x0)
+	{
+		s->composite->mix(&l->output[x0 * 2], oc, &l->lut[x0], x1 - x0, pal);
+	}
+}
+
+static int _vid_next_line_raster(vid_t *s, void *arg, int nlines, vid_line_t **lines)
+{
+	const _vid_raster_line_t *rl;
+	const _vid_line_template_t *t, *pt;
+	int16_t *o;
+	int x;
+	int vy;
+	int pal = 0;
+	int fsc = 0;
+	uint8_t sc = 0;
+	int al, ar;
+	vid_line_t *l = lines[1];
+	
+	l->width    = s->width;
+	l->frame    = s->bframe;
+	l->line     = s->bline;
+	l->vbialloc = 0;
+	l->lut      = NULL;
+	
+	rl = &s->raster[l->line - 1];
+	vy = rl->vy;
+	
+	/* Active video portion of this line */
+	al = rl->al;
+	ar = rl->ar;
+	
+	/* Shift the lines by one if the source
+	 * video has the bottom field first */
+	if(vy >= 0 && s->vframe.interlaced == 2) vy += 1;
+	
+	/* Centre the video vertically */
+	vy -= s->vframe_y;
+	
+	/* Check for out of bounds */
+	if(vy < 0 || vy >= s->vframe.height) vy = -1;
+	
+	if(s->conf.colour_mode == VID_PAL ||
+	   s->conf.colour_mode == VID_NTSC)
+	{
+		/* Does this line use colour? */
+		pal = (rl->burst >> (l->frame & 1)) & 1;
+		
+		/* Calculate colour sub-carrier lookup-positions for the start of this line */
+		l->lut = &s->colour_lookup[s->colour_lookup_offset];
+		
+		/* Update offset for the next line */
+		s->colour_lookup_offset += s->width;
+		s->colour_lookup_offset %= s->colour_lookup_width;
+		
+		if(s->conf.colour_mode == VID_PAL && pal &&
+		   (l->frame + l->line) & 1)
+		{
 			pal = -1;
 		}
 		
-		/* Clear the chrominance buffer */
-		if(pal) memset(s->chrominance_buffer, 0, sizeof(int16_t) * 2 * s->width);
 	}
 	else if(s->conf.colour_mode == VID_APOLLO_FSC)
 	{
@@ -3038,47 +3154,44 @@ static int _vid_next_line_raster(vid_t *s, void *arg, int nlines, vid_line_t **l
 		pal = 0;
 	}
 	
-	/* Blank the next line */
-	for(x = 0; x < s->width; x++)
+	/* Stamp the blanking and sync pulses for this line */
+	t = &s->raster_tmpl[rl->sync];
+	memcpy(l->output, t->line, sizeof(int16_t) * 2 * s->width);
+	
+	/* Add the end of any sync pulse from the previous line,
+	 * and the start of this line's pulses to the previous line */
+	pt = &s->raster_tmpl[s->raster_sync];
+	for(x = 0; x < pt->nnext; x++)
 	{
-		lines[2]->output[x * 2 + 0] = s->blanking_level;
-		lines[2]->output[x * 2 + 1] = 0;
+		l->output[x * 2] += pt->next[x];
 	}
 	
-	x = 0;
-	
-	/* Draw the sync pulses */
-	sc = 0x00;
-	
-	/* Left sync pulse */
-	if(seq[0] == 'h')      sc |= 1 << 0;
-	else if(seq[0] == 'v') sc |= 1 << 1;
-	else if(seq[0] == 'V') sc |= 1 << 2;
-	
-	/* Middle sync pulse */
-	if(seq[3] == 'v')      sc |= 1 << 3;
-	else if(seq[3] == 'V') sc |= 1 << 4;
-	
-	if(sc)
+	if(lines[0]->width > 0)
 	{
-		vbidata_render(s->syncs, &sc, 0, 5, VBIDATA_LSB_FIRST, l);
+		o = &lines[0]->output[(lines[0]->width - t->nprev) * 2];
+		for(x = 0; x < t->nprev; x++, o += 2)
+		{
+			*o += t->prev[x];
+		}
 	}
+	
+	s->raster_sync = rl->sync;
 
 	/* Render the active video if required */
-	if(seq[2] == 'a' || seq[3] == 'a')
+	if(rl->active)
 	{
 		uint32_t rgb = 0x000000;
 		uint32_t *prgb = &rgb;
 		int stride = 0;
-		int16_t *o, *oc;
+		int16_t *oc;
+		int vx, c;
 		
-		/* Calculate active video portion of this line */
-		al = (seq[2] == 'a' ? s->active_left : (seq[3] == 'a' ? s->half_width : -1));
-		ar = (seq[3] == 'a' ? s->active_left + s->active_width : (seq[2] == 'a' ? s->half_width : -1));
+		/* Clear the chrominance buffer */
+		if(pal) memset(&s->chrominance_buffer[al * 2], 0, sizeof(int16_t) * 2 * (ar - al));
 		
 		for(x = al, o = &l->output[al * 2]; x < s->active_left + s->vframe_x; x++, o += 2)
 		{
-			*o = s->yiq_level_lookup[0x000000].y;
+			*o = s->yiq_black.y;
 		}
 		
 		if(s->vframe.framebuffer && vy >= 0)
@@ -3089,51 +3202,60 @@ static int _vid_next_line_raster(vid_t *s, void *arg, int nlines, vid_line_t **l
 		}
 		
 		oc = &s->chrominance_buffer[x * 2];
-		for(; x < s->active_left + s->vframe_x + s->vframe.width && x < ar; x++, o += 2, oc += 2, prgb += stride)
+		
+		/* Convert the visible part of the line */
+		vx = s->active_left + s->vframe_x + s->vframe.width;
+		if(vx > ar) vx = ar;
+		
+		if(s->conf.colour_mode == VID_APOLLO_FSC ||
+		   s->conf.colour_mode == VID_CBS_FSC)
 		{
-			rgb = *prgb & 0xFFFFFF;
-			
-			if(s->conf.colour_mode == VID_APOLLO_FSC ||
-			   s->conf.colour_mode == VID_CBS_FSC)
+			for(c = 0; c < vx - x; c++, prgb += stride)
 			{
-				rgb  = (rgb >> (8 * fsc)) & 0xFF;
+				rgb  = (*prgb >> (8 * fsc)) & 0xFF;
 				rgb |= (rgb << 8) | (rgb << 16);
+				
+				s->yiq_line[c] = vid_rgb_to_yiq(s, rgb);
 			}
-			
-			*o = s->yiq_level_lookup[rgb].y;
+		}
+		else if(vx > x)
+		{
+			vid_rgb_to_yiq_line(s, s->yiq_line, prgb, stride, vx - x);
+		}
+		
+		if(vx > x)
+		{
+			s->composite->luma(o, (const int16_t *) s->yiq_line, vx - x);
 			
 			if(pal)
 			{
-				oc[0] = s->yiq_level_lookup[rgb].i;
-				oc[1] = s->yiq_level_lookup[rgb].q;
+				s->composite->chroma(oc, (const int16_t *) s->yiq_line, vx - x);
 			}
+			
+			o += (vx - x) * 2;
+			x = vx;
 		}
 		
 		for(; x < ar; x++, o += 2)
 		{
-			*o = s->yiq_level_lookup[0x000000].y;
+			*o = s->yiq_black.y;
 		}
 	}
 	
 	if(pal)
 	{
-		int16_t *o, *oc;
+		int bl = s->burst_left;
+		int br = s->burst_left + s->burst_width;
 		
 		/* Render the colour burst */
-		oc = &s->chrominance_buffer[s->burst_left * 2];
-		for(x = 0; x < s->burst_width; x++, oc += 2)
-		{
-			oc[0] = (s->burst_phase.i * s->burst_win[x]) >> 15;
-			oc[1] = (s->burst_phase.q * s->burst_win[x]) >> 15;
-		}
+		_vid_chroma_mix(s, l, s->burst_chroma, bl, br, pal);
 		
-		/* Render the colour subcarrier */
-		o = l->output;
-		oc = s->chrominance_buffer;
-		for(x = 0; x < s->width; x++, o += 2, oc += 2)
+		/* Render the colour subcarrier. The burst takes
+		 * priority where the two overlap */
+		if(rl->active)
 		{
-			*o += (oc[0] * l->lut[x].q +
-			       oc[1] * l->lut[x].i * pal) >> 15;
+			_vid_chroma_mix(s, l, &s->chrominance_buffer[al * 2], al, al < bl ? (ar < bl ? ar : bl) : al, pal);
+			_vid_chroma_mix(s, l, &s->chrominance_buffer[(al > br ? al : br) * 2], al > br ? al : br, ar, pal);
 		}
 	}
 	
@@ -3162,7 +3284,6 @@ static int _vid_next_line_raster(vid_t *s, void *arg, int nlines, vid_line_t **l
 	/* Render the SECAM colour subcarrier */
 	if(s->conf.colour_mode == VID_SECAM)
 	{
-		const cint16_t *g;
 		int16_t dmin, dmax;
 		int sl = 0, sr = 0;
 		
@@ -3176,13 +3297,13 @@ static int _vid_next_line_raster(vid_t *s, void *arg, int nlines, vid_line_t **l
 			
 			if(((l->frame * s->conf.lines) + l->line) & 1)
 			{
-				level = s->yiq_level_lookup[0x000000].q; // D'r
+				level = s->yiq_black.q; // D'r
 				dev = s->secam_fsync_level;
 				rw = 15e-6;
 			}
 			else
 			{
-				level = s->yiq_level_lookup[0x000000].i; // D'b
+				level = s->yiq_black.i; // D'b
 				dev = -s->secam_fsync_level;
 				rw = 18e-6;
 			}
@@ -3202,11 +3323,12 @@ static int _vid_next_line_raster(vid_t *s, void *arg, int nlines, vid_line_t **l
 			
 			l->vbialloc = 1;
 		}
-		else if(seq[2] == 'a' || seq[3] == 'a')
+		else if(rl->active)
 		{
 			uint32_t rgb = 0x000000;
 			uint32_t *prgb = &rgb;
 			int stride = 0;
+			int c;
 			
 			if(s->vframe.framebuffer && vy >= 0)
 			{
@@ -3220,17 +3342,19 @@ static int _vid_next_line_raster(vid_t *s, void *arg, int nlines, vid_line_t **l
 				
 				for(x = 0; x < s->active_left + s->vframe_x; x++)
 				{
-					s->chrominance_buffer[x] = s->yiq_level_lookup[0x000000].q;
+					s->chrominance_buffer[x] = s->yiq_black.q;
 				}
 				
-				for(; x < s->active_left + s->vframe_x + s->vframe.width; x++, prgb += stride)
+				vid_rgb_to_yiq_line(s, s->yiq_line, prgb, stride, s->vframe.width);
+				
+				for(c = 0; c < s->vframe.width; x++, c++)
 				{
-					s->chrominance_buffer[x] = s->yiq_level_lookup[*prgb & 0xFFFFFF].q;
+					s->chrominance_buffer[x] = s->yiq_line[c].q;
 				}
 				
 				for(; x < s->width; x++)
 				{
-					s->chrominance_buffer[x] = s->yiq_level_lookup[0x000000].q;
+					s->chrominance_buffer[x] = s->yiq_black.q;
 				}
 			}
 			else
@@ -3239,22 +3363,24 @@ static int _vid_next_line_raster(vid_t *s, void *arg, int nlines, vid_line_t **l
 				
 				for(x = 0; x < s->active_left + s->vframe_x; x++)
 				{
-					s->chrominance_buffer[x] = s->yiq_level_lookup[0x000000].i;
+					s->chrominance_buffer[x] = s->yiq_black.i;
 				}
 				
-				for(; x < s->active_left + s->vframe_x + s->vframe.width; x++, prgb += stride)
+				vid_rgb_to_yiq_line(s, s->yiq_line, prgb, stride, s->vframe.width);
+				
+				for(c = 0; c < s->vframe.width; x++, c++)
 				{
-					s->chrominance_buffer[x] = s->yiq_level_lookup[*prgb & 0xFFFFFF].i;
+					s->chrominance_buffer[x] = s->yiq_line[c].i;
 				}
 				
 				for(; x < s->width; x++)
 				{
-					s->chrominance_buffer[x] = s->yiq_level_lookup[0x000000].i;
+					s->chrominance_buffer[x] = s->yiq_black.i;
 				}
 			}
 			
 			sl = s->burst_left;
-			sr = seq[3] == 'a' ? sl + s->burst_width : s->half_width;
+			sr = rl->active & 2 ? sl + s->burst_width : s->half_width;
 		}
 		
 		if(sr > sl)
@@ -3264,24 +3390,13 @@ static int _vid_next_line_raster(vid_t *s, void *arg, int nlines, vid_line_t **l
 			iir_int16_process(&s->fm_secam_iir, s->chrominance_buffer, s->chrominance_buffer, s->width, 1);
 			
 			/* Reset the SECAM FM phase every line, alternating every third line */
-			s->fm_secam.counter = INT16_MAX;
-			s->fm_secam.phase.i = ((l->frame * s->conf.lines) + l->line) % 3 == 0 ? INT32_MAX : -INT32_MAX;
-			s->fm_secam.phase.q = 0;
+			s->fm_secam.nco.phase = ((l->frame * s->conf.lines) + l->line) % 3 == 0 ? 0 : 1U << 31;
 			
 			/* Limit the FM deviation */
 			dmin = s->fm_secam_dmin[((l->frame * s->conf.lines) + l->line) & 1];
 			dmax = s->fm_secam_dmax[((l->frame * s->conf.lines) + l->line) & 1];
 			
-			for(x = sl; x < sr; x++)
-			{
-				if(s->chrominance_buffer[x] < dmin) s->chrominance_buffer[x] = dmin;
-				else if(s->chrominance_buffer[x] > dmax) s->chrominance_buffer[x] = dmax;
-				
-				g = &s->fm_secam_bell[(uint16_t) s->chrominance_buffer[x]];
-				_fm_modulator_cgain(&s->fm_secam, &s->chrominance_buffer[x], s->chrominance_buffer[x], g);
-				
-				l->output[x * 2] += (s->chrominance_buffer[x] * s->burst_win[x - s->burst_left]) >> 15;
-			}
+			secam_modulate(s->secam, &s->fm_secam.nco, &s->fm_secam_bell, &l->output[sl * 2], &s->chrominance_buffer[sl], &s->burst_win[sl - s->burst_left], dmin, dmax, sr - sl);
 		}
 	}
 	
@@ -3307,106 +3422,202 @@ static void _vid_filter_free(vid_t *s, void *arg)
 	free(p);
 }
 
-static int _vid_audio_process(vid_t *s, void *arg, int nlines, vid_line_t **lines)
+static void _report_resampler(vid_t *s, const char *name, const fir_int16_t *fir)
 {
-	vid_line_t *l = lines[0];
-	int16_t audio[2] = { 0, 0 };
-	int x;
+	/* Only the resampler with interpolated phases is worth a mention */
+	if(!s->conf.verbose || fir->type != 5) return;
+	
+	fprintf(stderr, "%s resampler: %d/%d needs %d phases, using %d interpolated phases (%zu bytes, error %.1f dB)\n",
+		name, fir->interpolation, fir->decimation,
+		fir->interpolation, fir->phases,
+		sizeof(int16_t) * (fir->ntaps + fir->ataps * 2),
+		fir->error
+	);
+}
+
+/* Audio process
+ * 
+ * The audio carriers are fixed at init, so rather than test the
+ * config for each one on every sample the process is built from a
+ * template specialised for the combination in use. The flags select
+ * the carriers to include, the per-sample tests on constant flags are
+ * removed by the compiler. Combinations without a specialised version
+ * use the generic one, which tests s->audio_flags. */
+
+#define _AUDIO_FM_MONO  (1 << 0)
+#define _AUDIO_FM_LEFT  (1 << 1)
+#define _AUDIO_FM_RIGHT (1 << 2)
+#define _AUDIO_A2       (1 << 3)
+#define _AUDIO_AM_MONO  (1 << 4)
+#define _AUDIO_NICAM    (1 << 5)
+#define _AUDIO_MAC      (1 << 6)
+#define _AUDIO_SIS      (1 << 7)
+#define _AUDIO_DANCE    (1 << 8)
+
+/* The flags used per output sample */
+#define _AUDIO_CARRIERS (_AUDIO_FM_MONO | _AUDIO_FM_LEFT | _AUDIO_FM_RIGHT | _AUDIO_A2 | _AUDIO_AM_MONO)
+
+/* Audio delivered in blocks of NICAM_AUDIO_LEN samples */
+#define _AUDIO_BLOCKS (_AUDIO_NICAM | _AUDIO_MAC | _AUDIO_SIS)
+
+/* Audio resampler
+ * 
+ * Audio is read from the source at 32 kHz. The FM and AM carriers take
+ * their samples at the modulator rate, so each carrier stream is
+ * upsampled by a polyphase FIR filter a line at a time. The filter
+ * output is kept in a short FIFO, any samples left over at the end of
+ * a line are used at the start of the next. */
+
+#define _AUDIO_S_FM_MONO  0
+#define _AUDIO_S_FM_LEFT  1
+#define _AUDIO_S_FM_RIGHT 2
+#define _AUDIO_S_AM_MONO  3
+#define _AUDIO_STREAMS    4
+
+typedef struct {
+	
+	int interpolation;
+	int decimation;
+	fir_int16_t fir[_AUDIO_STREAMS];
 	
-	for(x = 0; x < l->width; x++)
+	/* 32 kHz input samples */
+	int ilen;
+	int16_t *in;
+	
+	/* Resampled output FIFO */
+	int olen;
+	int len;
+	int16_t *out;
+	
+} _vid_audio_process_t;
+
+static void _audio_read(vid_t *s, _vid_audio_process_t *p, const int flags, int n)
+{
+	const int16_t *audio;
+	int16_t *in;
+	int i, j, c;
+	
+	for(i = 0; i < n; i += c)
 	{
-		int16_t add[2] = { 0, 0 };
+		if(s->audiobuffer_samples == 0)
+		{
+			s->audiobuffer = av_read_audio(&s->av, &s->audiobuffer_samples);
+			
+			if(s->conf.systeraudio == 1)
+			{
+				ng_invert_audio(&s->ng, s->audiobuffer, s->audiobuffer_samples);
+			}
+		}
+		
+		if(s->audiobuffer)
+		{
+			/* Take as much of this block as is needed */
+			c = n - i;
+			if(c > s->audiobuffer_samples) c = s->audiobuffer_samples;
+			
+			audio = s->audiobuffer;
+			s->audiobuffer += c * 2;
+			s->audiobuffer_samples -= c;
+		}
+		else
+		{
+			/* No audio from the source */
+			c = n - i;
+			audio = NULL;
+		}
 		
-		/* TODO: Replace this with a real FIR filter... */
-		s->interp += HACKTV_AUDIO_SAMPLE_RATE;
-		if(s->interp >= s->sample_rate)
+		if(flags & _AUDIO_FM_MONO)
 		{
-			s->interp -= s->sample_rate;
+			in = &p->in[_AUDIO_S_FM_MONO * p->ilen + i];
 			
-			if(s->audiobuffer_samples == 0)
+			for(j = 0; j < c; j++)
 			{
-				s->audiobuffer = av_read_audio(&s->av, &s->audiobuffer_samples);
-				
-				if(s->conf.systeraudio == 1)
-				{
-					ng_invert_audio(&s->ng, s->audiobuffer, s->audiobuffer_samples);
-				}
+				in[j] = audio ? (audio[j * 2 + 0] + audio[j * 2 + 1]) / 2 : 0;
 			}
 			
-			if(s->audiobuffer)
+			if(s->fm_mono.limiter.width)
 			{
-				/* Fetch next sample */
-				audio[0] = s->audiobuffer[0];
-				audio[1] = s->audiobuffer[1];
-				s->audiobuffer += 2;
-				s->audiobuffer_samples--;
+				limiter_process(&s->fm_mono.limiter, in, in, in, c, 1);
 			}
-			else
+			
+			/* Reduce volume of audio in A2 Stereo mode to
+			 * leave room for the pilot/mode signal */
+			if(flags & _AUDIO_A2)
+			{
+				for(j = 0; j < c; j++) in[j] *= 0.95;
+			}
+		}
+		
+		if(flags & _AUDIO_FM_LEFT)
+		{
+			in = &p->in[_AUDIO_S_FM_LEFT * p->ilen + i];
+			
+			for(j = 0; j < c; j++)
 			{
-				/* No audio from the source */
-				audio[0] = 0;
-				audio[1] = 0;
+				in[j] = audio ? audio[j * 2 + 0] : 0;
 			}
 			
-			if(s->conf.am_audio_level > 0 && s->conf.am_mono_carrier != 0)
+			if(s->fm_left.limiter.width)
 			{
-				s->am_mono.sample = (audio[0] + audio[1]) / 2;
+				limiter_process(&s->fm_left.limiter, in, in, in, c, 1);
 			}
+		}
+		
+		if(flags & _AUDIO_FM_RIGHT)
+		{
+			in = &p->in[_AUDIO_S_FM_RIGHT * p->ilen + i];
 			
-			if(s->conf.fm_mono_level > 0 && s->conf.fm_mono_carrier != 0)
+			for(j = 0; j < c; j++)
 			{
-				s->fm_mono.sample = (audio[0] + audio[1]) / 2;
-				if(s->fm_mono.limiter.width)
-				{
-					limiter_process(&s->fm_mono.limiter, &s->fm_mono.sample, &s->fm_mono.sample, &s->fm_mono.sample, 1, 1);
-				}
-				
-				/* Reduce volume of audio in A2 Stereo mode to
-				 * leave room for the pilot/mode signal */
-				if(s->conf.a2stereo) s->fm_mono.sample *= 0.95;
+				in[j] = audio ? audio[j * 2 + 1] : 0;
 			}
 			
-			if(s->conf.fm_left_level > 0 && s->conf.fm_left_carrier != 0)
+			if(s->fm_right.limiter.width)
 			{
-				s->fm_left.sample = audio[0];
-				if(s->fm_left.limiter.width)
-				{
-					limiter_process(&s->fm_left.limiter, &s->fm_left.sample, &s->fm_left.sample, &s->fm_left.sample, 1, 1);
-				}
+				limiter_process(&s->fm_right.limiter, in, in, in, c, 1);
 			}
 			
-			if(s->conf.fm_right_level > 0 && s->conf.fm_right_carrier != 0)
+			/* Reduce volume of audio in A2 Stereo mode to
+			 * leave room for the pilot/mode signal */
+			if(flags & _AUDIO_A2)
 			{
-				s->fm_right.sample = audio[1];
-				if(s->fm_right.limiter.width)
-				{
-					limiter_process(&s->fm_right.limiter, &s->fm_right.sample, &s->fm_right.sample, &s->fm_right.sample, 1, 1);
-				}
-				
-				/* Reduce volume of audio in A2 Stereo mode to
-				 * leave room for the pilot/mode signal */
-				if(s->conf.a2stereo) s->fm_right.sample *= 0.95;
+				for(j = 0; j < c; j++) in[j] *= 0.95;
+			}
+		}
+		
+		if(flags & _AUDIO_AM_MONO)
+		{
+			in = &p->in[_AUDIO_S_AM_MONO * p->ilen + i];
+			
+			for(j = 0; j < c; j++)
+			{
+				in[j] = audio ? (audio[j * 2 + 0] + audio[j * 2 + 1]) / 2 : 0;
 			}
+		}
+		
+		for(j = 0; j < c; j++)
+		{
+			int16_t a0 = audio ? audio[j * 2 + 0] : 0;
+			int16_t a1 = audio ? audio[j * 2 + 1] : 0;
 			
-			if((s->conf.nicam_level > 0 && s->conf.nicam_carrier != 0) ||
-			   s->conf.type == VID_MAC || s->conf.sis)
+			if(flags & _AUDIO_BLOCKS)
 			{
-				s->nicam_buf[s->nicam_buf_len++] = audio[0];
-				s->nicam_buf[s->nicam_buf_len++] = audio[1];
+				s->nicam_buf[s->nicam_buf_len++] = a0;
+				s->nicam_buf[s->nicam_buf_len++] = a1;
 				
 				if(s->nicam_buf_len == NICAM_AUDIO_LEN * 2)
 				{
-					if(s->conf.nicam_level > 0 && s->conf.nicam_carrier != 0)
+					if(flags & _AUDIO_NICAM)
 					{
 						nicam_mod_input(&s->nicam, s->nicam_buf);
 					}
 					
-					if(s->conf.type == VID_MAC)
+					if(flags & _AUDIO_MAC)
 					{
 						mac_write_audio(s, &s->mac.audio, 0, s->nicam_buf, NICAM_AUDIO_LEN * 2);
 					}
 					
-					if(s->conf.sis)
+					if(flags & _AUDIO_SIS)
 					{
 						sis_write_audio(&s->sis, s->nicam_buf);
 					}
@@ -3415,10 +3626,10 @@ static int _vid_audio_process(vid_t *s, void *arg, int nlines, vid_line_t **line
 				}
 			}
 			
-			if(s->conf.dance_level > 0 && s->conf.dance_carrier != 0)
+			if(flags & _AUDIO_DANCE)
 			{
-				s->dance_buf[s->dance_buf_len++] = audio[0];
-				s->dance_buf[s->dance_buf_len++] = audio[1];
+				s->dance_buf[s->dance_buf_len++] = a0;
+				s->dance_buf[s->dance_buf_len++] = a1;
 				
 				if(s->dance_buf_len == DANCE_A_AUDIO_LEN * 2)
 				{
@@ -3427,56 +3638,149 @@ static int _vid_audio_process(vid_t *s, void *arg, int nlines, vid_line_t **line
 				}
 			}
 		}
+	}
+}
+
+static inline __attribute__((always_inline)) void _audio_resample(vid_t *s, _vid_audio_process_t *p, const int flags, int width)
+{
+	int n, x, i;
+	
+	if((flags & _AUDIO_CARRIERS) == 0)
+	{
+		/* No carriers to feed, read enough
+		 * audio to keep pace with the video */
+		n = (s->interp + (int64_t) width * HACKTV_AUDIO_SAMPLE_RATE) / s->sample_rate;
+		s->interp = (s->interp + (int64_t) width * HACKTV_AUDIO_SAMPLE_RATE) % s->sample_rate;
+		
+		_audio_read(s, p, flags, n);
+		
+		return;
+	}
+	
+	while(p->len < width)
+	{
+		n = ((int64_t) (width - p->len) * p->decimation + p->interpolation - 1) / p->interpolation;
+		if(n > p->ilen) n = p->ilen;
+		
+		_audio_read(s, p, flags, n);
+		
+		for(x = i = 0; i < _AUDIO_STREAMS; i++)
+		{
+			if(p->fir[i].type == 0) continue;
+			
+			x = fir_int16_process(&p->fir[i], &p->out[i * p->olen + p->len], &p->in[i * p->ilen], n, 1);
+		}
+		
+		p->len += x;
+	}
+}
+
+static void _audio_consume(_vid_audio_process_t *p, int width)
+{
+	int i;
+	
+	p->len -= width;
+	
+	for(i = 0; i < _AUDIO_STREAMS && p->len > 0; i++)
+	{
+		if(p->fir[i].type == 0) continue;
+		
+		memmove(&p->out[i * p->olen], &p->out[i * p->olen + width], sizeof(int16_t) * p->len);
+	}
+}
+
+static void _vid_audio_free(vid_t *s, void *arg)
+{
+	_vid_audio_process_t *p = arg;
+	int i;
+	
+	for(i = 0; i < _AUDIO_STREAMS; i++)
+	{
+		fir_int16_free(&p->fir[i]);
+	}
+	
+	free(p->in);
+	free(p->out);
+	free(p);
+}
+
+static inline __attribute__((always_inline)) int _vid_audio_line(vid_t *s, _vid_audio_process_t *p, vid_line_t *l, const int flags)
+{
+	const int16_t *fm_mono = &p->out[_AUDIO_S_FM_MONO * p->olen];
+	const int16_t *fm_left = &p->out[_AUDIO_S_FM_LEFT * p->olen];
+	const int16_t *fm_right = &p->out[_AUDIO_S_FM_RIGHT * p->olen];
+	const int16_t *am_mono = &p->out[_AUDIO_S_AM_MONO * p->olen];
+	int x, n;
+	
+	/* Fetch and resample the audio for this line */
+	_audio_resample(s, p, flags, l->width);
+	
+	for(x = 0; x < l->width && (flags & _AUDIO_CARRIERS); x += n)
+	{
+		int16_t *out = &l->output[x * 2];
 		
-		if(s->conf.fm_mono_level > 0 && s->conf.fm_mono_carrier != 0)
+		n = l->width - x;
+		if(n > NCO_BLOCK) n = NCO_BLOCK;
+		
+		if(flags & _AUDIO_FM_MONO)
 		{
-			_fm_modulator_add(&s->fm_mono, add, s->fm_mono.sample);
+			_fm_modulator_add(&s->fm_mono, out, &fm_mono[x], n);
 		}
 		
-		if(s->conf.fm_left_level > 0 && s->conf.fm_left_carrier != 0)
+		if(flags & _AUDIO_FM_LEFT)
 		{
-			_fm_modulator_add(&s->fm_left, add, s->fm_left.sample);
+			_fm_modulator_add(&s->fm_left, out, &fm_left[x], n);
 		}
 		
-		if(s->conf.fm_right_level > 0 && s->conf.fm_right_carrier != 0)
+		if(flags & _AUDIO_FM_RIGHT)
 		{
-			int16_t a2 = s->fm_right.sample;
+			const int16_t *a2 = &fm_right[x];
+			int16_t a2b[NCO_BLOCK];
 			
-			if(s->conf.a2stereo)
+			if(flags & _AUDIO_A2)
 			{
-				int16_t s1[2] = { 0, 0 };
-				int16_t s2[2] = { 0, 0 };
+				static const int16_t zero = 0;
+				int16_t s1[NCO_BLOCK * 2];
+				int16_t s2[NCO_BLOCK * 2];
+				int i;
+				
+				memset(s1, 0, sizeof(int16_t) * n * 2);
+				memset(s2, 0, sizeof(int16_t) * n * 2);
 				
-				if(s->a2stereo_system_m)
+				/* Generate the pilot tone */
+				_am_modulator_add(&s->a2stereo_signal, s1, &zero, 0, n);
+				_am_modulator_add(&s->a2stereo_pilot, s2, s1, 2, n);
+				
+				for(i = 0; i < n; i++)
 				{
 					/* The System M variant is L-R, not R */
-					a2 = s->fm_mono.sample - s->fm_right.sample;
+					a2b[i] = s->a2stereo_system_m ? fm_mono[x + i] - fm_right[x + i] : fm_right[x + i];
+					a2b[i] += s2[i * 2];
 				}
 				
-				/* Add the pilot tone */
-				_am_modulator_add(&s->a2stereo_signal, s1, 0);
-				_am_modulator_add(&s->a2stereo_pilot, s2, s1[0]);
-				a2 += s2[0];
+				a2 = a2b;
 			}
 			
-			_fm_modulator_add(&s->fm_right, add, a2);
+			_fm_modulator_add(&s->fm_right, out, a2, n);
 		}
 		
-		if(s->conf.am_audio_level > 0 && s->conf.am_mono_carrier != 0)
+		if(flags & _AUDIO_AM_MONO)
 		{
-			_am_modulator_add(&s->am_mono, add, s->am_mono.sample);
+			_am_modulator_add(&s->am_mono, out, &am_mono[x], 1, n);
 		}
-		
-		l->output[x * 2 + 0] += add[0];
-		l->output[x * 2 + 1] += add[1];
 	}
 	
-	if(s->conf.nicam_level > 0 && s->conf.nicam_carrier != 0)
+	if(flags & _AUDIO_CARRIERS)
+	{
+		_audio_consume(p, l->width);
+	}
+	
+	if(flags & _AUDIO_NICAM)
 	{
 		nicam_mod_output(&s->nicam, l->output, l->width);
 	}
 	
-	if(s->conf.dance_level > 0 && s->conf.dance_carrier != 0)
+	if(flags & _AUDIO_DANCE)
 	{
 		dance_mod_output(&s->dance, l->output, l->width);
 	}
@@ -3484,89 +3788,119 @@ static int _vid_audio_process(vid_t *s, void *arg, int nlines, vid_line_t **line
 	return(1);
 }
 
-static int _vid_fmmod_process(vid_t *s, void *arg, int nlines, vid_line_t **lines)
+/* Generic version, for any combination of carriers */
+static int _vid_audio_process(vid_t *s, void *arg, int nlines, vid_line_t **lines)
 {
-	vid_line_t *l = lines[0];
-	int x;
-	
-	/* FM modulate the video and audio if requested */
-	for(x = 0; x < l->width; x++)
-	{
-		_fm_modulator(&s->fm_video, &l->output[x * 2], l->output[x * 2]);
-	}
-	
-	return(1);
+	return(_vid_audio_line(s, arg, lines[0], s->audio_flags));
 }
 
-static int _vid_swap_iq_process(vid_t *s, void *arg, int nlines, vid_line_t **lines)
+#define _AUDIO_PROCESS(name, carriers) \
+	static int name(vid_t *s, void *arg, int nlines, vid_line_t **lines) \
+	{ \
+		return(_vid_audio_line(s, arg, lines[0], (carriers) | (s->audio_flags & ~_AUDIO_CARRIERS))); \
+	}
+
+_AUDIO_PROCESS(_vid_audio_process_none,   0)
+_AUDIO_PROCESS(_vid_audio_process_fm,     _AUDIO_FM_MONO)
+_AUDIO_PROCESS(_vid_audio_process_a2,     _AUDIO_FM_MONO | _AUDIO_FM_RIGHT | _AUDIO_A2)
+_AUDIO_PROCESS(_vid_audio_process_stereo, _AUDIO_FM_LEFT | _AUDIO_FM_RIGHT)
+_AUDIO_PROCESS(_vid_audio_process_am,     _AUDIO_AM_MONO)
+
+static const struct {
+	int carriers;
+	vid_lineprocess_process_t process;
+} _audio_processes[] = {
+	{ 0,                                              _vid_audio_process_none },
+	{ _AUDIO_FM_MONO,                                 _vid_audio_process_fm },
+	{ _AUDIO_FM_MONO | _AUDIO_FM_RIGHT | _AUDIO_A2,   _vid_audio_process_a2 },
+	{ _AUDIO_FM_LEFT | _AUDIO_FM_RIGHT,               _vid_audio_process_stereo },
+	{ _AUDIO_AM_MONO,                                 _vid_audio_process_am },
+	{ -1,                                             _vid_audio_process },
+};
+
+static int _vid_fmmod_block(vid_t *s, void *arg, int nlines, vid_line_t **lines, int count)
 {
-	vid_line_t *l = lines[0];
-	int x;
-	int16_t t;
+	vid_line_t *l;
 	
-	for(x = 0; x < l->width; x++)
+	for(l = lines[0]; count > 0; count--, l = l->next)
 	{
-		t = l->output[x * 2 + 0];
-		l->output[x * 2 + 0] = l->output[x * 2 + 1];
-		l->output[x * 2 + 1] = t;
+		/* FM modulate the video and audio if requested */
+		_fm_modulator(&s->fm_video, l->output, l->width);
 	}
 	
 	return(1);
 }
 
-static int _vid_offset_process(vid_t *s, void *arg, int nlines, vid_line_t **lines)
+static int _vid_fmmod_process(vid_t *s, void *arg, int nlines, vid_line_t **lines)
 {
-	vid_line_t *l = lines[0];
-	int x;
+	return(_vid_fmmod_block(s, arg, nlines, lines, 1));
+}
+
+static int _vid_rfpost_block(vid_t *s, void *arg, int nlines, vid_line_t **lines, int count)
+{
+	vid_line_t *l;
+	cint16_t c[NCO_BLOCK];
+	cint16_t *o;
+	int16_t *p;
+	int16_t t;
+	int x, i, n;
 	
-	for(x = 0; x < l->width; x++)
+	for(l = lines[0]; count > 0; count--, l = l->next)
 	{
-		cint16_t a, b;
-		
-		cint32_mul(&s->offset.phase, &s->offset.phase, &s->offset.delta);
+		p = NULL;
 		
-		a.i = l->output[x * 2 + 0];
-		a.q = l->output[x * 2 + 1];
-		b.i = s->offset.phase.i >> 16;
-		b.q = s->offset.phase.q >> 16;
-		cint16_mul(&a, &a, &b);
-		
-		l->output[x * 2 + 0] = a.i;
-		l->output[x * 2 + 1] = a.q;
+		if(s->passthru && !s->passthru_z.eof)
+		{
+			i = iqz_read(&s->passthru_z, s->passline, sizeof(int16_t) * 2 * l->width);
+			
+			if(i > 0)
+			{
+				/* Pad the end of the file with silence */
+				memset((uint8_t *) s->passline + i, 0, sizeof(int16_t) * 2 * l->width - i);
+				p = s->passline;
+			}
+		}
 		
-		/* Correct the amplitude after INT16_MAX samples */
-		if(--s->offset.counter == 0)
+		/* Swap, shift and sum one block at a time, so each
+		 * part of the line is only loaded once */
+		for(x = 0; x < l->width; x += n)
 		{
-			double ra = atan2(s->offset.phase.q, s->offset.phase.i);
+			n = l->width - x;
+			if(n > NCO_BLOCK) n = NCO_BLOCK;
 			
-			s->offset.phase.i = lround(cos(ra) * INT32_MAX);
-			s->offset.phase.q = lround(sin(ra) * INT32_MAX);
+			o = (cint16_t *) &l->output[x * 2];
+			
+			if(s->conf.offset != 0)
+			{
+				nco_tone(&s->offset.nco, c, n);
+				s->offset.nco.kernels->mix(o, o, c, s->conf.swap_iq, n);
+			}
+			else if(s->conf.swap_iq != 0)
+			{
+				for(i = 0; i < n; i++)
+				{
+					t = o[i].i;
+					o[i].i = o[i].q;
+					o[i].q = t;
+				}
+			}
 			
-			s->offset.counter = INT16_MAX;
+			if(p)
+			{
+				for(i = 0; i < n * 2; i++)
+				{
+					l->output[x * 2 + i] += p[x * 2 + i];
+				}
+			}
 		}
 	}
 	
 	return(1);
 }
 
-static int _vid_passthru_process(vid_t *s, void *arg, int nlines, vid_line_t **lines)
+static int _vid_rfpost_process(vid_t *s, void *arg, int nlines, vid_line_t **lines)
 {
-	vid_line_t *l = lines[0];
-	int x;
-	
-	if(feof(s->passthru))
-	{
-		return(1);
-	}
-	
-	fread(s->passline, sizeof(int16_t) * 2, l->width, s->passthru);
-	
-	for(x = 0; x < l->width * 2; x++)
-	{
-		l->output[x] += s->passline[x];
-	}
-	
-	return(1);
+	return(_vid_rfpost_block(s, arg, nlines, lines, 1));
 }
 
 static int _add_lineprocess(vid_t *s, const char *name, int nlines, void *arg, vid_lineprocess_process_t pprocess, vid_lineprocess_free_t pfree)
@@ -3587,6 +3921,7 @@ static int _add_lineprocess(vid_t *s, const char *name, int nlines, void *arg, v
 	p->nlines = nlines;
 	p->arg = arg;
 	p->process = pprocess;
+	p->process_block = NULL;
 	p->free = pfree;
 	
 	p->lines = calloc(sizeof(vid_line_t *), nlines);
@@ -3601,6 +3936,92 @@ static int _add_lineprocess(vid_t *s, const char *name, int nlines, void *arg, v
 	return(VID_OK);
 }
 
+static void _set_lineprocess_block(vid_t *s, vid_lineprocess_block_t pblock)
+{
+	/* Add a multi-line callback to the last process added */
+	s->processes[s->nprocesses - 1].process_block = pblock;
+}
+
+static int _init_audio_process(vid_t *s)
+{
+	_vid_audio_process_t *p;
+	int f = 0;
+	int i, x = 0;
+	
+	if(s->conf.fm_mono_level > 0 && s->conf.fm_mono_carrier != 0)   f |= _AUDIO_FM_MONO;
+	if(s->conf.fm_left_level > 0 && s->conf.fm_left_carrier != 0)   f |= _AUDIO_FM_LEFT;
+	if(s->conf.fm_right_level > 0 && s->conf.fm_right_carrier != 0) f |= _AUDIO_FM_RIGHT;
+	if(s->conf.am_audio_level > 0 && s->conf.am_mono_carrier != 0)  f |= _AUDIO_AM_MONO;
+	if(s->conf.nicam_level > 0 && s->conf.nicam_carrier != 0)       f |= _AUDIO_NICAM;
+	if(s->conf.dance_level > 0 && s->conf.dance_carrier != 0)       f |= _AUDIO_DANCE;
+	if(s->conf.type == VID_MAC) f |= _AUDIO_MAC;
+	if(s->conf.sis)             f |= _AUDIO_SIS;
+	
+	if(s->conf.a2stereo)        f |= _AUDIO_A2;
+	
+	s->audio_flags = f;
+	
+	p = calloc(1, sizeof(_vid_audio_process_t));
+	if(!p)
+	{
+		return(VID_OUT_OF_MEMORY);
+	}
+	
+	/* The exact ratio is always used. Rates that don't reduce to a
+	 * small one are handled by the resampler with interpolated phases */
+	i = gcd(s->sample_rate, HACKTV_AUDIO_SAMPLE_RATE);
+	p->interpolation = s->sample_rate / i;
+	p->decimation = HACKTV_AUDIO_SAMPLE_RATE / i;
+	
+	/* Size the buffers for the widest line */
+	p->ilen = (int64_t) s->max_width * HACKTV_AUDIO_SAMPLE_RATE / s->sample_rate + 16;
+	p->olen = s->max_width + (p->interpolation + p->decimation - 1) / p->decimation * 2 + 2;
+	p->in = calloc(p->ilen * _AUDIO_STREAMS, sizeof(int16_t));
+	p->out = calloc(p->olen * _AUDIO_STREAMS, sizeof(int16_t));
+	
+	if(!p->in || !p->out)
+	{
+		_vid_audio_free(s, p);
+		return(VID_OUT_OF_MEMORY);
+	}
+	
+	/* Create a resampler for each active carrier */
+	for(i = 0; i < _AUDIO_STREAMS; i++)
+	{
+		static const int carriers[_AUDIO_STREAMS] = {
+			_AUDIO_FM_MONO, _AUDIO_FM_LEFT, _AUDIO_FM_RIGHT, _AUDIO_AM_MONO
+		};
+		
+		if((f & carriers[i]) == 0) continue;
+		
+		if(fir_int16_resampler_init(&p->fir[i], p->interpolation, p->decimation) != 0)
+		{
+			_vid_audio_free(s, p);
+			return(VID_OUT_OF_MEMORY);
+		}
+		
+		/* An approximate ratio would play the audio at the wrong speed */
+		if((int64_t) p->fir[i].interpolation * p->decimation != (int64_t) p->fir[i].decimation * p->interpolation)
+		{
+			fprintf(stderr, "Audio resampler: Unable to resample %d Hz to %d Hz exactly\n", HACKTV_AUDIO_SAMPLE_RATE, s->sample_rate);
+			_vid_audio_free(s, p);
+			return(VID_ERROR);
+		}
+		
+		if(x++ == 0) _report_resampler(s, "Audio", &p->fir[i]);
+	}
+	
+	for(i = 0; _audio_processes[i].carriers != -1; i++)
+	{
+		if(_audio_processes[i].carriers == (f & _AUDIO_CARRIERS))
+		{
+			break;
+		}
+	}
+	
+	return(_add_lineprocess(s, "audio", 1, p, _audio_processes[i].process, _vid_audio_free));
+}
+
 static int _calc_filter_delay(int width, int ntaps)
 {
 	int delay;
@@ -3626,7 +4047,13 @@ static int _init_vresampler(vid_t *s)
 		return(VID_OUT_OF_MEMORY);
 	}
 	
-	fir_int16_resampler_init(&p->fir, s->sample_rate, s->pixel_rate);
+	if(fir_int16_resampler_init(&p->fir, s->sample_rate, s->pixel_rate) != 0)
+	{
+		free(p);
+		return(VID_OUT_OF_MEMORY);
+	}
+	
+	_report_resampler(s, "Video", &p->fir);
 	
 	/* Update maximum line width */
 	width = (s->width * p->fir.interpolation + p->fir.decimation - 1) / p->fir.decimation;
@@ -3795,140 +4222,953 @@ vbidata_lut_t *_render_sync_pulses(vid_t *s, const double syncs[][4], int num)
 	return(lut);
 }
 
-int vid_init(vid_t *s, unsigned int sample_rate, unsigned int pixel_rate, const vid_config_t * const conf)
+/* Compare the new source frame with the last one for the replay cache */
+static void _vid_compare_frame(vid_t *s)
 {
-	int r, x;
-	int64_t c;
-	double d;
-	double glut[0x100];
-	double width;
-	double level, slevel;
-	vid_line_t *l;
+	_vid_replay_t *r = &s->replay;
+	const av_frame_t *f = &s->vframe;
+	const uint32_t *p;
+	uint32_t *c;
+	int x, y, changed;
+	
+	changed = f->width != r->ref.width ||
+	          f->height != r->ref.height ||
+	          f->interlaced != r->ref.interlaced ||
+	          f->pixel_aspect_ratio.num != r->ref.pixel_aspect_ratio.num ||
+	          f->pixel_aspect_ratio.den != r->ref.pixel_aspect_ratio.den ||
+	          (f->framebuffer == NULL) != (r->ref.framebuffer == NULL);
+	
+	r->ref = *f;
+	
+	if(f->framebuffer)
+	{
+		r->ref.framebuffer = r->ref_buf;
+		
+		for(c = r->ref_buf, y = 0; y < f->height; y++)
+		{
+			p = &f->framebuffer[y * f->line_stride];
+			
+			for(x = 0; x < f->width; x++, c++, p += f->pixel_stride)
+			{
+				changed |= *c != *p;
+				*c = *p;
+			}
+		}
+	}
 	
-	/* Seed the system's PRNG, used by some of the video scramblers */
-	srand(time(NULL));
+	if(changed)
+	{
+		atomic_fetch_add(&r->changes, 1);
+	}
+}
+
+static void _vid_read_frame(vid_t *s)
+{
+	av_read_video(&s->av, &s->vframe);
+	
+	av_rotate_frame(&s->vframe, s->conf.frame_orientation & 3);
+	if(s->conf.frame_orientation & VID_HFLIP) av_hflip_frame(&s->vframe);
+	if(s->conf.frame_orientation & VID_VFLIP) av_vflip_frame(&s->vframe);
+	
+	/* Crop frame to fit inside active video area */
+	av_crop_frame(&s->vframe,
+		(s->vframe.width - s->active_width) / 2,
+		(s->vframe.height - s->conf.active_lines) / 2,
+		s->active_width,
+		s->conf.active_lines
+	);
 	
-	memset(s, 0, sizeof(vid_t));
-	memcpy(&s->conf, conf, sizeof(vid_config_t));
+	/* Calculate frame offset from top left */
+	s->vframe_x = (s->active_width - s->vframe.width) / 2;
+	s->vframe_y = (s->conf.active_lines - s->vframe.height) / 2;
 	
-	s->sample_rate = sample_rate;
-	s->pixel_rate = pixel_rate ? pixel_rate : sample_rate;
+	if(s->replay.ref_buf)
+	{
+		_vid_compare_frame(s);
+	}
+}
+
+static int _vid_next_frame(vid_t *s)
+{
+	/* Load the next frame */
+	if(s->bline == 1 || (s->conf.interlace && s->bline == s->conf.hline))
+	{
+		/* Have we reached the end of the video? */
+		if(av_eof(&s->av))
+		{
+			return(-1);
+		}
+		
+		_vid_read_frame(s);
+	}
 	
-	_test_sample_rate(&s->conf, s->pixel_rate);
+	return(0);
+}
+
+static void _vid_run_processes(vid_t *s, int first, int last, int count)
+{
+	_lineprocess_t *p;
+	int i, j;
 	
-	/* Calculate the number of samples per line */
-	width = (double) s->conf.frame_rate.den / s->conf.frame_rate.num / s->conf.lines;
+	/* A single process may be able to handle all the lines at once */
+	p = &s->processes[first];
 	
-	s->width = round((double) s->pixel_rate * width);
-	s->half_width = round((double) s->pixel_rate * width / 2);
-	s->max_width = s->width;
+	if(first == last && p->process_block)
+	{
+		p->process_block(p->vid, p->arg, p->nlines, p->lines, count);
+		
+		for(j = 0; j < p->nlines; j++)
+		{
+			for(i = 0; i < count; i++)
+			{
+				p->lines[j] = p->lines[j]->next;
+			}
+		}
+		
+		return;
+	}
 	
-	/* Calculate the active video width and offset */
-	s->active_left = round(s->pixel_rate * s->conf.active_left);
-	s->active_width = ceil(s->pixel_rate * s->conf.active_width);
-	if(s->active_width > s->width) s->active_width = s->width;
+	for(; count > 0; count--)
+	{
+		for(i = first; i <= last; i++)
+		{
+			p = &s->processes[i];
+			
+			if(p->process)
+			{
+				p->process(p->vid, p->arg, p->nlines, p->lines);
+			}
+			
+			for(j = 0; j < p->nlines; j++)
+			{
+				p->lines[j] = p->lines[j]->next;
+			}
+		}
+	}
+}
+
+static void _vid_next_bline(vid_t *s)
+{
+	/* Advance the next line/frame counter */
+	if(s->bline++ == s->conf.lines)
+	{
+		s->bline = 1;
+		s->bframe++;
+	}
+}
+
+/* -=== Threaded pipeline ===- */
+
+/* The line processes are split into contiguous groups, the workers.
+ * Processes that share state are kept in the same group. In threaded
+ * mode each worker runs on its own thread, otherwise vid_next_block()
+ * runs each worker in turn over all the lines of the block.
+ * 
+ * Each worker counts the lines (ticks) it has
+ * completed. Adjacent processes share exactly one line of the ring, so
+ * a worker may start tick n once the worker before it has completed
+ * tick n. The first worker may run up to pipe_slack lines ahead of the
+ * line last released by vid_next_line(). Lines are handed over using
+ * the tick counters alone, the mutex is only used to sleep when a
+ * worker has nothing to do. */
+
+#define _VID_PIPE_SLACK 64
+
+static int _pipe_ready(vid_t *s, int w, unsigned int tick)
+{
+	if(w == s->nworkers)
+	{
+		/* The caller of vid_next_line(), wait for the last worker
+		 * to complete the line or for the first to report EOF */
+		if((int) (atomic_load(&s->workers[w - 1].ticks) - tick) > 0) return(1);
+		if(atomic_load(&s->pipe_eof) && atomic_load(&s->pipe_eof_tick) == tick) return(1);
+		return(0);
+	}
 	
-	/* Calculate signal levels */
-	/* slevel is the the sub-carrier level. When FM modulating
-	 * this is always 1.0, otherwise it equals the overall level */
-	slevel = s->conf.modulation == VID_FM ? 1.0 : s->conf.level;
+	if(atomic_load(&s->pipe_hold))
+	{
+		return(0);
+	}
 	
-	level = s->conf.video_level * slevel;
+	if(w == 0)
+	{
+		if(atomic_load(&s->pipe_eof)) return(0);
+		return((int) (tick - atomic_load(&s->pipe_otick)) <= s->pipe_slack);
+	}
 	
-	/* Invert the video levels if requested */
-	if(s->conf.invert_video)
+	return((int) (atomic_load(&s->workers[w - 1].ticks) - tick) > 0);
+}
+
+static void _pipe_notify(vid_t *s)
+{
+	/* Only take the lock if somebody is sleeping */
+	if(atomic_load(&s->pipe_waiters) > 0)
 	{
-		double t;
-		
-		/* Swap sync and white levels */
-		t = s->conf.white_level;
-		s->conf.white_level = s->conf.sync_level;
-		s->conf.sync_level = t;
-		
-		/* Adjust black and blanking levels */
-		s->conf.blanking_level = s->conf.sync_level - (s->conf.blanking_level - s->conf.white_level);
-		s->conf.black_level = s->conf.sync_level - (s->conf.black_level - s->conf.white_level);
+		pthread_mutex_lock(&s->pipe_mutex);
+		pthread_cond_broadcast(&s->pipe_cond);
+		pthread_mutex_unlock(&s->pipe_mutex);
+	}
+}
+
+static int _pipe_wait(vid_t *s, int w, unsigned int tick)
+{
+	if(_pipe_ready(s, w, tick))
+	{
+		return(0);
 	}
 	
-	/* Calculate 16-bit blank and sync levels */
-	s->white_level    = round(s->conf.white_level    * level * INT16_MAX);
-	s->black_level    = round(s->conf.black_level    * level * INT16_MAX);
-	s->blanking_level = round(s->conf.blanking_level * level * INT16_MAX);
-	s->sync_level     = round(s->conf.sync_level     * level * INT16_MAX);
+	pthread_mutex_lock(&s->pipe_mutex);
+	atomic_fetch_add(&s->pipe_waiters, 1);
 	
-	/* Pre-render the sync pulses */
-	d = (s->conf.sync_level - s->conf.blanking_level) * level * INT16_MAX;
-	s->syncs = _render_sync_pulses(s, (const double[][4]) {
-		{ 0,         s->conf.hsync_width,       s->conf.sync_rise, d },
-		{ 0,         s->conf.vsync_short_width, s->conf.sync_rise, d },
-		{ 0,         s->conf.vsync_long_width,  s->conf.sync_rise, d },
-		{ width / 2, s->conf.vsync_short_width, s->conf.sync_rise, d },
-		{ width / 2, s->conf.vsync_long_width,  s->conf.sync_rise, d },
-	}, 5);
-	if(s->syncs == NULL)
+	if(w < s->nworkers)
 	{
-		return(VID_OUT_OF_MEMORY);
+		s->pipe_parked++;
+		
+		/* Wake vid_av_close() if it's waiting for us */
+		if(atomic_load(&s->pipe_hold))
+		{
+			pthread_cond_broadcast(&s->pipe_cond);
+		}
 	}
 	
-	/* Allocate memory for YUV lookup tables */
-	s->yiq_level_lookup = malloc(0x1000000 * sizeof(_yiq16_t));
-	if(s->yiq_level_lookup == NULL)
+	while(!atomic_load(&s->pipe_abort) && !_pipe_ready(s, w, tick))
 	{
-		vid_free(s);
-		return(VID_OUT_OF_MEMORY);
+		pthread_cond_wait(&s->pipe_cond, &s->pipe_mutex);
 	}
 	
-	/* Generate the gamma lookup table. LUTception */
-	if(s->conf.gamma <= 0)
+	if(w < s->nworkers)
 	{
-		s->conf.gamma = 1.0;
+		s->pipe_parked--;
 	}
 	
-	for(c = 0; c < 0x100; c++)
+	atomic_fetch_sub(&s->pipe_waiters, 1);
+	pthread_mutex_unlock(&s->pipe_mutex);
+	
+	return(atomic_load(&s->pipe_abort) ? -1 : 0);
+}
+
+/* Stop the workers at the end of their current line, so the
+ * caller can use the source and line process state */
+static void _vid_pipe_hold(vid_t *s)
+{
+	if(!s->pipe_threads)
 	{
-		glut[c] = pow((double) c / 255, 1 / s->conf.gamma);
+		return;
+	}
+	
+	pthread_mutex_lock(&s->pipe_mutex);
+	atomic_store(&s->pipe_hold, 1);
+	atomic_fetch_add(&s->pipe_waiters, 1);
+	
+	while(s->pipe_parked < s->nworkers)
+	{
+		pthread_cond_wait(&s->pipe_cond, &s->pipe_mutex);
+	}
+	
+	atomic_fetch_sub(&s->pipe_waiters, 1);
+	pthread_mutex_unlock(&s->pipe_mutex);
+}
+
+static void *_vid_worker_thread(void *arg)
+{
+	_vid_worker_t *w = arg;
+	vid_t *s = w->vid;
+	int n = w - s->workers;
+	unsigned int tick = 0;
+	
+	while(_pipe_wait(s, n, tick) == 0)
+	{
+		if(n == 0 && _vid_next_frame(s) != 0)
+		{
+			/* End of the source. Park until vid_next_line()
+			 * has returned the remaining lines and resumes */
+			atomic_store(&s->pipe_eof_tick, tick);
+			atomic_store(&s->pipe_eof, 1);
+			_pipe_notify(s);
+			continue;
+		}
+		
+		_vid_run_processes(s, w->first, w->last, 1);
+		
+		if(n == 0)
+		{
+			_vid_next_bline(s);
+		}
+		
+		atomic_store(&w->ticks, ++tick);
+		_pipe_notify(s);
+	}
+	
+	return(NULL);
+}
+
+static int _find_lineprocess(vid_t *s, const char *name)
+{
+	int i;
+	
+	for(i = 0; i < s->nprocesses; i++)
+	{
+		if(strcmp(s->processes[i].name, name) == 0)
+		{
+			return(i);
+		}
+	}
+	
+	return(-1);
+}
+
+static void _join_lineprocesses(int *join, int first, int last)
+{
+	/* Force processes first to last onto the same worker */
+	if(first < 0 || last < 0) return;
+	
+	for(first++; first <= last; first++)
+	{
+		join[first] = 1;
+	}
+}
+
+static int _init_pipeline(vid_t *s)
+{
+	int *join;
+	int i, n;
+	
+	/* Cut-and-rotate and Eurocrypt EMMs depend on the frame number last
+	 * returned by vid_next_line(), which the workers can't see */
+	if(s->conf.systercnr || s->conf.eurocrypt)
+	{
+		if(s->conf.threaded)
+		{
+			fprintf(stderr, "Warning: Threaded mode is not supported with this configuration. Using a single thread.\n");
+		}
+		
+		return(VID_OK);
+	}
+	
+	/* The output process is not run by any worker */
+	n = s->nprocesses - 1;
+	
+	join = calloc(sizeof(int), n);
+	if(!join)
+	{
+		return(VID_OUT_OF_MEMORY);
+	}
+	
+	/* Some processes share state with an earlier one */
+	if(s->conf.wss && s->wss.code == 0xFF)
+	{
+		/* Automatic WSS follows the aspect of the current frame */
+		_join_lineprocesses(join, 0, _find_lineprocess(s, "wss"));
+	}
+	
+	if(s->conf.type == VID_MAC)
+	{
+		/* The MAC raster reads the audio packets */
+		_join_lineprocesses(join, 0, _find_lineprocess(s, "audio"));
+	}
+	
+	if(s->conf.sis)
+	{
+		_join_lineprocesses(join, _find_lineprocess(s, "sis"), _find_lineprocess(s, "audio"));
+	}
+	
+	for(s->nworkers = i = 0; i < n; i++)
+	{
+		if(!join[i]) s->nworkers++;
+	}
+	
+	s->workers = calloc(sizeof(_vid_worker_t), s->nworkers);
+	if(!s->workers)
+	{
+		free(join);
+		s->nworkers = 0;
+		return(VID_OUT_OF_MEMORY);
+	}
+	
+	for(s->nworkers = i = 0; i < n; i++)
+	{
+		if(!join[i])
+		{
+			s->workers[s->nworkers++].first = i;
+		}
+		
+		s->workers[s->nworkers - 1].last = i;
+	}
+	
+	free(join);
+	
+	/* Extra lines to let the workers run ahead */
+	s->pipe_slack = s->conf.threaded ? _VID_PIPE_SLACK : 0;
+	
+	if(s->pipe_slack < s->block_lines - 1)
+	{
+		s->pipe_slack = s->block_lines - 1;
+	}
+	
+	s->olines += s->pipe_slack;
+	
+	return(VID_OK);
+}
+
+static void _stop_pipeline(vid_t *s, int nthreads)
+{
+	int i;
+	
+	atomic_store(&s->pipe_abort, 1);
+	
+	pthread_mutex_lock(&s->pipe_mutex);
+	pthread_cond_broadcast(&s->pipe_cond);
+	pthread_mutex_unlock(&s->pipe_mutex);
+	
+	for(i = 0; i < nthreads; i++)
+	{
+		pthread_join(s->workers[i].thread, NULL);
+	}
+	
+	pthread_cond_destroy(&s->pipe_cond);
+	pthread_mutex_destroy(&s->pipe_mutex);
+	
+	s->pipe_threads = 0;
+}
+
+static void _start_pipeline(vid_t *s)
+{
+	int i;
+	
+	pthread_mutex_init(&s->pipe_mutex, NULL);
+	pthread_cond_init(&s->pipe_cond, NULL);
+	
+	atomic_init(&s->pipe_otick, 0);
+	atomic_init(&s->pipe_eof_tick, 0);
+	atomic_init(&s->pipe_eof, 0);
+	atomic_init(&s->pipe_abort, 0);
+	atomic_init(&s->pipe_waiters, 0);
+	
+	/* The workers are held until the first call to vid_next_line(),
+	 * the AV source is not open yet */
+	atomic_init(&s->pipe_hold, 1);
+	s->pipe_parked = 0;
+	s->pipe_held = 0;
+	s->pipe_eof_seen = 0;
+	
+	for(i = 0; i < s->nworkers; i++)
+	{
+		s->workers[i].vid = s;
+		atomic_init(&s->workers[i].ticks, 0);
+		
+		if(pthread_create(&s->workers[i].thread, NULL, &_vid_worker_thread, &s->workers[i]) != 0)
+		{
+			/* The ring still works for the serial version */
+			fprintf(stderr, "Warning: Failed to start the line process threads. Using a single thread.\n");
+			_stop_pipeline(s, i);
+			return;
+		}
+	}
+	
+	s->pipe_threads = 1;
+}
+
+/* -=== Replay cache ===- */
+
+/* For a static source the output repeats once the raster, colour
+ * subcarrier and SECAM line phase are back where they started. One
+ * such cycle is copied from the output of vid_next_block() into a
+ * memory mapped buffer and played back from there, without running
+ * the line processes.
+ * 
+ * In VID_REPLAY_AUTO mode the next cycle is compared with the cached
+ * one, and replay starts only if the two match exactly. The audio
+ * carriers and FM video modulator don't return to the same phase each
+ * cycle, so in practice this needs a mode without them or --noaudio.
+ * While the cache is playing the source is still read at the normal
+ * rate, and the first frame that differs from the last one drops back
+ * to live rendering. Anything else that changes the output, such as a
+ * teletext clock, is caught by rendering one cycle live about once a
+ * second and comparing it with the cache.
+ * 
+ * VID_REPLAY_ON trusts that the source is static and starts replaying
+ * after the first cycle, without reading the source again. It accepts
+ * a small jump in carrier phase each time the cycle repeats.
+ * 
+ * Capture starts from the second cycle, once any filters have
+ * settled. Before going back to live rendering the replay continues
+ * until it reaches the line where the line processes were stopped, so
+ * the output continues without a break in the raster. */
+
+#define _REPLAY_MAX_FRAMES 16
+
+#define _REPLAY_WAIT    0 /* Waiting for the start of a cycle */
+#define _REPLAY_CAPTURE 1
+#define _REPLAY_VERIFY  2
+#define _REPLAY_PLAY    3
+#define _REPLAY_DRAIN   4 /* Playing until the resume line */
+
+static int _replay_cycle_frames(vid_t *s)
+{
+	int64_t f = 1;
+	int64_t l;
+	
+	if(s->conf.colour_mode == VID_PAL ||
+	   s->conf.colour_mode == VID_NTSC)
+	{
+		/* Lines until the subcarrier lookup offset wraps */
+		l = s->colour_lookup_width / gcd(s->colour_lookup_width, s->width);
+		f = l / gcd(l, s->conf.lines);
+		
+		/* The burst and PAL V-switch alternate each frame */
+		if(f % 2) f *= 2;
+	}
+	else if(s->conf.colour_mode == VID_SECAM)
+	{
+		/* The FM phase alternates every third line,
+		 * and D'r / D'b every line */
+		f = 6 / gcd(6, s->conf.lines);
+	}
+	else if(s->conf.colour_mode == VID_APOLLO_FSC ||
+	        s->conf.colour_mode == VID_CBS_FSC)
+	{
+		/* One colour per field */
+		f = 3;
+	}
+	
+	return(f);
+}
+
+static int _init_replay(vid_t *s)
+{
+	_vid_replay_t *r = &s->replay;
+	
+	r->frames = _replay_cycle_frames(s);
+	
+	if(r->frames > _REPLAY_MAX_FRAMES)
+	{
+		fprintf(stderr, "Warning: The output repeats every %d frames, too long to cache. Replay disabled.\n", r->frames);
+		return(VID_OK);
+	}
+	
+	r->lines = r->frames * s->conf.lines;
+	r->size = sizeof(int16_t) * 2 * s->max_width * r->lines;
+	
+	r->offset = calloc(r->lines + 1, sizeof(size_t));
+	if(!r->offset)
+	{
+		return(VID_OUT_OF_MEMORY);
+	}
+	
+	if(s->conf.replay == VID_REPLAY_AUTO)
+	{
+		/* Cropped source frames are never larger than the active area */
+		r->ref_buf = malloc(sizeof(uint32_t) * s->active_width * s->conf.active_lines);
+		if(!r->ref_buf)
+		{
+			return(VID_OUT_OF_MEMORY);
+		}
+		
+		/* Check the live output about once a second */
+		r->play_cycles = s->conf.frame_rate.num / s->conf.frame_rate.den / r->frames;
+		if(r->play_cycles < 1) r->play_cycles = 1;
+	}
+
+#ifndef WIN32
+	r->buf = mmap(NULL, r->size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if(r->buf == MAP_FAILED)
+	{
+		r->buf = NULL;
+	}
+#else
+	r->buf = malloc(r->size);
+#endif
+	
+	if(!r->buf)
+	{
+		return(VID_OUT_OF_MEMORY);
+	}
+	
+	r->state = _REPLAY_WAIT;
+	
+	return(VID_OK);
+}
+
+static void _free_replay(vid_t *s)
+{
+	_vid_replay_t *r = &s->replay;
+	
+	if(r->buf)
+	{
+#ifndef WIN32
+		munmap(r->buf, r->size);
+#else
+		free(r->buf);
+#endif
+	}
+	
+	free(r->offset);
+	free(r->ref_buf);
+}
+
+static void _replay_start(vid_t *s, int frame)
+{
+	_vid_replay_t *r = &s->replay;
+	
+	/* frame is the frame number of the line at pos */
+	r->state = _REPLAY_PLAY;
+	r->resume = r->pos;
+	r->frame = frame - r->pos / s->conf.lines;
+	r->cycles = 0;
+	r->held = 0;
+	r->reading = s->conf.replay == VID_REPLAY_AUTO;
+	
+	if(!r->recheck && s->conf.verbose)
+	{
+		fprintf(stderr, "Replaying %d frame%s from the cache.\n", r->frames, r->frames == 1 ? "" : "s");
+	}
+}
+
+/* Stop playing once the replay is back in step with the line processes */
+static void _replay_stop(vid_t *s, int next)
+{
+	_vid_replay_t *r = &s->replay;
+	
+	if(r->state == _REPLAY_PLAY)
+	{
+		r->state = _REPLAY_DRAIN;
+		r->next = next;
+	}
+}
+
+/* Called for each rendered output line */
+static void _replay_line(vid_t *s, const vid_line_t *l, int frame)
+{
+	_vid_replay_t *r = &s->replay;
+	const int16_t *c;
+	
+	switch(r->state)
+	{
+	case _REPLAY_WAIT:
+		
+		if(l->line != 1 || frame < r->frames || frame % r->frames != 0)
+		{
+			break;
+		}
+		
+		r->state = _REPLAY_CAPTURE;
+		r->pos = 0;
+		r->capture_changes = atomic_load(&r->changes);
+		
+		/* Fall through */
+	
+	case _REPLAY_CAPTURE:
+		
+		memcpy(&r->buf[r->offset[r->pos] * 2], l->output, sizeof(int16_t) * 2 * l->width);
+		r->offset[r->pos + 1] = r->offset[r->pos] + l->width;
+		
+		if(++r->pos < r->lines)
+		{
+			break;
+		}
+		
+		r->pos = 0;
+		r->recheck = 0;
+		
+		if(s->conf.replay == VID_REPLAY_ON)
+		{
+			_replay_start(s, frame + 1);
+		}
+		else
+		{
+			r->state = _REPLAY_VERIFY;
+			r->verified = 0;
+		}
+		
+		break;
+	
+	case _REPLAY_VERIFY:
+		
+		c = &r->buf[r->offset[r->pos] * 2];
+		
+		if(l->width != r->offset[r->pos + 1] - r->offset[r->pos] ||
+		   memcmp(c, l->output, sizeof(int16_t) * 2 * l->width) != 0)
+		{
+			/* Not static (yet), try again from the next cycle */
+			r->state = _REPLAY_WAIT;
+			break;
+		}
+		
+		r->pos = (r->pos + 1) % r->lines;
+		
+		if(++r->verified == r->lines)
+		{
+			_replay_start(s, frame + (l->line == s->conf.lines));
+		}
+		
+		break;
+	
+	case _REPLAY_PLAY:
+		
+		/* The rest of the block after replay was
+		 * enabled, the live output is still in step */
+		if(++r->pos == r->lines)
+		{
+			r->pos = 0;
+			r->frame += r->frames;
+		}
+		
+		r->resume = r->pos;
+		
+		break;
+	}
+}
+
+/* Reads the source frame due at line i of the cycle. Returns 1 if
+ * it has changed, or -1 at the end of the source */
+static int _replay_read(vid_t *s, int i)
+{
+	_vid_replay_t *r = &s->replay;
+	int line = i % s->conf.lines + 1;
+	
+	if(line != 1 && (!s->conf.interlace || line != s->conf.hline))
+	{
+		return(0);
+	}
+	
+	if(av_eof(&s->av))
+	{
+		return(-1);
+	}
+	
+	_vid_read_frame(s);
+	
+	return(atomic_load(&r->changes) != r->capture_changes);
+}
+
+static int16_t *_replay_block(vid_t *s, int n, size_t *samples)
+{
+	_vid_replay_t *r = &s->replay;
+	int16_t *data;
+	int i, d, c;
+	
+	if(r->eof)
+	{
+		return(NULL);
+	}
+	
+	if(r->state == _REPLAY_PLAY && r->reading)
+	{
+		if(!r->held)
+		{
+			/* The source is read from here until live rendering
+			 * resumes. The line processes may also have read
+			 * ahead past a change before they were stopped */
+			_vid_pipe_hold(s);
+			r->held = 1;
+			
+			if(atomic_load(&r->changes) != r->capture_changes)
+			{
+				_replay_stop(s, _REPLAY_WAIT);
+			}
+		}
+		
+		if(r->cycles >= r->play_cycles)
+		{
+			_replay_stop(s, _REPLAY_VERIFY);
+		}
+	}
+	
+	if(r->state == _REPLAY_DRAIN)
+	{
+		d = (r->resume - r->pos + r->lines) % r->lines;
+		
+		if(d == 0)
+		{
+			/* Back in step with the line processes */
+			r->state = r->next;
+			r->verified = 0;
+			r->recheck = 1;
+			return(NULL);
+		}
+		
+		if(n > d) n = d;
+	}
+	
+	/* Don't run past the end of the cycle */
+	if(n > r->lines - r->pos) n = r->lines - r->pos;
+	
+	for(i = r->pos; i < r->pos + n; i++)
+	{
+		c = r->reading ? _replay_read(s, i) : 0;
+		
+		if(c < 0)
+		{
+			/* End the output where the source ends, as the line
+			 * processes would. The rest is drained if another
+			 * source follows */
+			_replay_stop(s, _REPLAY_WAIT);
+			r->reading = 0;
+			r->eof = 1;
+			n = i - r->pos;
+			
+			if(n == 0)
+			{
+				return(NULL);
+			}
+			
+			break;
+		}
+		else if(c > 0)
+		{
+			_replay_stop(s, _REPLAY_WAIT);
+			
+			/* Stop at the resume line if it's still to come in
+			 * this block, otherwise drain into the next cycle */
+			d = (r->resume - r->pos + r->lines) % r->lines;
+			if(d > i - r->pos && n > d) n = d;
+		}
+		
+		if(i % s->conf.lines == 0)
+		{
+			s->frame_starts[s->nframe_starts].offset = r->offset[i] - r->offset[r->pos];
+			s->frame_starts[s->nframe_starts].frame = r->frame + i / s->conf.lines;
+			s->nframe_starts++;
+		}
+	}
+	
+	data = &r->buf[r->offset[r->pos] * 2];
+	
+	if(samples)
+	{
+		*samples = r->offset[r->pos + n] - r->offset[r->pos];
+	}
+	
+	i = r->pos + n - 1;
+	s->frame = r->frame + i / s->conf.lines;
+	s->line  = i % s->conf.lines + 1;
+	
+	r->pos += n;
+	if(r->pos == r->lines)
+	{
+		r->pos = 0;
+		r->frame += r->frames;
+		r->skipped += r->frames;
+		r->cycles++;
+	}
+	
+	return(data);
+}
+
+int vid_init(vid_t *s, unsigned int sample_rate, unsigned int pixel_rate, const vid_config_t * const conf)
+{
+	int r, x;
+	int64_t c;
+	double d;
+	double glut[0x100];
+	double width;
+	double level, slevel;
+	vid_line_t *l;
+	
+	/* Seed the system's PRNG, used by some of the video scramblers */
+	srand(time(NULL));
+	
+	memset(s, 0, sizeof(vid_t));
+	memcpy(&s->conf, conf, sizeof(vid_config_t));
+	
+	s->sample_rate = sample_rate;
+	s->pixel_rate = pixel_rate ? pixel_rate : sample_rate;
+	
+	/* Select the SIMD kernels for this CPU */
+	s->composite = composite_kernels(cpu_features());
+	s->secam = secam_kernels(cpu_features());
+	
+	_test_sample_rate(&s->conf, s->pixel_rate);
+	
+	/* Calculate the number of samples per line */
+	width = (double) s->conf.frame_rate.den / s->conf.frame_rate.num / s->conf.lines;
+	
+	s->width = round((double) s->pixel_rate * width);
+	s->half_width = round((double) s->pixel_rate * width / 2);
+	s->max_width = s->width;
+	
+	/* Calculate the active video width and offset */
+	s->active_left = round(s->pixel_rate * s->conf.active_left);
+	s->active_width = ceil(s->pixel_rate * s->conf.active_width);
+	if(s->active_width > s->width) s->active_width = s->width;
+	
+	/* Calculate signal levels */
+	/* slevel is the the sub-carrier level. When FM modulating
+	 * this is always 1.0, otherwise it equals the overall level */
+	slevel = s->conf.modulation == VID_FM ? 1.0 : s->conf.level;
+	
+	level = s->conf.video_level * slevel;
+	
+	/* Invert the video levels if requested */
+	if(s->conf.invert_video)
+	{
+		double t;
+		
+		/* Swap sync and white levels */
+		t = s->conf.white_level;
+		s->conf.white_level = s->conf.sync_level;
+		s->conf.sync_level = t;
+		
+		/* Adjust black and blanking levels */
+		s->conf.blanking_level = s->conf.sync_level - (s->conf.blanking_level - s->conf.white_level);
+		s->conf.black_level = s->conf.sync_level - (s->conf.black_level - s->conf.white_level);
+	}
+	
+	/* Calculate 16-bit blank and sync levels */
+	s->white_level    = round(s->conf.white_level    * level * INT16_MAX);
+	s->black_level    = round(s->conf.black_level    * level * INT16_MAX);
+	s->blanking_level = round(s->conf.blanking_level * level * INT16_MAX);
+	s->sync_level     = round(s->conf.sync_level     * level * INT16_MAX);
+	
+	/* Pre-render the sync pulses */
+	d = (s->conf.sync_level - s->conf.blanking_level) * level * INT16_MAX;
+	s->syncs = _render_sync_pulses(s, (const double[][4]) {
+		{ 0,         s->conf.hsync_width,       s->conf.sync_rise, d },
+		{ 0,         s->conf.vsync_short_width, s->conf.sync_rise, d },
+		{ 0,         s->conf.vsync_long_width,  s->conf.sync_rise, d },
+		{ width / 2, s->conf.vsync_short_width, s->conf.sync_rise, d },
+		{ width / 2, s->conf.vsync_long_width,  s->conf.sync_rise, d },
+	}, 5);
+	if(s->syncs == NULL)
+	{
+		return(VID_OUT_OF_MEMORY);
+	}
+	
+	/* Generate the gamma lookup table. LUTception */
+	if(s->conf.gamma <= 0)
+	{
+		s->conf.gamma = 1.0;
+	}
+	
+	for(c = 0; c < 0x100; c++)
+	{
+		glut[c] = pow((double) c / 255, 1 / s->conf.gamma);
+	}
+	
+	/* Generate the RGB > signal level lookup tables */
+	if(s->conf.compact_colour)
+	{
+		r = _init_yiq_channel_lookup(s, level, glut);
+	}
+	else
+	{
+		r = _init_yiq_lookup(s, level, glut);
+	}
+	
+	if(r != VID_OK)
+	{
+		vid_free(s);
+		return(r);
 	}
 	
-	/* Generate the RGB > signal level lookup tables */
-	for(c = 0x000000; c <= 0xFFFFFF; c++)
+	s->yiq_black = vid_rgb_to_yiq(s, 0x000000);
+	
+	/* Converted pixels for the current line */
+	s->yiq_line = malloc(sizeof(_yiq16_t) * s->active_width);
+	if(s->yiq_line == NULL)
 	{
-		double r, g, b;
-		double y, u, v;
-		double i, q;
-		
-		/* Calculate RGB 0..1 values */
-		r = glut[(c & 0xFF0000) >> 16];
-		g = glut[(c & 0x00FF00) >> 8];
-		b = glut[(c & 0x0000FF) >> 0];
-		
-		/* Calculate Y, Cb and Cr values */
-		y = r * s->conf.rw_co
-		  + g * s->conf.gw_co
-		  + b * s->conf.bw_co;
-		u = (b - y);
-		v = (r - y);
-		
-		i = s->conf.eu_co * u;
-		q = s->conf.ev_co * v;
-		
-		/* Adjust values to correct signal level */
-		y = (s->conf.black_level + (y * (s->conf.white_level - s->conf.black_level))) * level;
-		
-		if(s->conf.colour_mode != VID_SECAM)
-		{
-			i *= (s->conf.white_level - s->conf.black_level) * level;
-			q *= (s->conf.white_level - s->conf.black_level) * level;
-		}
-		else
-		{
-			i = (i + SECAM_CB_FREQ - SECAM_FM_FREQ) / SECAM_FM_DEV;
-			q = (q + SECAM_CR_FREQ - SECAM_FM_FREQ) / SECAM_FM_DEV;
-		}
-		
-		/* Convert to INT16 range and store in tables */
-		s->yiq_level_lookup[c].y = round(_dlimit(y, -1, 1) * INT16_MAX);
-		s->yiq_level_lookup[c].i = round(_dlimit(i, -1, 1) * INT16_MAX);
-		s->yiq_level_lookup[c].q = round(_dlimit(q, -1, 1) * INT16_MAX);
+		vid_free(s);
+		return(VID_OUT_OF_MEMORY);
 	}
 	
 	if(s->conf.colour_mode == VID_PAL ||
@@ -3999,6 +5239,24 @@ int vid_init(vid_t *s, unsigned int sample_rate, unsigned int pixel_rate, const
 			/* NTSC has a 180° burst */
 			s->burst_phase = (cint16_t) { -INT16_MAX, 0 };
 		}
+		
+		if(s->conf.colour_mode == VID_PAL ||
+		   s->conf.colour_mode == VID_NTSC)
+		{
+			/* Pre-render the burst chrominance */
+			s->burst_chroma = malloc(sizeof(int16_t) * 2 * s->burst_width);
+			if(!s->burst_chroma)
+			{
+				vid_free(s);
+				return(VID_OUT_OF_MEMORY);
+			}
+			
+			for(x = 0; x < s->burst_width; x++)
+			{
+				s->burst_chroma[x * 2 + 0] = (s->burst_phase.i * s->burst_win[x]) >> 15;
+				s->burst_chroma[x * 2 + 1] = (s->burst_phase.q * s->burst_win[x]) >> 15;
+			}
+		}
 	}
 	
 	/* Pre-render the FSC pulses */
@@ -4031,7 +5289,7 @@ int vid_init(vid_t *s, unsigned int sample_rate, unsigned int pixel_rate, const
 		double secam_level = (s->conf.white_level - s->conf.blanking_level) * level;
 		double taps[51];
 		
-		r = _init_fm_modulator(&s->fm_secam, s->pixel_rate, SECAM_FM_FREQ, SECAM_FM_DEV, secam_level);
+		r = _init_fm_modulator(s, &s->fm_secam, s->pixel_rate, SECAM_FM_FREQ, SECAM_FM_DEV, secam_level);
 		if(r != VID_OK)
 		{
 			vid_free(s);
@@ -4042,10 +5300,10 @@ int vid_init(vid_t *s, unsigned int sample_rate, unsigned int pixel_rate, const
 			(const double [2]) { 1.0, -0.90456054 },
 			(const double [2]) { 2.90456054, -2.80912108 }
 		);
-		if(r != VID_OK)
+		if(r != 0)
 		{
 			vid_free(s);
-			return(r);
+			return(VID_OUT_OF_MEMORY);
 		}
 		
 		fir_low_pass(taps, 51, s->pixel_rate, 1.50e6, 0.50e6, 1.0);
@@ -4066,21 +5324,18 @@ int vid_init(vid_t *s, unsigned int sample_rate, unsigned int pixel_rate, const
 		s->fm_secam_dmin[1] = lround((SECAM_CR_FREQ - SECAM_FM_FREQ - 506e3) / SECAM_FM_DEV * INT16_MAX);
 		s->fm_secam_dmax[1] = lround((SECAM_CR_FREQ - SECAM_FM_FREQ + 350e3) / SECAM_FM_DEV * INT16_MAX);
 		
-		s->fm_secam_bell = malloc(sizeof(cint16_t) * UINT16_MAX);
-		if(!s->fm_secam_bell)
+		/* The bell filter only needs to cover the limited deviation */
+		r = secam_bell_init(&s->fm_secam_bell, SECAM_FM_FREQ, SECAM_FM_DEV,
+			s->fm_secam_dmin[0] < s->fm_secam_dmin[1] ? s->fm_secam_dmin[0] : s->fm_secam_dmin[1],
+			s->fm_secam_dmax[0] > s->fm_secam_dmax[1] ? s->fm_secam_dmax[0] : s->fm_secam_dmax[1],
+			secam_level
+		);
+		if(r != 0)
 		{
 			vid_free(s);
 			return(VID_OUT_OF_MEMORY);
 		}
 		
-		for(r = INT16_MIN; r <= INT16_MAX; r++)
-		{
-			double dg[2];
-			_secam_g(dg, SECAM_FM_FREQ + (double) r * SECAM_FM_DEV / INT16_MAX);
-			s->fm_secam_bell[(uint16_t) r].i = lround(dg[0] * INT16_MAX);
-			s->fm_secam_bell[(uint16_t) r].q = lround(dg[1] * INT16_MAX);
-		}
-		
 		/* Field sync levels (optional) */
 		s->secam_fsync_level = round(350e3 / SECAM_FM_DEV * INT16_MAX);
 		
@@ -4099,8 +5354,9 @@ int vid_init(vid_t *s, unsigned int sample_rate, unsigned int pixel_rate, const
 			return(VID_OUT_OF_MEMORY);
 		}
 		
-		/* Allocate memory for the chrominance baseband buffer */
-		s->chrominance_buffer = malloc(sizeof(int16_t) * s->width);
+		/* Allocate memory for the chrominance baseband buffer. The FIR
+		 * filter reads half its taps beyond the end, keep these zero */
+		s->chrominance_buffer = calloc(s->width + 51 / 2, sizeof(int16_t));
 		if(!s->chrominance_buffer)
 		{
 			vid_free(s);
@@ -4151,6 +5407,13 @@ int vid_init(vid_t *s, unsigned int sample_rate, unsigned int pixel_rate, const
 	}
 	else
 	{
+		r = _init_raster(s);
+		
+		if(r != VID_OK)
+		{
+			return(r);
+		}
+		
 		_add_lineprocess(s, "raster", 3, NULL, _vid_next_line_raster, NULL);
 	}
 	
@@ -4327,7 +5590,7 @@ int vid_init(vid_t *s, unsigned int sample_rate, unsigned int pixel_rate, const
 	/* FM audio */
 	if(s->conf.fm_mono_level > 0 && s->conf.fm_mono_carrier != 0)
 	{
-		r = _init_fm_modulator(&s->fm_mono, s->sample_rate, s->conf.fm_mono_carrier, s->conf.fm_mono_deviation, s->conf.fm_mono_level * slevel);
+		r = _init_fm_modulator(s, &s->fm_mono, s->sample_rate, s->conf.fm_mono_carrier, s->conf.fm_mono_deviation, s->conf.fm_mono_level * slevel);
 		if(r != VID_OK)
 		{
 			vid_free(s);
@@ -4368,7 +5631,7 @@ int vid_init(vid_t *s, unsigned int sample_rate, unsigned int pixel_rate, const
 	
 	if(s->conf.fm_left_level > 0 && s->conf.fm_left_carrier != 0)
 	{
-		r = _init_fm_modulator(&s->fm_left, s->sample_rate, s->conf.fm_left_carrier, s->conf.fm_left_deviation, s->conf.fm_left_level * slevel);
+		r = _init_fm_modulator(s, &s->fm_left, s->sample_rate, s->conf.fm_left_carrier, s->conf.fm_left_deviation, s->conf.fm_left_level * slevel);
 		if(r != VID_OK)
 		{
 			vid_free(s);
@@ -4409,7 +5672,7 @@ int vid_init(vid_t *s, unsigned int sample_rate, unsigned int pixel_rate, const
 	
 	if(s->conf.fm_right_level > 0 && s->conf.fm_right_carrier != 0)
 	{
-		r = _init_fm_modulator(&s->fm_right, s->sample_rate, s->conf.fm_right_carrier, s->conf.fm_right_deviation, s->conf.fm_right_level * slevel);
+		r = _init_fm_modulator(s, &s->fm_right, s->sample_rate, s->conf.fm_right_carrier, s->conf.fm_right_deviation, s->conf.fm_right_level * slevel);
 		if(r != VID_OK)
 		{
 			vid_free(s);
@@ -4494,13 +5757,18 @@ int vid_init(vid_t *s, unsigned int sample_rate, unsigned int pixel_rate, const
 	/* Add the audio process */
 	if(s->audio == 1)
 	{
-		_add_lineprocess(s, "audio", 1, NULL, _vid_audio_process, NULL);
+		r = _init_audio_process(s);
+		if(r != VID_OK)
+		{
+			vid_free(s);
+			return(r);
+		}
 	}
 	
 	/* FM video */
 	if(s->conf.modulation == VID_FM)
 	{
-		r = _init_fm_modulator(&s->fm_video, s->sample_rate, 0, s->conf.fm_deviation, s->conf.fm_level * s->conf.level);
+		r = _init_fm_modulator(s, &s->fm_video, s->sample_rate, 0, s->conf.fm_deviation, s->conf.fm_level * s->conf.level);
 		if(r != VID_OK)
 		{
 			vid_free(s);
@@ -4519,26 +5787,12 @@ int vid_init(vid_t *s, unsigned int sample_rate, unsigned int pixel_rate, const
 		}
 		
 		_add_lineprocess(s, "fmmod", 1, NULL, _vid_fmmod_process, NULL);
-	}
-	
-	if(s->conf.swap_iq != 0)
-	{
-		_add_lineprocess(s, "swap_iq", 1, NULL, _vid_swap_iq_process, NULL);
+		_set_lineprocess_block(s, _vid_fmmod_block);
 	}
 	
 	if(s->conf.offset != 0)
 	{
-		double d;
-		
-		s->offset.counter = INT16_MAX;
-		s->offset.phase.i = INT16_MAX;
-		s->offset.phase.q = 0;
-		
-		d = 2.0 * M_PI / s->sample_rate * s->conf.offset;
-		s->offset.delta.i = lround(cos(d) * INT32_MAX);
-		s->offset.delta.q = lround(sin(d) * INT32_MAX);
-		
-		_add_lineprocess(s, "offset", 1, NULL, _vid_offset_process, NULL);
+		nco_init(&s->offset.nco, s->sample_rate, s->conf.offset, 0);
 	}
 	
 	if(s->conf.passthru)
@@ -4560,6 +5814,21 @@ int vid_init(vid_t *s, unsigned int sample_rate, unsigned int pixel_rate, const
 			return(VID_ERROR);
 		}
 		
+		/* Files written with --compress are read transparently */
+		r = iqz_reader_open(&s->passthru_z, s->passthru);
+		
+		if(r == 0 && (s->passthru_z.type != RF_INT16 || !s->passthru_z.complex))
+		{
+			fprintf(stderr, "%s: Compressed passthru files must be int16 complex.\n", s->conf.passthru);
+			r = -1;
+		}
+		
+		if(r < 0)
+		{
+			vid_free(s);
+			return(VID_ERROR);
+		}
+		
 		/* Allocate memory for the temporary passthru buffer */
 		s->passline = calloc(sizeof(int16_t) * 2, s->max_width);
 		if(!s->passline)
@@ -4567,14 +5836,61 @@ int vid_init(vid_t *s, unsigned int sample_rate, unsigned int pixel_rate, const
 			vid_free(s);
 			return(VID_OUT_OF_MEMORY);
 		}
-		
-		_add_lineprocess(s, "passthru", 1, NULL, _vid_passthru_process, NULL);
+	}
+	
+	if(s->conf.swap_iq != 0 || s->conf.offset != 0 || s->conf.passthru)
+	{
+		/* IQ swap, frequency offset and passthru share one pass */
+		_add_lineprocess(s, "rfpost", 1, NULL, _vid_rfpost_process, NULL);
+		_set_lineprocess_block(s, _vid_rfpost_block);
 	}
 	
 	/* The final process is only for output */
 	_add_lineprocess(s, "output", 1, NULL, NULL, NULL);
 	s->output_process = &s->processes[s->nprocesses - 1];
 	
+	/* Lines per vid_next_block() call, defaulting to the longest field */
+	s->block_lines = s->conf.block_lines;
+	
+	if(s->block_lines <= 0)
+	{
+		s->block_lines = s->conf.lines;
+		
+		if(s->conf.hline > 0)
+		{
+			s->block_lines = s->conf.hline - 1;
+			
+			if(s->block_lines < s->conf.lines - s->conf.hline + 1)
+			{
+				s->block_lines = s->conf.lines - s->conf.hline + 1;
+			}
+		}
+	}
+	
+	s->block = malloc(sizeof(int16_t) * 2 * s->max_width * s->block_lines);
+	if(!s->block)
+	{
+		vid_free(s);
+		return(VID_OUT_OF_MEMORY);
+	}
+	
+	s->frame_starts = malloc(sizeof(vid_frame_start_t) * (s->block_lines / s->conf.lines + 2));
+	if(!s->frame_starts)
+	{
+		vid_free(s);
+		return(VID_OUT_OF_MEMORY);
+	}
+	
+	if(s->conf.threaded || s->block_lines > 1)
+	{
+		r = _init_pipeline(s);
+		if(r != VID_OK)
+		{
+			vid_free(s);
+			return(r);
+		}
+	}
+	
 	/* Output line buffer(s) */
 	s->oline = calloc(sizeof(vid_line_t), s->olines);
 	if(!s->oline)
@@ -4606,8 +5922,9 @@ int vid_init(vid_t *s, unsigned int sample_rate, unsigned int pixel_rate, const
 		s->oline[r].next = &s->oline[(r + 1) % s->olines];
 	}
 	
-	/* Setup lineprocess output windows (non-threaded version) */
-	l = &s->oline[s->olines - 1];
+	/* Setup lineprocess output windows. Any slack lines for
+	 * the threaded pipeline sit ahead of the first process */
+	l = &s->oline[s->olines - s->pipe_slack - 1];
 	
 	for(r = 0; r < s->nprocesses; r++)
 	{
@@ -4621,6 +5938,21 @@ int vid_init(vid_t *s, unsigned int sample_rate, unsigned int pixel_rate, const
 		}
 	}
 	
+	if(s->conf.replay != VID_REPLAY_OFF)
+	{
+		r = _init_replay(s);
+		if(r != VID_OK)
+		{
+			vid_free(s);
+			return(r);
+		}
+	}
+	
+	if(s->conf.threaded && s->nworkers > 0)
+	{
+		_start_pipeline(s);
+	}
+	
 	return(VID_OK);
 }
 
@@ -4628,6 +5960,16 @@ void vid_free(vid_t *s)
 {
 	int i;
 	
+	/* Stop the pipeline threads */
+	if(s->pipe_threads)
+	{
+		_stop_pipeline(s, s->nworkers);
+	}
+	
+	free(s->workers);
+	
+	_free_replay(s);
+	
 	/* Close the AV source */
 	av_close(&s->av);
 	
@@ -4644,7 +5986,8 @@ void vid_free(vid_t *s)
 	
 	if(s->conf.passthru)
 	{
-		fclose(s->passthru);
+		iqz_reader_close(&s->passthru_z);
+		if(s->passthru) fclose(s->passthru);
 		free(s->passline);
 	}
 	
@@ -4700,9 +6043,19 @@ void vid_free(vid_t *s)
 	
 	/* Free allocated memory */
 	free(s->yiq_level_lookup);
+	free(s->yiq_channel_lookup);
+	free(s->yiq_line);
+	free(s->raster);
+	
+	for(i = 0; i < 32; i++)
+	{
+		free(s->raster_tmpl[i].line);
+	}
+	
 	free(s->colour_lookup);
 	fir_int16_free(&s->secam_l_fir);
 	fir_int16_free(&s->fm_secam_fir);
+	secam_bell_free(&s->fm_secam_bell);
 	iir_int16_free(&s->fm_secam_iir);
 	_free_fm_modulator(&s->fm_secam);
 	_free_fm_modulator(&s->fm_video);
@@ -4727,8 +6080,11 @@ void vid_free(vid_t *s)
 		free(s->oline);
 	}
 	
+	free(s->block);
+	free(s->frame_starts);
 	free(s->chrominance_buffer);
 	free(s->burst_win);
+	free(s->burst_chroma);
 	free(s->syncs);
 	free(s->fsc_syncs);
 	
@@ -4749,6 +6105,19 @@ void vid_info(vid_t *s)
 	}
 	
 	fprintf(stderr, "Sample rate: %d\n", s->sample_rate);
+	
+	if(s->conf.colour_mode == VID_PAL ||
+	   s->conf.colour_mode == VID_NTSC)
+	{
+		fprintf(stderr, "Colour kernels: %s\n", s->composite->name);
+	}
+	else if(s->conf.colour_mode == VID_SECAM)
+	{
+		fprintf(stderr, "Colour kernels: %s\n", s->secam->name);
+	}
+	
+	fprintf(stderr, "Filter kernels: %s\n", fir_kernels(cpu_features())->name);
+	fprintf(stderr, "Oscillator kernels: %s\n", nco_kernels(cpu_features())->name);
 }
 
 size_t vid_get_framebuffer_length(vid_t *s)
@@ -4756,62 +6125,95 @@ size_t vid_get_framebuffer_length(vid_t *s)
 	return(sizeof(uint32_t) * s->active_width * s->conf.active_lines);
 }
 
+int vid_av_close(vid_t *s)
+{
+	/* Wait for all the workers to park before
+	 * the source is closed underneath them */
+	_vid_pipe_hold(s);
+	
+	/* The line processes may have stopped part way through a
+	 * frame from this source if it ended while replaying */
+	av_frame_init(&s->vframe, 0, 0, NULL, 0, 0);
+	
+	/* Drop any audio left over from this source */
+	s->audiobuffer = NULL;
+	s->audiobuffer_samples = 0;
+	
+	/* The next source may not be static */
+	if(s->replay.state >= _REPLAY_PLAY)
+	{
+		s->replay.state = _REPLAY_DRAIN;
+		s->replay.next = _REPLAY_WAIT;
+	}
+	else
+	{
+		s->replay.state = _REPLAY_WAIT;
+	}
+	
+	s->replay.reading = 0;
+	s->replay.eof = 0;
+	
+	return(av_close(&s->av));
+}
+
 static vid_line_t *_vid_next_line(vid_t *s, size_t *samples)
 {
 	vid_line_t *l = s->output_process->lines[0];
-	int i, j;
 	
-	/* Load the next frame */
-	if(s->bline == 1 || (s->conf.interlace && s->bline == s->conf.hline))
+	if(_vid_next_frame(s) != 0)
 	{
-		/* Have we reached the end of the video? */
-		if(av_eof(&s->av))
-		{
-			return(NULL);
-		}
-		
-		av_read_video(&s->av, &s->vframe);
-		
-		av_rotate_frame(&s->vframe, s->conf.frame_orientation & 3);
-		if(s->conf.frame_orientation & VID_HFLIP) av_hflip_frame(&s->vframe);
-		if(s->conf.frame_orientation & VID_VFLIP) av_vflip_frame(&s->vframe);
-		
-		/* Crop frame to fit inside active video area */
-		av_crop_frame(&s->vframe,
-			(s->vframe.width - s->active_width) / 2,
-			(s->vframe.height - s->conf.active_lines) / 2,
-			s->active_width,
-			s->conf.active_lines
-		);
-		
-		/* Calculate frame offset from top left */
-		s->vframe_x = (s->active_width - s->vframe.width) / 2;
-		s->vframe_y = (s->conf.active_lines - s->vframe.height) / 2;
+		return(NULL);
 	}
 	
-	for(i = 0; i < s->nprocesses; i++)
+	_vid_run_processes(s, 0, s->nprocesses - 1, 1);
+	_vid_next_bline(s);
+	
+	/* Return a pointer to the output buffer */
+	if(samples)
 	{
-		_lineprocess_t *p = &s->processes[i];
-		
-		if(p->process)
-		{
-			p->process(p->vid, p->arg, p->nlines, p->lines);
-		}
-		
-		for(j = 0; j < p->nlines; j++)
-		{
-			p->lines[j] = p->lines[j]->next;
-		}
+		*samples = l->width;
 	}
 	
-	/* Advance the next line/frame counter */
-	if(s->bline++ == s->conf.lines)
+	return(l);
+}
+
+static vid_line_t *_vid_next_line_threaded(vid_t *s, size_t *samples)
+{
+	vid_line_t *l;
+	unsigned int tick;
+	
+	if(s->pipe_held)
 	{
-		s->bline = 1;
-		s->bframe++;
+		/* Release the previous line back to the first worker */
+		s->output_process->lines[0] = s->output_process->lines[0]->next;
+		atomic_fetch_add(&s->pipe_otick, 1);
+		s->pipe_held = 0;
 	}
 	
-	/* Return a pointer to the output buffer */
+	/* Resume the workers after an EOF or vid_av_close() */
+	if(s->pipe_eof_seen)
+	{
+		atomic_store(&s->pipe_eof, 0);
+		s->pipe_eof_seen = 0;
+	}
+	
+	atomic_store(&s->pipe_hold, 0);
+	_pipe_notify(s);
+	
+	/* Wait for the next line */
+	tick = atomic_load(&s->pipe_otick);
+	_pipe_wait(s, s->nworkers, tick);
+	
+	if((int) (atomic_load(&s->workers[s->nworkers - 1].ticks) - tick) <= 0)
+	{
+		/* Reached the end of the video */
+		s->pipe_eof_seen = 1;
+		return(NULL);
+	}
+	
+	l = s->output_process->lines[0];
+	s->pipe_held = 1;
+	
 	if(samples)
 	{
 		*samples = l->width;
@@ -4827,7 +6229,7 @@ int16_t *vid_next_line(vid_t *s, size_t *samples)
 	/* Drop any delay lines introduced by scramblers / filters */
 	do
 	{
-		l = _vid_next_line(s, samples);
+		l = s->pipe_threads ? _vid_next_line_threaded(s, samples) : _vid_next_line(s, samples);
 		if(l == NULL) return(NULL);
 	}
 	while(l->line < 1);
@@ -4838,3 +6240,137 @@ int16_t *vid_next_line(vid_t *s, size_t *samples)
 	return(l->output);
 }
 
+static int _vid_render_block(vid_t *s, int count)
+{
+	_vid_worker_t *w = &s->workers[0];
+	int i, n;
+	
+	/* Render the lines with the first worker, stopping early at EOF */
+	for(n = 0; n < count; n++)
+	{
+		if(_vid_next_frame(s) != 0) break;
+		
+		_vid_run_processes(s, w->first, w->last, 1);
+		_vid_next_bline(s);
+	}
+	
+	/* The remaining workers process the same lines in turn */
+	for(i = 1; i < s->nworkers && n > 0; i++)
+	{
+		w = &s->workers[i];
+		_vid_run_processes(s, w->first, w->last, n);
+	}
+	
+	return(n);
+}
+
+static size_t _vid_block_line(vid_t *s, vid_line_t *l, size_t offset)
+{
+	int frame;
+	
+	/* Drop any delay lines introduced by scramblers / filters */
+	if(l->line < 1)
+	{
+		return(offset);
+	}
+	
+	/* The line processes don't count the frames played from the cache */
+	frame = l->frame + s->replay.skipped;
+	
+	if(s->replay.buf)
+	{
+		_replay_line(s, l, frame);
+	}
+	
+	memcpy(&s->block[offset * 2], l->output, sizeof(int16_t) * 2 * l->width);
+	
+	if(l->line == 1)
+	{
+		s->frame_starts[s->nframe_starts].offset = offset;
+		s->frame_starts[s->nframe_starts].frame = frame;
+		s->nframe_starts++;
+	}
+	
+	s->frame = frame;
+	s->line  = l->line;
+	
+	return(offset + l->width);
+}
+
+int16_t *vid_next_block(vid_t *s, size_t *samples)
+{
+	vid_line_t *l;
+	size_t len = 0;
+	int n, i;
+	
+	n = s->block_lines;
+	s->nframe_starts = 0;
+	
+	if(s->conf.block_lines <= 0)
+	{
+		/* Stop at the end of the current field */
+		i = s->line < s->conf.lines ? s->line + 1 : 1;
+		
+		if(s->conf.hline > 0 && i < s->conf.hline)
+		{
+			n = s->conf.hline - i;
+		}
+		else
+		{
+			n = s->conf.lines + 1 - i;
+		}
+	}
+	
+	if(s->replay.state >= _REPLAY_PLAY)
+	{
+		int16_t *data = _replay_block(s, n, samples);
+		
+		if(data || s->replay.eof)
+		{
+			return(data);
+		}
+	}
+	
+	if(!s->pipe_threads && s->nworkers > 0)
+	{
+		while(len == 0)
+		{
+			n = _vid_render_block(s, n);
+			if(n == 0) break;
+			
+			for(i = 0; i < n; i++)
+			{
+				len = _vid_block_line(s, s->output_process->lines[0], len);
+				s->output_process->lines[0] = s->output_process->lines[0]->next;
+			}
+		}
+	}
+	else
+	{
+		for(i = 0; i < n; i++)
+		{
+			l = s->pipe_threads ? _vid_next_line_threaded(s, NULL) : _vid_next_line(s, NULL);
+			if(l == NULL) break;
+			
+			if(l->line < 1)
+			{
+				i--;
+				continue;
+			}
+			
+			len = _vid_block_line(s, l, len);
+		}
+	}
+	
+	if(len == 0)
+	{
+		return(NULL);
+	}
+	
+	if(samples)
+	{
+		*samples = len;
+	}
+	
+	return(s->block);
+}
@@ -20,11 +20,17 @@
 
 #include <stdint.h>
 #include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
 
 #include "av.h"
 #include "nicam728.h"
 #include "dance.h"
 #include "fir.h"
+#include "nco.h"
+#include "composite.h"
+#include "secam.h"
+#include "iqz.h"
 
 #ifdef WIN32
 #define OS_SEP '\\'
@@ -92,6 +98,11 @@ typedef struct vid_t vid_t;
 #define VID_APOLLO_FSC 4
 #define VID_CBS_FSC    5
 
+/* Replay cache modes */
+#define VID_REPLAY_OFF  0
+#define VID_REPLAY_AUTO 1 /* Replay once a whole cycle repeats exactly, while the source doesn't change */
+#define VID_REPLAY_ON   2 /* The source is static, replay the first cycle */
+
 /* Audio pre-emphasis modes */
 //#define VID_NONE 0
 #define VID_50US 1
@@ -102,9 +113,7 @@ typedef struct vid_t vid_t;
 
 typedef struct {
 	int16_t level;
-	int32_t counter;
-	cint32_t phase;
-	cint32_t *lut;
+	nco_t nco;
 	
 	limiter_t limiter;
 	int16_t sample;
@@ -118,18 +127,14 @@ typedef struct {
 
 typedef struct {
 	int16_t level;
-	int32_t counter;
-	cint32_t phase;
-	cint32_t delta;
+	nco_t nco;
 	
 	int16_t sample;
 	
 } _mod_am_t;
 
 typedef struct {
-	int32_t counter;
-	cint32_t phase;
-	cint32_t delta;
+	nco_t nco;
 } _mod_offset_t;
 
 
@@ -306,6 +311,21 @@ typedef struct {
 	/* Video filter enable flag */
 	int vfilter;
 	
+	/* Run the line processes on worker threads */
+	int threaded;
+	
+	/* Lines rendered per vid_next_block() call, 0 for one field */
+	int block_lines;
+	
+	/* Use the compact colour conversion tables */
+	int compact_colour;
+	
+	/* Cache and replay the output of static sources */
+	int replay;
+	
+	/* Report more about what the encoder is doing */
+	int verbose;
+	
 } vid_config_t;
 
 typedef struct {
@@ -314,12 +334,67 @@ typedef struct {
 	const char *desc;
 } vid_configs_t;
 
+/* The start of a frame within an output block */
+typedef struct {
+	size_t offset;
+	uint32_t frame;
+} vid_frame_start_t;
+
 typedef struct {
 	int16_t y;
 	int16_t i;
 	int16_t q;
 } _yiq16_t;
 
+typedef struct {
+	int32_t y;
+	int32_t i;
+	int32_t q;
+} _yiq32_t;
+
+typedef struct {
+	uint8_t sync; /* Sync pulse bits for vid_t.syncs */
+	uint8_t burst; /* Colour burst, bit 0 = even frames, bit 1 = odd */
+	uint8_t active; /* Active video, bit 0 = left half, bit 1 = right */
+	int al, ar; /* Active video extents in samples, or -1 */
+	int vy; /* Active line number before centring, or -1 */
+} _vid_raster_line_t;
+
+typedef struct {
+	int16_t *line; /* Blanking and sync pulses, IQ */
+	int16_t *prev; /* Sync pulse samples that run into the end of the previous line */
+	int nprev;
+	int16_t *next; /* And into the start of the next line */
+	int nnext;
+} _vid_line_template_t;
+
+typedef struct {
+	int frames; /* Length of the cycle in frames */
+	int lines;  /* ... and in lines */
+	int16_t *buf; /* The cached output, IQ */
+	size_t size; /* Size of buf in bytes */
+	size_t *offset; /* Offset of each line in buf in samples, lines + 1 entries */
+	int state;
+	int next; /* State after draining */
+	int pos; /* Next line of the cycle */
+	int resume; /* Line of the cycle where live rendering continues */
+	int frame; /* Frame number at the start of the current cycle */
+	int skipped; /* Frames played from the cache, added to the live frame numbers */
+	int verified; /* Lines compared so far */
+	int recheck; /* Verifying a cycle that was already playing */
+	
+	/* Auto mode, the source is still read while playing */
+	int reading;
+	int eof; /* The source ended while playing */
+	int held; /* The pipeline has been held since playback started */
+	int cycles; /* Cycles played since the last live check */
+	int play_cycles; /* ... and between live checks */
+	av_frame_t ref; /* Copy of the last source frame */
+	uint32_t *ref_buf;
+	atomic_uint changes; /* Incremented each time the source frame changes */
+	unsigned int capture_changes;
+} _vid_replay_t;
+
 struct vid_line_t {
 	
 	/* The output line buffer */
@@ -343,6 +418,7 @@ struct vid_line_t {
 
 /* Line process function prototypes */
 typedef int (*vid_lineprocess_process_t)(vid_t *s, void *arg, int nlines, vid_line_t **lines);
+typedef int (*vid_lineprocess_block_t)(vid_t *s, void *arg, int nlines, vid_line_t **lines, int count);
 typedef void (*vid_lineprocess_free_t)(vid_t *s, void *arg);
 typedef struct _lineprocess_t _lineprocess_t;
 
@@ -357,6 +433,7 @@ struct _lineprocess_t {
 	
 	/* Process callbacks */
 	vid_lineprocess_process_t process;
+	vid_lineprocess_block_t process_block;
 	vid_lineprocess_free_t free;
 	
 	/* Callback parameters */
@@ -364,6 +441,20 @@ struct _lineprocess_t {
 	void *arg;
 };
 
+typedef struct {
+	
+	vid_t *vid;
+	pthread_t thread;
+	
+	/* Range of line processes run by this worker */
+	int first;
+	int last;
+	
+	/* Number of lines completed by this worker */
+	atomic_uint ticks;
+	
+} _vid_worker_t;
+
 struct vid_t {
 	/* AV source */
 	av_t av;
@@ -388,12 +479,27 @@ struct vid_t {
 	int16_t sync_level;
 	
 	_yiq16_t *yiq_level_lookup;
+	_yiq32_t *yiq_channel_lookup;
+	_yiq16_t yiq_black;
+	_yiq16_t *yiq_line;
+	
+	/* Raster line descriptors, indexed by line - 1 */
+	_vid_raster_line_t *raster;
+	
+	/* Pre-rendered raster lines, indexed by sync pulse bits */
+	_vid_line_template_t raster_tmpl[32];
+	uint8_t raster_sync;
 	
 	unsigned int colour_lookup_width;
 	unsigned int colour_lookup_offset;
 	cint16_t *colour_lookup;
 	
+	/* Luma, chroma and subcarrier kernels for this CPU */
+	const composite_kernels_t *composite;
+	const secam_kernels_t *secam;
+	
 	cint16_t burst_phase;
+	int16_t *burst_chroma;
 	int burst_left;
 	int burst_width;
 	int16_t *burst_win;
@@ -404,7 +510,7 @@ struct vid_t {
 	int16_t fm_secam_dmin[2];
 	int16_t fm_secam_dmax[2];
 	fir_int16_t secam_l_fir;
-	cint16_t *fm_secam_bell;
+	secam_bell_t fm_secam_bell;
 	int16_t secam_fsync_level;
 	
 	vbidata_lut_t *fsc_syncs;
@@ -425,6 +531,10 @@ struct vid_t {
 	uint32_t frame;
 	int line;
 	
+	/* Frames starting in the block returned by vid_next_block() */
+	vid_frame_start_t *frame_starts;
+	int nframe_starts;
+	
 	/* Raw baseband video file */
 	FILE *raw_bb_file;
 	
@@ -455,6 +565,7 @@ struct vid_t {
 	
 	/* Audio state */
 	int audio;
+	int audio_flags;
 	int16_t *audiobuffer;
 	size_t audiobuffer_samples;
 	int interp;
@@ -494,6 +605,7 @@ struct vid_t {
 	/* Passthru source */
 	FILE *passthru;
 	int16_t *passline;
+	iqz_reader_t passthru_z;
 	
 	/* D/D2-MAC specific data */
 	mac_t mac;
@@ -507,6 +619,30 @@ struct vid_t {
 	int nprocesses;
 	_lineprocess_t *processes;
 	_lineprocess_t *output_process;
+	
+	/* Block output buffer */
+	int block_lines;
+	int16_t *block;
+	
+	/* Replay cache for static sources */
+	_vid_replay_t replay;
+	
+	/* Threaded pipeline state */
+	int nworkers;
+	_vid_worker_t *workers;
+	int pipe_threads;
+	int pipe_slack;
+	int pipe_parked;
+	int pipe_held;
+	int pipe_eof_seen;
+	atomic_uint pipe_otick;
+	atomic_uint pipe_eof_tick;
+	atomic_int pipe_eof;
+	atomic_int pipe_hold;
+	atomic_int pipe_abort;
+	atomic_int pipe_waiters;
+	pthread_mutex_t pipe_mutex;
+	pthread_cond_t pipe_cond;
 };
 
 extern const vid_configs_t vid_configs[];
@@ -516,7 +652,10 @@ extern void vid_free(vid_t *s);
 extern int vid_av_close(vid_t *s);
 extern void vid_info(vid_t *s);
 extern size_t vid_get_framebuffer_length(vid_t *s);
+extern _yiq16_t vid_rgb_to_yiq(vid_t *s, uint32_t rgb);
+extern void vid_rgb_to_yiq_line(vid_t *s, _yiq16_t *yiq, const uint32_t *rgb, int stride, int n);
 extern int16_t *vid_next_line(vid_t *s, size_t *samples);
+extern int16_t *vid_next_block(vid_t *s, size_t *samples);
 
 #endif
 